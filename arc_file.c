@@ -5,6 +5,9 @@
 #include "ini_parser.h"
 #include "arc_file.h"
 #include "debug.h"
+#ifdef HAVE_CORE_CACHE
+#include "core_cache.h"
+#endif
 
 #define MAX_CONF_SIZE 512
 #define MAX_BUTTONS_SIZE 128
@@ -24,6 +27,10 @@ typedef struct {
 static arc_t arc;
 static int conf_ptr;
 
+#ifdef HAVE_CORE_CACHE
+typedef char arc_cache_size_check[(sizeof(arc_t) <= CORE_CACHE_ARC_SIZE) ? 1 : -1];
+#endif
+
 char arc_set_conf(char *, char, int);
 
 // arc ini sections
@@ -58,6 +65,22 @@ char arc_set_conf(char *c, char action, int tag)
 int64_t arc_open(const char *fname)
 {
 	ini_cfg_t arc_ini_cfg;
+#ifdef HAVE_CORE_CACHE
+	core_cache_id_t id;
+	FIL file;
+
+	// the settings of a recently loaded core may be cached
+	id.sclust = 0;
+	if (f_open(&file, fname, FA_READ) == FR_OK) {
+		core_cache_id(&file, &id);
+		f_close(&file);
+	}
+	if (core_cache_arc_get(&id, &arc, sizeof(arc))) {
+		conf_ptr = strlen(arc.conf);
+		iprintf("ARC CONF STR: %s\n",arc.conf);
+		return arc.mod;
+	}
+#endif
 
 	arc_ini_cfg.filename = fname;
 	arc_ini_cfg.sections = arc_ini_sections;
@@ -69,6 +92,9 @@ int64_t arc_open(const char *fname)
 	arc.mod = -1; // indicate error by default, valid ARC file will overrdide with the correct MOD value
 	ini_parse(&arc_ini_cfg, 0, 0);
 	iprintf("ARC CONF STR: %s\n",arc.conf);
+#ifdef HAVE_CORE_CACHE
+	core_cache_arc_put(&id, &arc, sizeof(arc));
+#endif
 	return arc.mod;
 }
 
@@ -8,6 +8,7 @@
 #include "hdd.h"
 #include "user_io.h"
 #include "data_io.h"
+#include "idxfile.h"
 #include "debug.h"
 
 #define CONFIG_FILENAME  "ARCHIE  CFG"
@@ -187,12 +188,62 @@ static void archie_kbd_reset(void) {
   flags = 0;
 }
 
+#ifdef HAVE_IDX_CACHE
+// FileCore metadata is kept in the image cache: the first sectors with the
+// boot block (and the map of E format floppies), the map of hard discs as
+// given by the disc record in the boot block, and directories by their
+// "Hugo"/"Nick" (or big directory "SBPr") header.
+static struct {
+  unsigned long start, end;  // map sectors, both copies
+} archie_map[SD_IMAGES];
+
+static void archie_find_map(int unit, const unsigned char *dr) {
+  unsigned char log2secsize = dr[0];
+  unsigned char log2bpmb = dr[5];
+  unsigned int nzones = dr[9] | (dr[0x2a] << 8);
+  unsigned int zone_spare = dr[10] | (dr[11] << 8);
+  long addr;
+
+  archie_map[unit].start = archie_map[unit].end = 0;
+  if (log2secsize < 8 || log2secsize > 12 || !nzones || zone_spare >= (8 << log2secsize))
+    return;
+
+  // the map is in the middle zone, in map bits
+  addr = (long)(nzones >> 1) * ((8 << log2secsize) - zone_spare) - ((nzones > 1) ? 480 : 0);
+  if (addr < 0) return;
+  if (log2bpmb >= log2secsize) addr <<= log2bpmb - log2secsize;
+  else addr >>= log2secsize - log2bpmb;
+
+  // in 512 byte sectors
+  archie_map[unit].start = (addr << log2secsize) >> 9;
+  archie_map[unit].end = archie_map[unit].start + ((2 * nzones << log2secsize) >> 9);
+  archie_debugf("map of image %d at %lu-%lu", unit, archie_map[unit].start, archie_map[unit].end);
+}
+
+static char archie_cache_pin(IDXFile *file, unsigned long lba, const unsigned char *data) {
+  int unit = file - sd_image;
+  char pin = 0;
+
+  for (int i = 0; i < IDX_CACHE_LINE; i++, lba++, data += 512) {
+    if (lba < 8) pin = 1;
+    if (lba == 6) archie_find_map(unit, data + 0x1c0);  // boot block at 0xc00, disc record at 0xdc0
+    if (lba >= archie_map[unit].start && lba < archie_map[unit].end) pin = 1;
+    if (!memcmp(data + 1, "Hugo", 4) || !memcmp(data + 1, "Nick", 4) || !memcmp(data + 4, "SBPr", 4))
+      pin = 1;
+  }
+  return pin;
+}
+#endif
+
 void archie_init(void) {
   FIL file;
   UINT br;
   char i;
 
   archie_debugf("init");
+#ifdef HAVE_IDX_CACHE
+  IDXCacheSetPin(archie_cache_pin);
+#endif
 
   ResetMenu();
   ChangeDirectoryName("/");
@@ -0,0 +1,232 @@
+// cd_cache.c
+// Sector cache and formatted sector reads for the mounted CD image
+
+#include <string.h>
+#include <stdio.h>
+#include "cd_cache.h"
+#include "cue_parser.h"
+#include "utils.h"
+#include "debug.h"
+
+#if CD_CACHE_LINES
+typedef struct
+{
+  int lba;              // first sector stored in the line
+  int count;            // number of sectors in the line, 0 = empty
+  int track;
+  unsigned long stamp;  // last access, for LRU eviction
+  unsigned char data[CD_CACHE_LINE_SECTORS * CD_SECTOR_RAW];
+  unsigned char sub[CD_CACHE_LINE_SECTORS * CD_SUBCHANNEL];
+} cd_cache_line_t;
+
+static cd_cache_line_t cd_cache[CD_CACHE_LINES];
+static unsigned long cd_cache_stamp = 0;
+
+// the .SUB file
+static IDXFile cd_sub;
+static char cd_sub_valid = 0;
+#endif
+
+void cd_cache_invalidate() {
+#if CD_CACHE_LINES
+  for (int i = 0; i < CD_CACHE_LINES; i++) cd_cache[i].count = 0;
+#endif
+}
+
+// returns the position of the requested data inside the sector as stored
+// in the image, and where/how much of it goes to the output buffer
+static int cd_sector_layout(int track, int blocksize, int *dst, int *len) {
+  int sector_size = toc.tracks[track].sector_size;
+  int skip = 0;
+
+  if (blocksize == CD_SECTOR_DATA) {
+    if (sector_size == 2352) skip += 16;
+    // CD-XA with 8 subheader bytes
+    if (sector_size >= 2336 && toc.tracks[track].type == SECTOR_DATA_MODE2) skip += 8;
+    *dst = 0;
+    *len = CD_SECTOR_DATA;
+  } else {
+    *dst = (sector_size == CD_SECTOR_RAW) ? 0 : 16;
+    *len = sector_size;
+  }
+  return skip;
+}
+
+#if CD_CACHE_LINES
+static cd_cache_line_t *cd_cache_lookup(int lba, int track) {
+  for (int i = 0; i < CD_CACHE_LINES; i++) {
+    cd_cache_line_t *line = &cd_cache[i];
+    if (line->count && line->track == track && lba >= line->lba && lba < (line->lba + line->count))
+      return line;
+  }
+  return 0;
+}
+
+static cd_cache_line_t *cd_cache_fill(int lba, int track, int offset) {
+  UINT br;
+  int sector_size = toc.tracks[track].sector_size;
+  cd_cache_line_t *line = &cd_cache[0];
+
+  // take an empty line, or the least recently used one
+  for (int i = 0; i < CD_CACHE_LINES; i++) {
+    if (!cd_cache[i].count) {
+      line = &cd_cache[i];
+      break;
+    }
+    if (cd_cache[i].stamp < line->stamp) line = &cd_cache[i];
+  }
+
+  // fill the line with the following sectors of the same track in one go
+  int count = MIN(CD_CACHE_LINE_SECTORS, toc.tracks[track].end - lba);
+  if (count < 1) count = 1;
+
+  DISKLED_ON
+  if (f_lseek(&toc.file->file, offset) != FR_OK ||
+      f_read(&toc.file->file, line->data, count * sector_size, &br) != FR_OK)
+    br = 0;
+  DISKLED_OFF
+
+  line->lba = lba;
+  line->track = track;
+  line->count = br / sector_size;
+
+  // the subchannel data of the same sectors, with one read as well
+  if (cd_sub_valid && line->count) {
+    if (sector_size != CD_SECTOR_RAW ||
+        f_lseek(&cd_sub.file, (FSIZE_t)(offset / CD_SECTOR_RAW) * CD_SUBCHANNEL) != FR_OK ||
+        f_read(&cd_sub.file, line->sub, line->count * CD_SUBCHANNEL, &br) != FR_OK)
+      br = 0;
+    if (br < line->count * CD_SUBCHANNEL)
+      memset(line->sub + br, 0, line->count * CD_SUBCHANNEL - br);
+  }
+
+  return line->count ? line : 0;
+}
+#endif
+
+// find the track and the image offset of a sector
+static char cd_locate(int lba, int *track, int *offset) {
+  if (!toc.valid) return CD_RES_NODISC;
+
+  *track = cue_gettrackbylba(lba);
+  if (*track >= toc.last || !toc.tracks[*track].sector_size) return CD_RES_RANGE;
+
+  *offset = (lba - toc.tracks[*track].start) * toc.tracks[*track].sector_size + toc.tracks[*track].offset;
+  if (*offset < 0) return CD_RES_RANGE;
+
+  return CD_RES_OK;
+}
+
+char cd_read_sector(int lba, unsigned char *buffer, int blocksize) {
+  int track, offset, skip, dst, len;
+  char res;
+
+  if ((res = cd_locate(lba, &track, &offset)) != CD_RES_OK) {
+    memset(buffer, 0, blocksize);
+    return res;
+  }
+
+  skip = cd_sector_layout(track, blocksize, &dst, &len);
+
+#if CD_CACHE_LINES
+  cd_cache_line_t *line = cd_cache_lookup(lba, track);
+  if (!line) line = cd_cache_fill(lba, track, offset);
+  if (!line) {
+    memset(buffer, 0, blocksize);
+    return CD_RES_READERR;
+  }
+  line->stamp = ++cd_cache_stamp;
+  memcpy(buffer + dst, line->data + (lba - line->lba) * toc.tracks[track].sector_size + skip, len);
+#else
+  UINT br;
+  DISKLED_ON
+  res = f_lseek(&toc.file->file, offset + skip);
+  if (res == FR_OK) res = f_read(&toc.file->file, buffer + dst, len, &br);
+  DISKLED_OFF
+  if (res != FR_OK) {
+    memset(buffer, 0, blocksize);
+    return CD_RES_READERR;
+  }
+#endif
+  return CD_RES_OK;
+}
+
+void cd_cache_prefetch(int lba) {
+#if CD_CACHE_LINES
+  int track, offset;
+  cd_cache_line_t *line;
+
+  if (cd_locate(lba, &track, &offset) != CD_RES_OK) return;
+  if (cd_cache_lookup(lba, track)) return;
+
+  if ((line = cd_cache_fill(lba, track, offset))) line->stamp = ++cd_cache_stamp;
+#endif
+}
+
+char cd_sub_mount(const char *name) {
+#if CD_CACHE_LINES
+  static char subname[FF_LFN_BUF + 1];
+  const char *ext = GetExtension(name);
+  int len = ext ? (ext - name - 1) : strlen(name);
+
+  cd_sub_umount();
+
+  // the .SUB holds 96 bytes for each raw sector of a single image, in the
+  // same order (the CUE parser refuses more than one BIN)
+  if (!toc.valid || len + 4 > FF_LFN_BUF) return 0;
+  for (int i = 0; i < toc.last; i++)
+    if (toc.tracks[i].sector_size != CD_SECTOR_RAW) return 0;
+
+  memcpy(subname, name, len);
+  strcpy(&subname[len], ".SUB");
+  if (IDXOpen(&cd_sub, subname, FA_READ) != FR_OK) return 0;
+  if (f_size(&cd_sub.file) != f_size(&toc.file->file) / CD_SECTOR_RAW * CD_SUBCHANNEL) {
+    iprintf("CD: %s doesn't match the image\n", subname);
+    IDXClose(&cd_sub);
+    return 0;
+  }
+  iprintf("CD: using subchannel file %s\n", subname);
+  IDXIndex(&cd_sub);
+  cd_sub_valid = 1;
+  cd_cache_invalidate();
+  return cd_sub_valid;
+#else
+  return 0;
+#endif
+}
+
+void cd_sub_umount() {
+#if CD_CACHE_LINES
+  if (cd_sub_valid) {
+    IDXClose(&cd_sub);
+    cd_sub_valid = 0;
+    cd_cache_invalidate();
+  }
+#endif
+}
+
+char cd_has_subchannel() {
+#if CD_CACHE_LINES
+  return cd_sub_valid;
+#else
+  return 0;
+#endif
+}
+
+char cd_read_subchannel(int lba, unsigned char *buffer) {
+#if CD_CACHE_LINES
+  int track, offset;
+  cd_cache_line_t *line;
+
+  if (cd_sub_valid && cd_locate(lba, &track, &offset) == CD_RES_OK) {
+    if (!(line = cd_cache_lookup(lba, track))) line = cd_cache_fill(lba, track, offset);
+    if (line) {
+      line->stamp = ++cd_cache_stamp;
+      memcpy(buffer, line->sub + (lba - line->lba) * CD_SUBCHANNEL, CD_SUBCHANNEL);
+      return CD_RES_OK;
+    }
+  }
+#endif
+  memset(buffer, 0, CD_SUBCHANNEL);
+  return CD_RES_NODISC;
+}
@@ -0,0 +1,48 @@
+#ifndef CD_CACHE_H
+#define CD_CACHE_H
+
+#include "hardware.h"
+
+// Sector cache for the CD image mounted via cue_parse(), shared by all
+// CD engines (IDE ATAPI, PCECD, NeoCD, PSX).
+// The cache is organized in lines of consecutive sectors of the same track,
+// each line is filled by a single read and lines are evicted in LRU order.
+// The size is set by the hardware layer, without it every request reads
+// directly from the image.
+
+#ifndef CD_CACHE_LINES
+#define CD_CACHE_LINES 0
+#endif
+
+#ifndef CD_CACHE_LINE_SECTORS
+#define CD_CACHE_LINE_SECTORS 1
+#endif
+
+#define CD_SECTOR_RAW  2352
+#define CD_SECTOR_DATA 2048
+#define CD_SUBCHANNEL  96    // P-W subchannel of a sector, deinterleaved (.SUB)
+
+#define CD_RES_OK      0
+#define CD_RES_NODISC  1
+#define CD_RES_RANGE   2
+#define CD_RES_READERR 3
+
+void cd_cache_invalidate();
+// Read one sector formatted for blocksize:
+// CD_SECTOR_DATA - user data only, sync/header/subheader stripped
+// CD_SECTOR_RAW  - full sector, for 2048/2336 byte tracks the data is placed
+//                  after the 16 byte header, which is left for the caller
+// The buffer is zero filled if the sector cannot be read.
+char cd_read_sector(int lba, unsigned char *buffer, int blocksize);
+// Fill a cache line starting at lba if it's not cached yet (read-ahead).
+void cd_cache_prefetch(int lba);
+
+// Optional subchannel stream (<name>.SUB, CloneCD layout), read together
+// with the main data into the cache lines. Needs the cache.
+char cd_sub_mount(const char *name);
+void cd_sub_umount();
+char cd_has_subchannel();
+// Read the 96 bytes subchannel data of a sector, zero filled if not available
+char cd_read_subchannel(int lba, unsigned char *buffer);
+
+#endif // CD_CACHE_H
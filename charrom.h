@@ -68,8 +68,8 @@ unsigned char charrom[128][8] =
         {0x3e,0x3e,0x22,0x22,0x22,0x3e,0x3e,0x00},         // 25   [0x19] unchecked checkbox
         {0x3e,0x3e,0x3e,0x3e,0x3e,0x3e,0x3e,0x00},         // 26   [0x1a] checked checkbox
         {0x00,0x00,0x00,0x0c,0x0c,0x00,0x00,0x00},         // 27   [0x1b] middle dot
-        {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},         // 28   [0x1c]
-        {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},         // 29   [0x1d]
+        {0x3e,0x3e,0x3e,0x3e,0x3e,0x3e,0x3e,0x3e},         // 28   [0x1c] progress bar, done
+        {0x22,0x22,0x22,0x22,0x22,0x22,0x22,0x22},         // 29   [0x1d] progress bar, to do
         {0x7f,0x51,0x57,0x55,0x57,0x51,0x7e,0x00},         // 30   [0x1e] floppy disk
         {0x1c,0x22,0x41,0x49,0x41,0x22,0x1c,0x00},         // 31   [0x1f] cdrom
         {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},         // 32   [0x20]
@@ -19,6 +19,7 @@
 #include "usb/usb.h"
 #include "misc_cfg.h"
 #include "menu-minimig.h"
+#include "kickstart.h"
 
 configTYPE config;
 static configTYPE tmpconf;
@@ -96,6 +97,14 @@ static void ClearVectorTable(void)
   SPIN(); SPIN(); SPIN(); SPIN();
 }
 
+// the checksum of the decrypted ROM as it was sent to the core
+static void CheckKickstart(unsigned long sum)
+{
+  iprintf("Kickstart checksum %08lx\n", sum);
+  if (sum != KICK_CHECKSUM_OK)
+    BootPrint("Kickstart checksum error!");
+}
+
 //// UploadKickstart() ////
 char UploadKickstart(char *name)
 {
@@ -136,7 +145,7 @@ char UploadKickstart(char *name)
         PrepareBootUpload(0xF8, 0x08);
         SendFile(&romfile);
       } else {
-        SendFileV2(&romfile, NULL, 0, 0xf80000, f_size(&romfile)>>9);
+        CheckKickstart(SendFileV2(&romfile, NULL, 0, 0xf80000, f_size(&romfile)>>9));
         f_rewind(&romfile);
         SendFileV2(&romfile, NULL, 0, 0xe00000, f_size(&romfile)>>9);
         ClearVectorTable();
@@ -150,7 +159,7 @@ char UploadKickstart(char *name)
         PrepareBootUpload(0xF8, 0x08);
         SendFileEncrypted(&romfile,romkey,keysize);
       } else {
-        SendFileV2(&romfile, romkey, keysize, 0xf80000, f_size(&romfile)>>9);
+        CheckKickstart(SendFileV2(&romfile, romkey, keysize, 0xf80000, f_size(&romfile)>>9));
         f_rewind(&romfile);
         SendFileV2(&romfile, romkey, keysize, 0xe00000, f_size(&romfile)>>9);
         ClearVectorTable();
@@ -164,7 +173,7 @@ char UploadKickstart(char *name)
         PrepareBootUpload(0xF8, 0x04);
         SendFile(&romfile);
       } else {
-        SendFileV2(&romfile, NULL, 0, 0xf80000, f_size(&romfile)>>9);
+        CheckKickstart(SendFileV2(&romfile, NULL, 0, 0xf80000, f_size(&romfile)>>9));
         f_rewind(&romfile);
         SendFileV2(&romfile, NULL, 0, 0xfc0000, f_size(&romfile)>>9);
         ClearVectorTable();
@@ -179,7 +188,7 @@ char UploadKickstart(char *name)
         PrepareBootUpload(0xF8, 0x04);
         SendFileEncrypted(&romfile,romkey,keysize);
       } else {
-        SendFileV2(&romfile, romkey, keysize, 0xf80000, f_size(&romfile)>>9);
+        CheckKickstart(SendFileV2(&romfile, romkey, keysize, 0xf80000, f_size(&romfile)>>9));
         f_rewind(&romfile);
         SendFileV2(&romfile, romkey, keysize, 0xfc0000, f_size(&romfile)>>9);
         ClearVectorTable();
@@ -635,7 +644,7 @@ unsigned char SaveConfiguration(char *filename)
 
 void EjectAllFloppies() {
   for(int i=0;i<drives;i++)
-    df[i].status = 0;
+    EjectFloppy(&df[i]);
 
   // harddisk
   config.hardfile[0].present = 0;
@@ -0,0 +1,114 @@
+// core_cache.c
+// ARC settings and bitstream link maps of the recently loaded cores
+
+#include <stdio.h>
+#include <string.h>
+#include "core_cache.h"
+#include "fat_compat.h"
+
+typedef struct
+{
+  core_cache_id_t id;
+  unsigned char   age;    // 0 - unused, highest - most recently used
+} core_cache_slot_t;
+
+static core_cache_slot_t arc_slots[CORE_CACHE_ENTRIES];
+static unsigned char     arc_data[CORE_CACHE_ENTRIES][CORE_CACHE_ARC_SIZE];
+
+static core_cache_slot_t rbf_slots[CORE_CACHE_ENTRIES];
+static DWORD             rbf_clmt[CORE_CACHE_ENTRIES][CORE_CACHE_CLMT];
+
+static unsigned char     core_cache_age = 0;
+
+static DWORD core_cache_get32(const BYTE *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((DWORD)p[3] << 24);
+}
+
+void core_cache_id(FIL *file, core_cache_id_t *id) {
+  memset(id, 0, sizeof(core_cache_id_t));
+  id->sclust = file->obj.sclust;
+  id->size = f_size(file);
+  id->fs_id = file->obj.id;
+  // the directory entry is still in the window (or in the exFAT entry set)
+  if (fs.fs_type == FS_EXFAT)
+    id->mtime = core_cache_get32(fs.dirbuf + 12);  // XDIR_ModTime
+  else if (file->dir_ptr && file->dir_sect == fs.winsect)
+    id->mtime = core_cache_get32(file->dir_ptr + 22);  // DIR_ModTime
+}
+
+static void core_cache_touch(core_cache_slot_t *slot) {
+  // renumber all slots before the age wraps
+  if (core_cache_age == 0xff) {
+    for (int i = 0; i < CORE_CACHE_ENTRIES; i++) {
+      if (arc_slots[i].age) arc_slots[i].age = 1;
+      if (rbf_slots[i].age) rbf_slots[i].age = 1;
+    }
+    core_cache_age = 1;
+  }
+  slot->age = ++core_cache_age;
+}
+
+// the slot of the file, or -1
+static int core_cache_find(core_cache_slot_t *slots, const core_cache_id_t *id) {
+  for (int i = 0; i < CORE_CACHE_ENTRIES; i++)
+    if (slots[i].age && !memcmp(&slots[i].id, id, sizeof(core_cache_id_t)))
+      return i;
+  return -1;
+}
+
+// the least recently used slot
+static int core_cache_victim(core_cache_slot_t *slots) {
+  int victim = 0;
+  for (int i = 1; i < CORE_CACHE_ENTRIES; i++)
+    if (slots[i].age < slots[victim].age)
+      victim = i;
+  return victim;
+}
+
+char core_cache_arc_get(const core_cache_id_t *id, void *arc, unsigned int len) {
+  int i;
+
+  if (!id->sclust || len > CORE_CACHE_ARC_SIZE || (i = core_cache_find(arc_slots, id)) < 0)
+    return 0;
+  memcpy(arc, arc_data[i], len);
+  core_cache_touch(&arc_slots[i]);
+  iprintf("Core cache: ARC settings cached\n");
+  return 1;
+}
+
+void core_cache_arc_put(const core_cache_id_t *id, const void *arc, unsigned int len) {
+  int i;
+
+  if (!id->sclust || len > CORE_CACHE_ARC_SIZE) return;
+  if ((i = core_cache_find(arc_slots, id)) < 0) {
+    i = core_cache_victim(arc_slots);
+    arc_slots[i].id = *id;
+  }
+  memcpy(arc_data[i], arc, len);
+  core_cache_touch(&arc_slots[i]);
+}
+
+void core_cache_linkmap(FIL *file) {
+  core_cache_id_t id;
+  int i;
+
+  core_cache_id(file, &id);
+  if (!id.sclust) return;
+
+  if ((i = core_cache_find(rbf_slots, &id)) >= 0) {
+    iprintf("Core cache: bitstream link map cached\n");
+  } else {
+    i = core_cache_victim(rbf_slots);
+    rbf_slots[i].age = 0;
+    rbf_clmt[i][0] = CORE_CACHE_CLMT;
+    file->cltbl = rbf_clmt[i];
+    // too fragmented files are read by following the FAT
+    if (f_lseek(file, CREATE_LINKMAP) != FR_OK) {
+      file->cltbl = 0;
+      return;
+    }
+    rbf_slots[i].id = id;
+  }
+  file->cltbl = rbf_clmt[i];
+  core_cache_touch(&rbf_slots[i]);
+}
@@ -0,0 +1,35 @@
+#ifndef CORE_CACHE_H
+#define CORE_CACHE_H
+
+// Recently loaded cores. The parsed ARC settings and the cluster link map
+// of the bitstream are kept for the last cores, so switching back to one
+// of them skips parsing the ARC file and following the FAT chain of the
+// bitstream. A cached entry is only used if the file still has the same
+// start cluster, size and modification time, on the same mounted volume.
+
+#include <inttypes.h>
+#include "FatFs/ff.h"
+
+#define CORE_CACHE_ENTRIES  4
+#define CORE_CACHE_ARC_SIZE 768  // max. size of the parsed ARC settings
+#define CORE_CACHE_CLMT     128  // link map of a bitstream, 2 DWORDs per fragment
+
+typedef struct
+{
+  DWORD   sclust;
+  DWORD   mtime;
+  FSIZE_t size;
+  WORD    fs_id;
+} core_cache_id_t;
+
+// identify a file, has to be called right after f_open()
+void core_cache_id(FIL *file, core_cache_id_t *id);
+
+// returns 1 and the parsed settings if the ARC file is cached
+char core_cache_arc_get(const core_cache_id_t *id, void *arc, unsigned int len);
+void core_cache_arc_put(const core_cache_id_t *id, const void *arc, unsigned int len);
+
+// set up the fast seek link map of an opened bitstream
+void core_cache_linkmap(FIL *file);
+
+#endif // CORE_CACHE_H
@@ -0,0 +1,14 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+// CRC32 with the polynomial 0xEDB88320 (zip, upgrade files, RBZ, BPS)
+// Initial CRC value is -1 (0xFFFFFFFF)
+// Final CRC value is bitwise negation of the last calculated value
+
+#include "attrs.h"
+
+unsigned long CalculateCRC32(unsigned long crc, const unsigned char *pBuffer, unsigned long nSize);
+// smaller and slower, runs from RAM while the flash is being programmed
+unsigned long CalculateCRC32Ram(unsigned long crc, const unsigned char *pBuffer, unsigned long nSize) RAMFUNC;
+
+#endif // CRC32_H
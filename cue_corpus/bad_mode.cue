@@ -0,0 +1,3 @@
+FILE "game.bin" BINARY
+  TRACK 01 CDG
+    INDEX 01 00:00:00
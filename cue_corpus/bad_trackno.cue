@@ -0,0 +1,3 @@
+FILE "game.bin" BINARY
+  TRACK 02 MODE1/2352
+    INDEX 01 00:00:00
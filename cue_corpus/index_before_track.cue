@@ -0,0 +1,3 @@
+FILE "game.bin" BINARY
+    INDEX 01 00:00:00
+  TRACK 01 MODE1/2352
@@ -0,0 +1,5 @@
+FILE vcd.bin BINARY
+  TRACK 01 MODE2/2336
+    INDEX 01 00:00:00
+  TRACK 02 AUDIO
+    INDEX 01 20:00:00
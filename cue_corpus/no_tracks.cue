@@ -0,0 +1,2 @@
+REM only a file
+FILE "game.bin" BINARY
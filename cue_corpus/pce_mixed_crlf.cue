@@ -0,0 +1,15 @@
+REM GENRE Shooter
+REM DATE 1992
+CATALOG 0000000000000
+FILE "Gate of Thunder (J) [!].bin" BINARY
+	TRACK 01 AUDIO
+		INDEX 01 00:00:00
+	TRACK 02 MODE1/2352
+		INDEX 00 00:53:12
+		INDEX 01 00:56:12
+	TRACK 03 AUDIO
+		INDEX 00 07:40:30
+		INDEX 01 07:42:30
+	TRACK 04 MODE1/2352
+		INDEX 00 09:01:00
+		INDEX 01 09:03:00
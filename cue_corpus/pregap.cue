@@ -0,0 +1,9 @@
+FILE "data.img" BINARY
+  TRACK 01 MODE1/2048
+    INDEX 01 00:00:00
+  TRACK 02 AUDIO
+    PREGAP 00:02:00
+    INDEX 01 10:00:00
+  TRACK 03 AUDIO
+    PREGAP 00:02:00
+    INDEX 01 12:30:40
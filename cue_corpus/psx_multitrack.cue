@@ -0,0 +1,9 @@
+FILE "Wipeout XL (Europe).bin" BINARY
+  TRACK 01 MODE2/2352
+    INDEX 01 00:00:00
+  TRACK 02 AUDIO
+    INDEX 00 45:10:20
+    INDEX 01 45:12:20
+  TRACK 03 AUDIO
+    INDEX 00 48:00:00
+    INDEX 01 48:02:00
@@ -0,0 +1,3 @@
+FILE "Crash Bandicoot (USA).bin" BINARY
+  TRACK 01 MODE2/2352
+    INDEX 01 00:00:00
@@ -0,0 +1,152 @@
+// cue_fuzz.c
+// Fuzzer for the CUE tokenizer and parser, build it with sanitizers
+//
+// As a libFuzzer target (clang -fsanitize=fuzzer,address,undefined -DCUE_FUZZ_LIBFUZZER)
+// or standalone: cuefuzz [-n iterations] [-s seed] seed.cue ...
+// the standalone driver mutates the seed files and parses the results.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "cue_parser.h"
+
+#define FUZZ_FILE   "/tmp/cuefuzz.cue"
+#define FUZZ_MAXLEN 4096
+
+int iprintf(const char *format, ...) {
+    return 0;
+}
+
+const char *GetExtension(const char *fileName) {
+    const char *fileExt = 0;
+    int len = strlen(fileName);
+
+    while(len > 2) {
+        if (fileName[len-2] == '.') {
+            fileExt = &fileName[len-1];
+            break;
+        }
+        len--;
+    }
+    return fileExt;
+}
+
+static void check_toc(int res) {
+    if (res > CUE_RES_BINERR) abort();
+    if (res != CUE_RES_OK) return;
+    if (toc.last < 1 || toc.last > 99) abort();
+    for (int i = 0; i < toc.last; i++) {
+        int ss = toc.tracks[i].sector_size;
+        if (ss != 2048 && ss != 2336 && ss != 2352) abort();
+        if (toc.tracks[i].type > SECTOR_DATA_MODE2) abort();
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    FILE *f = fopen(FUZZ_FILE, "wb");
+    if (!f) return 0;
+    fwrite(data, 1, size, f);
+    fclose(f);
+    check_toc(cue_parse(FUZZ_FILE));
+    return 0;
+}
+
+#ifndef CUE_FUZZ_LIBFUZZER
+static const char *dict[] = {
+    "FILE", "BINARY", "TRACK", "INDEX", "PREGAP", "AUDIO", "MODE1/2048", "MODE1/2352",
+    "MODE2/2336", "MODE2/2352", "REM", "\"", " ", "\t", "\n", "\r\n", ";", ":", "00", "01",
+    "99", "100", "59:74", "99:59:74", "-1", "\xff", "\0",
+};
+
+static size_t mutate(uint8_t *buf, size_t len) {
+    int ops = 1 + rand() % 8;
+
+    while (ops--) {
+        size_t pos = len ? rand() % len : 0;
+        switch (rand() % 6) {
+        case 0: // flip a bit
+            if (len) buf[pos] ^= 1 << (rand() % 8);
+            break;
+        case 1: // random byte
+            if (len) buf[pos] = rand();
+            break;
+        case 2: // delete a range
+            if (len) {
+                size_t n = 1 + rand() % (len - pos);
+                memmove(buf + pos, buf + pos + n, len - pos - n);
+                len -= n;
+            }
+            break;
+        case 3: // insert a dictionary token
+        {
+            const char *tok = dict[rand() % (sizeof(dict) / sizeof(dict[0]))];
+            size_t n = strlen(tok) ? strlen(tok) : 1;
+            if (len + n > FUZZ_MAXLEN) break;
+            memmove(buf + pos + n, buf + pos, len - pos);
+            memcpy(buf + pos, tok, n);
+            len += n;
+            break;
+        }
+        case 4: // duplicate a range
+            if (len) {
+                size_t n = 1 + rand() % (len - pos);
+                if (len + n > FUZZ_MAXLEN) break;
+                memmove(buf + pos + n, buf + pos, len - pos);
+                len += n;
+            }
+            break;
+        case 5: // truncate
+            len = pos;
+            break;
+        }
+    }
+    return len;
+}
+
+int main(int argc, char **argv) {
+    static uint8_t seeds[64][FUZZ_MAXLEN];
+    static size_t seed_len[64];
+    uint8_t buf[FUZZ_MAXLEN];
+    int nseeds = 0, opt;
+    long iterations = 10000;
+    unsigned int seed = time(NULL);
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+        case 'n': iterations = atol(optarg); break;
+        case 's': seed = strtoul(optarg, 0, 10); break;
+        default:
+            fprintf(stderr, "usage: %s [-n iterations] [-s seed] seed.cue ...\n", argv[0]);
+            return 2;
+        }
+    }
+
+    for (int i = optind; i < argc && nseeds < 64; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        if (!f) continue;
+        seed_len[nseeds] = fread(seeds[nseeds], 1, FUZZ_MAXLEN, f);
+        fclose(f);
+        nseeds++;
+    }
+    if (!nseeds) nseeds = 1; // start from an empty input
+
+    printf("seed %u, %d seed file(s)\n", seed, nseeds);
+    srand(seed);
+
+    for (long n = 0; n < iterations; n++) {
+        int s = rand() % nseeds;
+        size_t len = seed_len[s];
+        memcpy(buf, seeds[s], len);
+        len = mutate(buf, len);
+        LLVMFuzzerTestOneInput(buf, len);
+    }
+    unlink(FUZZ_FILE);
+    printf("%ld iterations done\n", iterations);
+    return 0;
+}
+#endif
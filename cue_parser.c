@@ -7,10 +7,18 @@
 #include <ctype.h>
 #include "cue_parser.h"
 #ifdef CUE_PARSER_TEST
+#ifdef CUE_PARSER_DEBUG
 #define cue_parser_debugf(a, ...) printf(a"\n", ## __VA_ARGS__)
 #else
+#define cue_parser_debugf(...)
+#endif
+#else
 #include "debug.h"
 #include "idxfile.h"
+#include "cd_cache.h"
+#ifdef HAVE_TOC_CACHE
+#include "toc_cache.h"
+#endif
 #endif
 
 //// defines ////
@@ -52,6 +60,10 @@
 #define CHAR_TO_LOWERCASE(c)    ({ char _c = (c); if (CHAR_IS_ALPHA_UPPER(_c)) _c = _c - 'A' + 'a'; _c;})
 
 #ifdef CUE_PARSER_TEST
+// provided by the test harness
+int iprintf(const char *format, ...);
+const char *GetExtension(const char *fileName);
+
 FILE* cue_fp = NULL;
 char  sector_buffer[512] = {0};
 int   cue_size = 0;
@@ -92,6 +104,7 @@ static char ParseMSF(const char *s, msf_t *msf) {
   if (*s && CHAR_IS_NUM(*s)) msf->f = 10*(*s++ - '0'); else return 0;
   if (*s && CHAR_IS_NUM(*s)) msf->f+= (*s++ - '0'); else return 0;
   if (*s) return 0;
+  if (msf->s >= 60 || msf->f >= 75) return 0;
   return 1;
 }
 
@@ -133,6 +146,18 @@ static int cue_getword(char* word)
   return c==0 ? CUE_EOT : i == 0 ? CUE_NOWORD : literal ? 1 : 0;
 }
 
+static void cue_print_toc(const char *filename)
+{
+  msf_t msf;
+
+  iprintf("Tracks in the CUE file %s : %d\n", filename, toc.last);
+  for (int i = 0; i < toc.last ; i++) {
+    LBA2MSF(toc.tracks[i].start, &msf);
+    iprintf("Track %i, start: %d - %02d:%02d:%02d (%d) end: %d sector size:%d\n",
+      i+1, toc.tracks[i].start, msf.m, msf.s, msf.f, toc.tracks[i].offset, toc.tracks[i].end, toc.tracks[i].sector_size);
+  }
+}
+
 //// cue_parse() ////
 #ifdef CUE_PARSER_TEST
 char cue_parse(const char *filename)
@@ -147,8 +172,20 @@ char cue_parse(const char *filename, IDXFile *image)
   msf_t msf;
   int lba, lastindex1 = 0;
   char e[3];
+  #ifndef CUE_PARSER_TEST
+  char binname[CUE_WORD_SIZE];
+  #endif
 
   memset(&toc, 0, sizeof(toc));
+  #ifndef CUE_PARSER_TEST
+  cd_cache_invalidate();
+  #ifdef HAVE_TOC_CACHE
+  if (toc_cache_load(filename, image)) {
+    cue_print_toc(filename);
+    return CUE_RES_OK;
+  }
+  #endif
+  #endif
 
   const char *ext = GetExtension(filename);
   e[0] = e[1] = e[2] = ' ';
@@ -164,16 +201,20 @@ char cue_parse(const char *filename, IDXFile *image)
     #else
     toc.file = image;
     if (IDXOpen(toc.file, filename, FA_READ) == FR_OK) {
+      strncpy(binname, filename, CUE_WORD_SIZE - 1);
+      binname[CUE_WORD_SIZE - 1] = 0;
       bin_valid = 1;
+    } else {
+      error = CUE_RES_BINERR;
+    }
+    #endif
+    if (bin_valid) {
       track = 1;
       toc.tracks[0].sector_size = 2048;
       toc.tracks[0].type = SECTOR_DATA_MODE1;
       toc.tracks[0].offset = 0;
       toc.tracks[0].start = 0;
-    } else {
-      error = CUE_RES_BINERR;
     }
-    #endif
   } else {
     // open cue file
     #ifdef CUE_PARSER_TEST
@@ -221,9 +262,10 @@ char cue_parse(const char *filename, IDXFile *image)
               }
               #else
                 toc.file = image;
-                if (IDXOpen(toc.file, word, FA_READ) == FR_OK)
+                if (IDXOpen(toc.file, word, FA_READ) == FR_OK) {
+                  strcpy(binname, word);
                   bin_valid = 1;
-                else
+                } else
                   error = CUE_RES_BINERR;
               }
               #endif
@@ -276,7 +318,7 @@ char cue_parse(const char *filename, IDXFile *image)
               cue_parser_debugf("Index: %s", word);
               index = strtol(word, 0, 10);
             } else if (submode == 1) {
-              if (!ParseMSF(word, &msf)) {
+              if (!track || !ParseMSF(word, &msf)) {
                 error = CUE_RES_INVALID;
               } else {
                 lba = MSF2LBA(msf.m, msf.s, msf.f);
@@ -315,12 +357,14 @@ char cue_parse(const char *filename, IDXFile *image)
     #endif
   }
 
-  #ifndef CUE_PARSET_TEST
   if (!bin_valid)
     error = CUE_RES_BINERR;
-  else if (error) 
-    f_close(&toc.file->file);
-  else {
+  else if (!error && (!track || !toc.tracks[track - 1].sector_size))
+    error = CUE_RES_INVALID;
+  #ifndef CUE_PARSER_TEST
+  if (error) {
+    if (bin_valid) f_close(&toc.file->file);
+  } else {
     IDXIndex(toc.file);
     if (track > 0) {
       tracklen = (f_size(&toc.file->file) - toc.tracks[track - 1].offset) / toc.tracks[track - 1].sector_size;
@@ -334,14 +378,12 @@ char cue_parse(const char *filename, IDXFile *image)
     toc.last = track;
     toc.end = toc.tracks[track-1].end;
     toc.valid = 1;
+    #if !defined(CUE_PARSER_TEST) && defined(HAVE_TOC_CACHE)
+    toc_cache_save(filename, binname, toc.file);
+    #endif
   }
 
-  iprintf("Tracks in the CUE file %s : %d\n", filename, toc.last);
-  for (int i = 0; i < toc.last ; i++) {
-    LBA2MSF(toc.tracks[i].start, &msf);
-    iprintf("Track %i, start: %d - %02d:%02d:%02d (%d) end: %d sector size:%d\n",
-      i+1, toc.tracks[i].start, msf.m, msf.s, msf.f, toc.tracks[i].offset, toc.tracks[i].end, toc.tracks[i].sector_size);
-  }
+  cue_print_toc(filename);
   return error;
 }
 
@@ -1,34 +1,270 @@
+// cue_test.c
+// Host side regression and benchmark harness for cue_parser.c
+//
+// cuetest [-v] [-u] [-n N] file.cue ...
+//   parses each file, compares the resulting TOC with file.cue.out
+//   (-u writes it instead), -n repeats each parse N times for timing
+// cuetest -g N [-s seed]
+//   parses N generated CUE sheets and checks them against a model
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <unistd.h>
+#include <time.h>
 
 #include "cue_parser.h"
 
-//#define CUEFILE "Golden Axe.cue"
-//#define CUEFILE "Golden Axe (Japan).cue"
-//#define CUEFILE "[TGXCD1042] [Mixed mode CD] [--].cue"
-//#define CUEFILE "Sherlock Holmes Consulting Detective (USA).cue"
-#define CUEFILE "Space Ava 201.cue"
+#define GEN_FILE "/tmp/cuetest_gen.cue"
+
+static int verbose = 0;
 
-void iprintf(const char *format, ...) {
+int iprintf(const char *format, ...) {
+    int ret = 0;
     va_list arg;
+    if (!verbose) return 0;
     va_start(arg, format);
-    vprintf(format, arg);
+    ret = vprintf(format, arg);
     va_end(arg);
+    return ret;
 }
 
-void cue_parser_debugf(char *str, const char *format, ...) {
-    va_list arg;
-    va_start(arg, format);
-    vsprintf(str, format, arg);
-    va_end(arg);
+const char *GetExtension(const char *fileName) {
+    const char *fileExt = 0;
+    int len = strlen(fileName);
+
+    while(len > 2) {
+        if (fileName[len-2] == '.') {
+            fileExt = &fileName[len-1];
+            break;
+        }
+        len--;
+    }
+    return fileExt;
+}
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void dump_toc(FILE *f, int res) {
+    fprintf(f, "result %d\n", res);
+    fprintf(f, "tracks %d end %d\n", toc.last, toc.end);
+    for (int i = 0; i < toc.last; i++)
+        fprintf(f, "track %d start %d end %d offset %d type %d size %d\n", i + 1,
+            toc.tracks[i].start, toc.tracks[i].end, toc.tracks[i].offset, toc.tracks[i].type, toc.tracks[i].sector_size);
+}
+
+static char *read_file(const char *name) {
+    FILE *f = fopen(name, "rb");
+    char *buf;
+    long size;
+
+    if (!f) return NULL;
+    fseek(f, 0L, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0L, SEEK_SET);
+    buf = malloc(size + 1);
+    if (fread(buf, 1, size, f) != size) size = 0;
+    buf[size] = 0;
+    fclose(f);
+    return buf;
+}
+
+// parse one corpus file, returns 0 if the TOC matches the expected output
+static int test_file(const char *name, int update, int repeat) {
+    char expname[1024];
+    char *result, *expected;
+    size_t result_len;
+    FILE *f;
+    double t;
+    int res, ret = 0;
+
+    t = now_us();
+    for (int i = 0; i < repeat; i++) res = cue_parse(name);
+    t = (now_us() - t) / repeat;
+
+    f = open_memstream(&result, &result_len);
+    dump_toc(f, res);
+    fclose(f);
+
+    snprintf(expname, sizeof(expname), "%s.out", name);
+    if (update) {
+        f = fopen(expname, "wb");
+        if (!f) {
+            printf("FAIL %s: cannot write %s\n", name, expname);
+            free(result);
+            return 1;
+        }
+        fputs(result, f);
+        fclose(f);
+        printf("UPDATED %s\n", expname);
+    } else if (!(expected = read_file(expname))) {
+        printf("FAIL %s: no expected output (%s)\n", name, expname);
+        ret = 1;
+    } else {
+        if (strcmp(result, expected)) {
+            printf("FAIL %s\n--- expected\n%s--- got\n%s", name, expected, result);
+            ret = 1;
+        } else {
+            printf("PASS %s (%.1f us/parse)\n", name, t);
+        }
+        free(expected);
+    }
+    free(result);
+    return ret;
+}
+
+// ---------- generated CUE sheets checked against a model ----------
+
+static const struct {
+    const char *token;
+    int sector_size;
+    int type;
+} gen_modes[] = {
+    { "AUDIO",      2352, SECTOR_AUDIO },
+    { "MODE1/2048", 2048, SECTOR_DATA_MODE1 },
+    { "MODE1/2352", 2352, SECTOR_DATA_MODE1 },
+    { "MODE2/2336", 2336, SECTOR_DATA_MODE2 },
+    { "MODE2/2352", 2352, SECTOR_DATA_MODE2 },
+};
+
+static void gen_msf(FILE *f, int frames) {
+    fprintf(f, "%02d:%02d:%02d", frames / 75 / 60, (frames / 75) % 60, frames % 75);
+}
+
+static void gen_indent(FILE *f) {
+    static const char *indents[] = { "", " ", "  ", "    ", "\t", " \t" };
+    fputs(indents[rand() % 6], f);
 }
 
-int main() {
-    char res;
-    msf_t msf;
+static void gen_eol(FILE *f, int crlf) {
+    fputs(crlf ? "\r\n" : "\n", f);
+}
+
+// writes a random CUE sheet and the TOC expected from it
+static void gen_cue(const char *name, cd_track_t *exp, int *exp_last) {
+    FILE *f = fopen(name, "wb");
+    int crlf = rand() & 1;
+    int tracks = 1 + rand() % 99;
+    int maxlen = 440000 / tracks - 300;
+    int frames = 0, pregap = 0, prev_frames = 0;
+
+    memset(exp, 0, 100 * sizeof(cd_track_t));
+    if (rand() & 1) { fputs("REM GENRE Game", f); gen_eol(f, crlf); }
+    if (rand() & 1) { fputs("CATALOG 0000000000000", f); gen_eol(f, crlf); }
+    if (rand() & 1) { fputs("PERFORMER \"Some Performer\"", f); gen_eol(f, crlf); }
+    fputs(rand() & 1 ? "FILE \"Generated Disc (Track 1) [!].bin\" BINARY" : "FILE disc.bin BINARY", f);
+    gen_eol(f, crlf);
 
-    if (res=cue_parse(CUEFILE)) {
-      printf("Error (%d)\n!", res);
+    for (int t = 0; t < tracks; t++) {
+        int mode = rand() % 5;
+        int gap = 0;
+
+        gen_indent(f);
+        fprintf(f, "TRACK %02d %s", t + 1, gen_modes[mode].token);
+        gen_eol(f, crlf);
+        exp[t].sector_size = gen_modes[mode].sector_size;
+        exp[t].type = gen_modes[mode].type;
+
+        if (t) {
+            frames += 1 + rand() % maxlen;
+            switch (rand() % 3) {
+            case 1: // pregap stored in the image
+                gap = 1 + rand() % 300;
+                gen_indent(f);
+                fputs("INDEX 00 ", f);
+                gen_msf(f, frames);
+                gen_eol(f, crlf);
+                exp[t - 1].end = frames + pregap;
+                break;
+            case 2: // pregap not stored in the image
+                pregap += 150;
+                gen_indent(f);
+                fputs("PREGAP 00:02:00", f);
+                gen_eol(f, crlf);
+                break;
+            }
+            frames += gap;
+        }
+
+        gen_indent(f);
+        fputs("INDEX 01 ", f);
+        gen_msf(f, frames);
+        gen_eol(f, crlf);
+
+        exp[t].start = frames + pregap;
+        if (t) {
+            exp[t].offset = exp[t - 1].offset + (frames - prev_frames) * exp[t - 1].sector_size;
+            if (!exp[t - 1].end) exp[t - 1].end = exp[t].start - 1;
+        } else {
+            exp[t].offset = frames * exp[t].sector_size;
+        }
+        prev_frames = frames;
     }
+    fclose(f);
+    *exp_last = tracks;
+}
+
+static int test_generated(int count) {
+    cd_track_t exp[100];
+    int exp_last, failed = 0;
+    double t = 0, t0;
+
+    for (int n = 0; n < count; n++) {
+        gen_cue(GEN_FILE, exp, &exp_last);
+        t0 = now_us();
+        int res = cue_parse(GEN_FILE);
+        t += now_us() - t0;
+
+        int ok = (res == CUE_RES_OK) && (toc.last == exp_last);
+        for (int i = 0; ok && i < exp_last; i++) {
+            ok = toc.tracks[i].start == exp[i].start && toc.tracks[i].end == exp[i].end &&
+                 toc.tracks[i].offset == exp[i].offset && toc.tracks[i].type == exp[i].type &&
+                 toc.tracks[i].sector_size == exp[i].sector_size;
+        }
+        if (!ok) {
+            printf("FAIL generated sheet #%d (kept as %s)\n", n, GEN_FILE);
+            dump_toc(stdout, res);
+            return 1;
+        }
+    }
+    unlink(GEN_FILE);
+    printf("PASS %d generated sheets (%.1f us/parse)\n", count, t / count);
+    return failed;
+}
+
+int main(int argc, char **argv) {
+    int update = 0, repeat = 1, generate = 0, failed = 0;
+    unsigned int seed = time(NULL);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "vun:g:s:")) != -1) {
+        switch (opt) {
+        case 'v': verbose = 1; break;
+        case 'u': update = 1; break;
+        case 'n': repeat = atoi(optarg); break;
+        case 'g': generate = atoi(optarg); break;
+        case 's': seed = strtoul(optarg, 0, 10); break;
+        default:
+            fprintf(stderr, "usage: %s [-v] [-u] [-n repeat] [-g count] [-s seed] [file.cue ...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (repeat < 1) repeat = 1;
+
+    for (int i = optind; i < argc; i++)
+        failed += test_file(argv[i], update, repeat);
+
+    if (generate) {
+        printf("seed %u\n", seed);
+        srand(seed);
+        failed += test_generated(generate);
+    }
+
+    if (failed) printf("%d test(s) failed\n", failed);
+    return failed ? 1 : 0;
 }
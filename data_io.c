@@ -5,17 +5,56 @@
 
 #include "user_io.h"
 #include "data_io.h"
+#include "mist_cfg.h"
+#include "utils.h"
 #include "debug.h"
 #include "spi.h"
 #ifdef HAVE_QSPI
 #include "qspi.h"
 #endif
+#ifdef HAVE_ZIP
+#include "zip.h"
+#endif
+#ifdef HAVE_PATCH
+#include "patch.h"
+#endif
 
 // core supports direct ROM upload via SS4
 char rom_direct_upload = 0;
+#define DIO_DIRECT_STEP (64*1024)  // multiple of the sector size
+
+// transfer pacing of the core, 0 burst = byte by byte (slow cores)
+static unsigned short dio_burst = 0;
+static unsigned short dio_gap = 0;
 
 static data_io_processor_t* PROCESSORS[MAX_DATA_IO_PROCESSORS];
 
+// statistics of the running or the last upload, times in ms
+typedef struct {
+  unsigned long bytes;      // sent so far
+  unsigned long total;      // announced file size
+  unsigned long time;
+  unsigned long read_time;  // reading from the card (and patching)
+  unsigned long send_time;  // SPI/QSPI transfer to the core
+} data_io_stats_t;
+
+static data_io_stats_t dio_stats;
+static unsigned long dio_start;
+static char dio_running = 0;
+static data_io_progress_t dio_progress = 0;
+static unsigned long dio_progress_next;
+
+// ROM entries of the mist.ini, collected while parsing and uploaded in one go
+#ifndef ROM_NAMES_SIZE
+#define ROM_NAMES_SIZE 256
+#endif
+#define ROM_NAME_MAX 61  // without the .ROM extension
+
+static char rom_names[ROM_NAMES_SIZE];
+static unsigned int rom_names_len = 0;
+static char rom_upload_started = 0;
+static char rom_dir_changed = 0;
+
 void data_io_init() {
   memset(PROCESSORS, 0, sizeof(PROCESSORS));
 }
@@ -27,7 +66,36 @@ void data_io_set_index(char index) {
   DisableFpga();
 }
 
+// ask the core how fast it can receive data
+static void data_io_get_caps(void) {
+  dio_burst = dio_gap = 0;
+
+  if (user_io_get_core_features() & FEAT_DIO_CAPS) {
+    unsigned char burst, gap;
+
+    EnableFpga();
+    SPI(DIO_FILE_TX_CAPS);
+    burst = SPI(0);
+    gap = SPI(0);
+    DisableFpga();
+
+    dio_burst = burst ? burst << 4 : SECTOR_BUFFER_SIZE;
+    dio_gap = gap << 4;
+  } else if (mist_cfg.dio_fast) {
+    // no handshake, but the user says it's safe
+    dio_burst = SECTOR_BUFFER_SIZE;
+  }
+  if (dio_burst)
+    iprintf("DIO: %d bytes bursts, %d bytes gap\n", dio_burst, dio_gap);
+}
+
+void data_io_set_progress(data_io_progress_t progress) {
+  dio_progress = progress;
+}
+
 void data_io_file_tx_start(void) {
+  data_io_get_caps();
+
   EnableFpga();
   SPI(DIO_FILE_TX);
   SPI(0xff);
@@ -51,14 +119,25 @@ void data_io_file_tx_done(void) {
   if (user_io_get_core_features() & FEAT_QSPI)
     qspi_end();
 #endif
-  iprintf("\n");
+
+  if (dio_running) {
+    unsigned long rate;
+
+    dio_running = 0;
+    dio_stats.time = GetRTTC() - dio_start;
+    rate = dio_stats.time ? dio_stats.bytes / dio_stats.time : 0; // bytes/ms = kB/s
+    iprintf("\nDIO: %lu bytes in %lu ms, %lu.%03lu MB/s (read %lu ms, send %lu ms)\n",
+            dio_stats.bytes, dio_stats.time, rate / 1000, rate % 1000,
+            dio_stats.read_time, dio_stats.send_time);
+  } else
+    iprintf("\n");
 }
 
 ///////////////////////////
 // TRANSMIT FILE TO FPGA //
 ///////////////////////////
 
-void data_io_file_tx_prepare(FIL *file, char index, const char *ext) {
+static void data_io_tx_prepare(FIL *file, char index, const char *ext, FSIZE_t fsize) {
   char e[3];
   iprintf("Preparing transmission for index %d\n", index);
 
@@ -76,7 +155,6 @@ void data_io_file_tx_prepare(FIL *file, char index, const char *ext) {
   EnableFpga();
   SPI(DIO_FILE_INFO);
 
-  FSIZE_t fsize = f_size(file);
   spi_n(0, 8);                      // name
   spi8(e[0]);spi8(e[1]);spi8(e[2]); // ext
   spi8(file->obj.attr);             // attr
@@ -93,56 +171,164 @@ void data_io_file_tx_prepare(FIL *file, char index, const char *ext) {
 
   DisableFpga();
 
+  memset(&dio_stats, 0, sizeof(dio_stats));
+  dio_stats.total = fsize;
+  dio_progress_next = fsize / 100;
+  if (dio_progress && fsize >= DIO_PROGRESS_MIN) dio_progress(0, fsize);
+
   // prepare transmission of new file
   data_io_file_tx_start();
 
+  dio_start = GetRTTC();
+  dio_running = 1;
+}
+
+void data_io_file_tx_prepare(FIL *file, char index, const char *ext) {
+  data_io_tx_prepare(file, index, ext, f_size(file));
+}
+
+static void data_io_tx_spi(const char *data, unsigned int len) {
+#ifdef HAVE_QSPI
+  if (user_io_get_core_features() & FEAT_QSPI) {
+    qspi_write_block((const uint8_t*)data, len);
+    return;
+  }
+#endif
+  if (!dio_burst) {
+    // spi_write DMA is too fast for cores without the handshake
+    EnableFpga();
+    SPI(DIO_FILE_TX_DAT);
+    while (len--)
+      SPI(*data++);
+    DisableFpga();
+    return;
+  }
+
+  while (len) {
+    unsigned int n = (len > dio_burst) ? dio_burst : len;
+
+    EnableFpga();
+    SPI(DIO_FILE_TX_DAT);
+    spi_write(data, n);
+    DisableFpga();
+    data += n;
+    len -= n;
+    // pause requested by the core, clock the bus with the chip selects inactive
+    if (len && dio_gap) spi_n(0xff, dio_gap);
+  }
+}
+
+static void data_io_tx_progress(void) {
+  if (!dio_progress || !dio_running || dio_stats.total < DIO_PROGRESS_MIN || dio_stats.bytes < dio_progress_next)
+    return;
+  // every percent, and once at the end
+  if (dio_stats.bytes >= dio_stats.total)
+    dio_progress_next = ~0UL;
+  else
+    dio_progress_next = MIN(dio_stats.bytes + dio_stats.total / 100, dio_stats.total);
+
+#ifdef HAVE_QSPI
+  // the OSD can't be written in the middle of a QSPI transfer
+  if (user_io_get_core_features() & FEAT_QSPI) {
+    qspi_end();
+    dio_progress(dio_stats.bytes, dio_stats.total);
+    qspi_start_write();
+    return;
+  }
+#endif
+  dio_progress(dio_stats.bytes, dio_stats.total);
+}
+
+void data_io_file_tx_data(const char *data, unsigned int len) {
+  unsigned long time = GetRTTC();
+
+  data_io_tx_spi(data, len);
+  dio_stats.send_time += GetRTTC() - time;
+  dio_stats.bytes += len;
+  data_io_tx_progress();
+}
+
+// read the next chunk of a file to upload
+static void data_io_tx_read(FIL *file, void *buf, UINT len, UINT *br) {
+  unsigned long time = GetRTTC();
+
+  DISKLED_ON
+  f_read(file, buf, len, br);
+  DISKLED_OFF
+  dio_stats.read_time += GetRTTC() - time;
 }
 
-static void data_io_file_tx_send(FIL *file) {
+#ifdef HAVE_PATCH
+// the ROM is read chunk by chunk, and the patch records are spliced in.
+// The upload stops at the first error, returns its PATCH_ERR_ code.
+static char data_io_file_tx_patch(FIL *file) {
+  FSIZE_t size = patch_size(), pos = 0;
+  UINT br;
+  char res = PATCH_OK;
+
+  iprintf("Selected %llu bytes to send with patch\n", size);
+
+  while (pos < size) {
+    iprintf(".");
+
+    unsigned short chunk = (size - pos > SECTOR_BUFFER_SIZE) ? SECTOR_BUFFER_SIZE : size - pos;
+
+    br = 0;
+    unsigned long time = GetRTTC();
+    DISKLED_ON
+    if (pos < f_size(file) && f_read(file, sector_buffer, chunk, &br) != FR_OK) res = PATCH_ERR_READ;
+    if (br < chunk) memset(sector_buffer + br, 0, chunk - br);
+    if (res == PATCH_OK) res = patch_apply(sector_buffer, pos, chunk);
+    DISKLED_OFF
+    dio_stats.read_time += GetRTTC() - time;
+
+    if (res != PATCH_OK) {
+      iprintf("Patched upload failed at %llu: %d\n", pos, res);
+      return res;
+    }
+    data_io_file_tx_data(sector_buffer, chunk);
+    pos += chunk;
+  }
+  return PATCH_OK;
+}
+#endif
+
+static char data_io_file_tx_send(FIL *file) {
   FSIZE_t bytes2send = f_size(file);
   UINT br;
 
+#ifdef HAVE_PATCH
+  if (patch_active())
+    return data_io_file_tx_patch(file);
+#endif
+
   /* transmit the entire file using one transfer */
   iprintf("Selected %llu bytes to send\n", bytes2send);
 
   while(bytes2send) {
     iprintf(".");
 
-    unsigned short c, chunk = (bytes2send>SECTOR_BUFFER_SIZE)?SECTOR_BUFFER_SIZE:bytes2send;
-    char *p;
+    unsigned short chunk = (bytes2send>SECTOR_BUFFER_SIZE)?SECTOR_BUFFER_SIZE:bytes2send;
 
     if (rom_direct_upload && fat_uses_mmc()) {
-      // upload directly from the SD-Card if the core supports that
+      // upload directly from the SD-Card if the core supports that, in
+      // whole sector steps to report the progress
       bytes2send = (file->obj.objsize + 511) & 0xfffffe00;
       file->obj.objsize = bytes2send; // hack to foul FatFs think the last block is a full sector
-      DISKLED_ON
-      f_read(file, 0, bytes2send, &br);
-      DISKLED_OFF
-      bytes2send = 0;
-    } else {
-      DISKLED_ON
-      f_read(file, sector_buffer, chunk, &br);
-      DISKLED_OFF
-
-#ifdef HAVE_QSPI
-      if (user_io_get_core_features() & FEAT_QSPI) {
-        qspi_write_block(sector_buffer, chunk);
-      } else {
-#endif
-        EnableFpga();
-        SPI(DIO_FILE_TX_DAT);
-
-//      spi_write(sector_buffer, chunk); // DMA -- too fast for some cores
-        for(p = sector_buffer, c=0;c < chunk;c++)
-          SPI(*p++);
-
-        DisableFpga();
-#ifdef HAVE_QSPI
+      while (bytes2send) {
+        UINT step = (bytes2send > DIO_DIRECT_STEP) ? DIO_DIRECT_STEP : bytes2send;
+        data_io_tx_read(file, 0, step, &br);
+        dio_stats.bytes += step;
+        data_io_tx_progress();
+        bytes2send -= step;
       }
-#endif
+    } else {
+      data_io_tx_read(file, sector_buffer, chunk, &br);
+      data_io_file_tx_data(sector_buffer, chunk);
       bytes2send -= chunk;
     }
   }
+  return 0;
 }
 
 
@@ -150,18 +336,49 @@ static void data_io_file_tx_fill(unsigned char fill, unsigned int len) {
 
   EnableFpga();
   SPI(DIO_FILE_TX_DAT);
+  dio_stats.bytes += len;
   while(len--) {
     SPI(fill);
   }
   DisableFpga();
 }
 
-void data_io_file_tx(FIL *file, char index, const char *ext) {
+char data_io_file_tx(FIL *file, char index, const char *ext) {
+  char res;
+#ifdef HAVE_PATCH
+  if (patch_active())
+    data_io_tx_prepare(file, index, ext, patch_size());
+  else
+#endif
   data_io_file_tx_prepare(file, index, ext);
-  data_io_file_tx_send(file);
+  res = data_io_file_tx_send(file);
   data_io_file_tx_done();
+  return res;
+}
+
+#ifdef HAVE_ZIP
+static char data_io_zip_write(const unsigned char *data, unsigned int len) {
+  iprintf(".");
+  data_io_file_tx_data((const char*)data, len);
+  return 1;
 }
 
+// send a member of the zip archive being browsed
+char data_io_zip_tx(const char *name, char index, const char *ext) {
+  zip_entry_t *entry;
+  FIL *file = zip_member_open(name, &entry);
+  char res;
+
+  if (!file) return ZIP_ERR_READ;
+  data_io_tx_prepare(file, index, ext, entry->size);
+  iprintf("Selected %lu bytes to send from the archive\n", entry->size);
+
+  res = zip_member_read(entry, data_io_zip_write);
+  data_io_file_tx_done();
+  return res;
+}
+#endif
+
 static data_io_processor_t* data_io_get_processor(const char *processor_id) {
   for (int i = 0; i < MAX_DATA_IO_PROCESSORS; i++) {
     if (PROCESSORS[i]) {
@@ -275,56 +492,81 @@ void data_io_file_rx(FIL *file, char index, unsigned int len) {
 // ROM UPLOAD //
 ////////////////
 
-void data_io_rom_upload(char *rname, char mode) {
-
+// upload the collected ROMs, all from the core dir and in the open transfer
+static void data_io_rom_flush(void) {
   FIL file;
   FRESULT res;
-  static char first = 1;
-  char fname[67];
+  char fname[ROM_NAME_MAX + 5];
+  char *name = rom_names;
+
+  if (!rom_names_len) return;
+
+  // try to change into core dir. Stay in root if that doesn't exist
+  user_io_change_into_core_dir();
+  rom_dir_changed = 1;
+
+  while (name < rom_names + rom_names_len) {
+    strcpy(fname, name);
+    strcat(fname, ".ROM");
+    name += strlen(name) + 1;
+    iprintf("rom upload '%s'\n", fname);
+
+    res = f_open(&file, fname, FA_READ);
+    if (res == FR_OK) {
+      if (!rom_upload_started) {
+        // set reset
+        user_io_8bit_set_status(UIO_STATUS_RESET, UIO_STATUS_RESET);
+        data_io_file_tx_prepare(&file, 0, "ROM");
+        rom_upload_started = 1;
+      }
+      data_io_file_tx_send(&file);
+      f_close(&file);
+    } else
+      iprintf("Error opening file %s (%d)!\n", fname, res);
+  }
+  rom_names_len = 0;
+}
+
+char data_io_rom_upload(char *rname, char mode) {
+  unsigned int len;
+  char flushed = 0;
 
   // new ini parsing starts, prepare uploads
   if(mode == 0) {
-    first = 1;
-    return;
+    rom_names_len = 0;
+    rom_upload_started = 0;
+    rom_dir_changed = 0;
+    return 0;
   }
 
   // ini parsing done
   if(mode == 2) {
+    data_io_rom_flush();
     // has something been uploaded?
     // -> then end transfer
-    if(!first) {
+    if(rom_upload_started) {
       iprintf("upload ends\n");
 
       data_io_file_tx_done();
       user_io_8bit_set_status(0, UIO_STATUS_RESET);
     }
-    return;
-  }
-
-  // try to change into core dir. Stay in root if that doesn't exist
-  user_io_change_into_core_dir();
-
-  strncpy(fname, rname, sizeof(fname)-5);
-  fname[sizeof(fname)-6] = 0;
-  strcat(fname,".ROM");
-  iprintf("rom upload '%s'\n", fname);
-
-  res=f_open(&file, fname, FA_READ);
-  if (res== FR_OK) {
-
-    if(first) {
-      // set reset
-      user_io_8bit_set_status(UIO_STATUS_RESET, UIO_STATUS_RESET);
-      data_io_file_tx_prepare(&file, 0, "ROM");
-      first = 0;
+    // restore the directory listing once for all ROMs
+    if(rom_dir_changed) {
+      ChangeDirectoryName("/");
+      ScanDirectory(SCAN_INIT, "RBF",  SCAN_LFN | SCAN_SYSDIR);
     }
+    return 0;
+  }
 
-    //    user_io_file_tx(&f, 0);
-    data_io_file_tx_send(&file);
-    f_close(&file);
-  } else
-    iprintf("Error opening file %s (%d)!\n", fname, res);
-
-  ChangeDirectoryName("/");
-  ScanDirectory(SCAN_INIT, "RBF",  SCAN_LFN | SCAN_SYSDIR);
+  // only collect the name, the files are opened when the ini is parsed
+  len = strlen(rname);
+  if (len > ROM_NAME_MAX) len = ROM_NAME_MAX;
+  if (rom_names_len + len + 1 > sizeof(rom_names)) {
+    data_io_rom_flush();
+    flushed = 1;
+  }
+  memcpy(rom_names + rom_names_len, rname, len);
+  rom_names[rom_names_len + len] = 0;
+  rom_names_len += len + 1;
+  return flushed;
 }
@@ -15,9 +15,17 @@
 #define DIO_FILE_INFO   0x56
 #define DIO_FILE_RX     0x57
 #define DIO_FILE_RX_DAT 0x58
+#define DIO_FILE_TX_CAPS 0x59 // with FEAT_DIO_CAPS: core returns its max. burst length and the gap
+                              // between bursts, both in 16 bytes units (0 burst = no limit)
 
 #define MAX_DATA_IO_PROCESSORS 10
 
+#define DIO_PROGRESS_MIN (256*1024) // no progress reports for smaller uploads
+
+// called while uploading large files, first with done = 0, then for
+// each percent
+typedef void (*data_io_progress_t)(unsigned long done, unsigned long total);
+
 typedef struct {
     char id[4];
     void (*file_tx_send)(FIL *file, int index, const char* name, const char* ext);
@@ -28,13 +36,24 @@ void data_io_file_tx_prepare(FIL *file, char index, const char *ext);
 void data_io_set_index(char index);
 void data_io_file_tx_start();
 void data_io_file_tx_done();
+// send file data with the pacing of the core, between tx_start/tx_done
+void data_io_file_tx_data(const char *data, unsigned int len);
 void data_io_fill_tx(unsigned char, unsigned int, char);
-void data_io_file_tx(FIL*, char, const char*);
+// returns 0, or the PATCH_ERR_ code if a patched upload has been aborted
+char data_io_file_tx(FIL*, char, const char*);
 void data_io_file_tx_processor(FIL*, char, const char*, const char*, const char*);
+#ifdef HAVE_ZIP
+// send a member of the zip archive being browsed, returns ZIP_OK on success
+char data_io_zip_tx(const char *name, char index, const char *ext);
+#endif
 void data_io_file_rx(FIL*, char, unsigned int);
 
-// called when a rom entry is found in the mist.ini
-void data_io_rom_upload(char *s, char mode);
+// called when a rom entry is found in the mist.ini, the ROMs are uploaded
+// when the parsing is done (mode 2). Returns 1 if the file system has been
+// accessed early, as the name buffer was full.
+char data_io_rom_upload(char *s, char mode);
 
 char data_io_add_processor(data_io_processor_t *processor);
+
+void data_io_set_progress(data_io_progress_t progress);
 #endif // DATA_IO_H
@@ -7,6 +7,7 @@
 #define ERROR_KICKSTART_UPLOAD 6
 #define ERROR_UPDATE_FAILED 7
 #define ERROR_READ_BITSTREAM_FAILED 8
+#define ERROR_BITSTREAM_CRC 9
 #define ERROR_DIRECT_ACCESS_INTERNAL 10
 
 extern unsigned char Error;
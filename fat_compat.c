@@ -8,11 +8,14 @@
 #include "osd.h"
 #include "attrs.h"
 #include "utils.h"
+#ifdef HAVE_ZIP
+#include "zip.h"
+#endif
 
 #include "FatFs/ff.h"
 #include "FatFs/diskio.h"
 
-unsigned char sector_buffer[SECTOR_BUFFER_SIZE]; // sector buffer for one CDDA sector (or 4 SD sector)
+unsigned char sector_buffer[SECTOR_BUFFER_SIZE] __attribute__ ((aligned (4))); // sector buffer for one CDDA sector (or 4 SD sector)
 struct PartitionEntry partitions[4];             // lbastart and sectors will be byteswapped as necessary
 int partitioncount;
 
@@ -132,6 +135,20 @@ void ChangeDirectoryName(unsigned char *name) {
 	uint32_t      iPreviousDirectoryTmp = fs.cdir;
 
 	iprintf("ChangeDirectoryName: %s -> %s = ", cwd, name);
+#ifdef HAVE_ZIP
+	if (zip_active()) {
+		// leaving the archive, select it in its directory
+		zip_close();
+		iPreviousDirectory = zip_cluster();
+		if (!strcmp(name, "..")) {
+			iprintf("%s\n", cwd);
+			return;
+		}
+	} else if (name[0] != '/' && zip_is_archive(name) && zip_open(name)) {
+		iprintf("%s/%s\n", cwd, name);
+		return;
+	}
+#endif
 	if(name[0] == '/') {
 		// Absolute path
 		strcpy(sector_buffer, name);
@@ -350,6 +367,11 @@ char ScanDirectory(unsigned long mode, char *extension, unsigned char options) {
 		iSelectedEntry = 0;
 		for (i = 0; i < maxDirEntries; i++)
 			sort_table[i] = i;
+#ifdef HAVE_ZIP
+		// the archive is only browsed by selectors which asked for it
+		if (zip_active() && !(options & SCAN_ZIP)) zip_close();
+		if (!zip_active())
+#endif
 		if (f_opendir(&dir, ".") != FR_OK) return 0;
 	}
 	else
@@ -401,18 +423,32 @@ char ScanDirectory(unsigned long mode, char *extension, unsigned char options) {
 	//enable caching in the sector buffer while traversing the directory,
 	//because FatFs is inefficiently using single sector reads
 	disk_cache_set(true, fs.database);
+#ifdef HAVE_ZIP
+	if (zip_active()) zip_rewinddir(); else
+#endif
 	f_rewinddir(&dir);
 	nNewEntries = 0;
 	while (1) {
+#ifdef HAVE_ZIP
+		if (initial && (fs.cdir || zip_active()) && options & (SCAN_DIR | SCAN_SYSDIR)) {
+#else
 		if (initial && fs.cdir && options & (SCAN_DIR | SCAN_SYSDIR)) {
+#endif
 			fil.fattrib = AM_DIR;
 			strcpy(fil.fname, "..");
 			fil.altname[0] = 0;
 			initial = 0;
 		} else {
+#ifdef HAVE_ZIP
+			if (zip_active()) zip_readdir(&fil); else
+#endif
 			if (f_readdir(&dir, &fil) != FR_OK) break;
 		}
 		if (fil.fname[0] == 0) break;
+#ifdef HAVE_ZIP
+		if (options & SCAN_ZIP && !(fil.fattrib & AM_DIR) && !zip_active() && zip_is_archive(fil.fname))
+			fil.fattrib |= AM_DIR | AM_ZIP; // entered like a directory
+#endif
 
 		is_file = ~fil.fattrib & AM_DIR;
 
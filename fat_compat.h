@@ -96,6 +96,14 @@ extern unsigned char fat32;
 #define FIND_DIR     4 // find first directory beginning with given character
 #define FIND_FILE    8 // find first file entry beginning with given character
 #define SCAN_SYSDIR 16 // include subdirectories with system attribute
+#ifdef HAVE_ZIP
+#define SCAN_ZIP    32 // list zip archives as directories
+#else
+#define SCAN_ZIP     0
+#endif
+
+// FILINFO attribute of zip archives listed as directories (not used by FatFs)
+#define AM_ZIP 0x40
 
 extern FATFS fs;
 
@@ -24,6 +24,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 // 2010-01-09   - support for variable number of tracks
 
 #include <stdio.h>
+#include <string.h>
 
 #include "errors.h"
 #include "hardware.h"
@@ -48,14 +49,64 @@ adfTYPE df[4];            // drive 0 information structure
 #define LAST_SECTOR (SECTOR_COUNT - 1)
 #define GAP_SIZE (TRACK_SIZE - SECTOR_COUNT * SECTOR_SIZE)
 
+#ifdef HAVE_FDD_CACHE
+// the current track of each drive, read at once when the head steps, with the
+// data checksums calculated while loading. Written sectors are kept here and
+// written back together when the head leaves the track, the disk is ejected
+// or the drive has been idle for FDD_FLUSH_DELAY.
+#define FDD_FLUSH_DELAY 1000 // ms
+
+typedef struct
+{
+    unsigned char  data[SECTOR_COUNT * 512] __attribute__ ((aligned (4)));
+    unsigned char  checksum[SECTOR_COUNT][4];
+    DWORD          sclust; // image file of the cached track
+    unsigned long  flush_timer;
+    unsigned short dirty; // sectors not yet written back
+    unsigned char  track;
+    unsigned char  valid;
+} fddCacheTYPE;
+
+static fddCacheTYPE fdd_cache[4];
+static unsigned long fdd_mfm[DATA_SIZE / 4]; // encoded data field of a sector
+#endif
+
+// calculates the checksum of the data field (odd and even bits)
+static void DataChecksum(const unsigned char *pData, unsigned char *checksum)
+{
+    unsigned short i;
+    unsigned char x;
+
+    checksum[0] = 0;
+    checksum[1] = 0;
+    checksum[2] = 0;
+    checksum[3] = 0;
+
+    i = DATA_SIZE / 2 / 4;
+    while (i--)
+    {
+        x = *pData++;
+        checksum[0] ^= x ^ x >> 1;
+        x = *pData++;
+        checksum[1] ^= x ^ x >> 1;
+        x = *pData++;
+        checksum[2] ^= x ^ x >> 1;
+        x = *pData++;
+        checksum[3] ^= x ^ x >> 1;
+    }
+}
+
 // sends the data in the sector buffer to the FPGA, translated into an Amiga floppy format sector
 // note that we do not insert clock bits because they will be stripped by the Amiga software anyway
-void SendSector(unsigned char *pData, unsigned char sector, unsigned char track, unsigned char dsksynch, unsigned char dsksyncl)
+// pDataChecksum may point to the already known data checksum
+void SendSector(unsigned char *pData, const unsigned char *pDataChecksum, unsigned char sector, unsigned char track, unsigned char dsksynch, unsigned char dsksyncl)
 {
     unsigned char checksum[4];
     unsigned short i;
     unsigned char x;
+#ifndef HAVE_FDD_CACHE
     unsigned char *p;
+#endif
 
     // preamble
     SPI(0xAA);
@@ -112,25 +163,16 @@ void SendSector(unsigned char *pData, unsigned char sector, unsigned char track,
     SPI(checksum[2] | 0xAA);
     SPI(checksum[3] | 0xAA);
 
-    // calculate data checksum
-    checksum[0] = 0;
-    checksum[1] = 0;
-    checksum[2] = 0;
-    checksum[3] = 0;
-
-    p = pData;
-    i = DATA_SIZE / 2 / 4;
-    while (i--)
+    // data checksum
+    if (pDataChecksum)
     {
-        x = *p++;
-        checksum[0] ^= x ^ x >> 1;
-        x = *p++;
-        checksum[1] ^= x ^ x >> 1;
-        x = *p++;
-        checksum[2] ^= x ^ x >> 1;
-        x = *p++;
-        checksum[3] ^= x ^ x >> 1;
+        checksum[0] = pDataChecksum[0];
+        checksum[1] = pDataChecksum[1];
+        checksum[2] = pDataChecksum[2];
+        checksum[3] = pDataChecksum[3];
     }
+    else
+        DataChecksum(pData, checksum);
 
     // send data checksum
     SPI(0xAA);
@@ -142,6 +184,23 @@ void SendSector(unsigned char *pData, unsigned char sector, unsigned char track,
     SPI(checksum[2] | 0xAA);
     SPI(checksum[3] | 0xAA);
 
+#ifdef HAVE_FDD_CACHE
+    // encode the data field a word at a time (the bit shifted in from the
+    // next byte is masked by the clock bits), and send it in one transfer
+    {
+        const unsigned long *src = (const unsigned long*)pData;
+        unsigned long *dst = fdd_mfm;
+
+        i = DATA_SIZE / 2 / 4;
+        while (i--)
+            *dst++ = *src++ >> 1 | 0xAAAAAAAA;
+        src = (const unsigned long*)pData;
+        i = DATA_SIZE / 2 / 4;
+        while (i--)
+            *dst++ = *src++ | 0xAAAAAAAA;
+        spi_write((const char*)fdd_mfm, DATA_SIZE);
+    }
+#else
     // odd bits of data field
     i = DATA_SIZE / 2;
     p = pData;
@@ -153,6 +212,7 @@ void SendSector(unsigned char *pData, unsigned char sector, unsigned char track,
     p = pData;
     while (i--)
         SPI(*p++ | 0xAA);
+#endif
 }
 
 void SendGap(void)
@@ -162,6 +222,98 @@ void SendGap(void)
         SPI(0xAA);
 }
 
+#ifdef HAVE_FDD_CACHE
+// writes the dirty sectors of the cached track back to the image in one go
+static void CacheFlush(adfTYPE *drive)
+{
+    fddCacheTYPE *cache = &fdd_cache[drive - df];
+    unsigned char first, last;
+    FRESULT res;
+    UINT bw;
+
+    if (!cache->dirty)
+        return;
+
+    if (cache->valid && cache->sclust == drive->file.obj.sclust)
+    {
+        for (first = 0; !(cache->dirty & 1 << first); first++);
+        for (last = SECTOR_COUNT - 1; !(cache->dirty & 1 << last); last--);
+
+        fdd_debugf("Flush track %d, sectors %d-%d\r", cache->track, first, last);
+        DISKLED_ON;
+        res = f_lseek(&drive->file, (cache->track * SECTOR_COUNT + first) * 512);
+        if (res == FR_OK)
+            res = f_write(&drive->file, &cache->data[first * 512], (last - first + 1) * 512, &bw);
+        if (res == FR_OK)
+            res = f_sync(&drive->file);
+        DISKLED_OFF;
+        if (res != FR_OK)
+        {
+            fdd_debugf("Flush: error %u\r", res);
+            ErrorMessage("  WriteTrack", res);
+            cache->valid = 0;
+        }
+    }
+    cache->dirty = 0;
+}
+
+// loads the current track of the drive into its cache, NULL on errors
+static fddCacheTYPE *CacheTrack(adfTYPE *drive)
+{
+    fddCacheTYPE *cache = &fdd_cache[drive - df];
+    unsigned char sector;
+    UINT br;
+
+    if (cache->valid && cache->sclust == drive->file.obj.sclust && cache->track == drive->track)
+        return cache;
+
+    CacheFlush(drive);
+    cache->valid = 0;
+    if (f_lseek(&drive->file, drive->track * SECTOR_COUNT * 512) != FR_OK ||
+        f_read(&drive->file, cache->data, SECTOR_COUNT * 512, &br) != FR_OK || br != SECTOR_COUNT * 512)
+    {
+        fdd_debugf("Track cache read failed\r");
+        return NULL;
+    }
+
+    for (sector = 0; sector < SECTOR_COUNT; sector++)
+        DataChecksum(&cache->data[sector * 512], cache->checksum[sector]);
+
+    cache->sclust = drive->file.obj.sclust;
+    cache->track = drive->track;
+    cache->valid = 1;
+    return cache;
+}
+
+#endif
+
+// writes back pending sectors, before the image is closed or replaced
+void FlushFloppy(adfTYPE *drive)
+{
+#ifdef HAVE_FDD_CACHE
+    CacheFlush(drive);
+#endif
+}
+
+void EjectFloppy(adfTYPE *drive)
+{
+    FlushFloppy(drive);
+#ifdef HAVE_FDD_CACHE
+    fdd_cache[drive - df].valid = 0; // the next image may reuse the clusters
+#endif
+    drive->status = 0;
+}
+
+// sectors written by the Amiga, not yet in the image file
+unsigned char FloppyDirty(adfTYPE *drive)
+{
+#ifdef HAVE_FDD_CACHE
+    return fdd_cache[drive - df].dirty != 0;
+#else
+    return 0;
+#endif
+}
+
 // read a track from disk
 void ReadTrack(adfTYPE *drive)
 { // track number is updated in drive struct before calling this function
@@ -171,6 +323,11 @@ void ReadTrack(adfTYPE *drive)
     unsigned char track;
     unsigned short dsksync;
     unsigned short dsklen;
+    unsigned char *pData = sector_buffer;
+    const unsigned char *pDataChecksum = 0;
+#ifdef HAVE_FDD_CACHE
+    fddCacheTYPE *cache;
+#endif
     //unsigned short n;
     fdd_debugf("Read track %d\r", drive->track);
 
@@ -181,16 +338,26 @@ void ReadTrack(adfTYPE *drive)
         drive->track = drive->tracks - 1;
     }
 
+#ifdef HAVE_FDD_CACHE
+    cache = CacheTrack(drive);
+#endif
+
     if (drive->track != drive->track_prev)
     { // track step or track 0, start at beginning of track
         drive->track_prev = drive->track;
         sector = 0;
         drive->sector_offset = sector;
+#ifdef HAVE_FDD_CACHE
+        if (!cache)
+#endif
         f_lseek(&drive->file, drive->track * SECTOR_COUNT * 512);
     }
     else
     { // same track, start at next sector in track
         sector = drive->sector_offset;
+#ifdef HAVE_FDD_CACHE
+        if (!cache)
+#endif
         f_lseek(&drive->file, (drive->track * SECTOR_COUNT + sector) * 512);
     }
     fdd_debugf("sector: %d\r", sector);
@@ -209,6 +376,14 @@ void ReadTrack(adfTYPE *drive)
 
     while (1)
     {
+#ifdef HAVE_FDD_CACHE
+        if (cache)
+        {
+            pData = &cache->data[sector * 512];
+            pDataChecksum = cache->checksum[sector];
+        }
+        else
+#endif
         FileReadBlock(&drive->file, sector_buffer);
 
         EnableFpgaMinimig();
@@ -244,7 +419,7 @@ void ReadTrack(adfTYPE *drive)
             {
                 //GenerateHeader(sector_header, sector_buffer, sector, track, dsksync);
                 //SendSector(sector_header, sector_buffer);
-                SendSector(sector_buffer, sector, track, (unsigned char)(dsksync >> 8), (unsigned char)dsksync);
+                SendSector(pData, pDataChecksum, sector, track, (unsigned char)(dsksync >> 8), (unsigned char)dsksync);
 
                 if (sector == LAST_SECTOR)
                     SendGap();
@@ -270,6 +445,9 @@ void ReadTrack(adfTYPE *drive)
         else // go to the start of current track
         {
             sector = 0;
+#ifdef HAVE_FDD_CACHE
+            if (!cache)
+#endif
             f_lseek(&drive->file, (drive->track * SECTOR_COUNT) * 512);
         }
 
@@ -597,6 +775,9 @@ void WriteTrack(adfTYPE *drive)
     unsigned char Sector;
     FRESULT res;
     FSIZE_t fpos;
+#ifdef HAVE_FDD_CACHE
+    fddCacheTYPE *cache = CacheTrack(drive);
+#endif
 
     fdd_debugf("Write track %d\r", drive->track);
     drive->track_prev = -1; // just to force next read from the start of current track
@@ -605,6 +786,29 @@ void WriteTrack(adfTYPE *drive)
     {
         if (GetHeader(&Track, &Sector))
         {
+#ifdef HAVE_FDD_CACHE
+            if (Track == drive->track && cache)
+            {
+                // stage the sector in the track cache, written back later
+                if (GetData())
+                {
+                    if (drive->status & DSK_WRITABLE)
+                    {
+                        fdd_debugf("Stage sector: %d\r", Sector);
+                        memcpy(&cache->data[Sector * 512], sector_buffer, 512);
+                        DataChecksum(sector_buffer, cache->checksum[Sector]);
+                        cache->dirty |= 1 << Sector;
+                        cache->flush_timer = GetTimer(FDD_FLUSH_DELAY);
+                    }
+                    else
+                    {
+                        Error = 30;
+                        fdd_debugf("Write attempt to protected disk!\r");
+                    }
+                }
+            }
+            else
+#endif
             if (Track == drive->track)
             {
                 res = f_lseek(&drive->file, (drive->track * SECTOR_COUNT + Sector) * 512);
@@ -636,6 +840,9 @@ void WriteTrack(adfTYPE *drive)
             ErrorMessage("  WriteTrack", Error);
         }
     }
+#ifdef HAVE_FDD_CACHE
+    if (!cache)
+#endif
     f_sync(&drive->file);
 }
 
@@ -668,5 +875,14 @@ void HandleFDD(unsigned char c1, unsigned char c2)
         WriteTrack(&df[sel]);
         DISKLED_OFF;
     }
+#ifdef HAVE_FDD_CACHE
+    else
+    {
+        // write back tracks the drives didn't touch for a while
+        for (sel = 0; sel < 4; sel++)
+            if (fdd_cache[sel].dirty && CheckTimer(fdd_cache[sel].flush_timer))
+                CacheFlush(&df[sel]);
+    }
+#endif
 }
 
@@ -32,6 +32,9 @@ unsigned char FindSync(adfTYPE *drive);
 unsigned char GetHeader(unsigned char *pTrack, unsigned char *pSector);
 unsigned char GetData(void);
 void WriteTrack(adfTYPE *drive);
+void FlushFloppy(adfTYPE *drive);
+void EjectFloppy(adfTYPE *drive);
+unsigned char FloppyDirty(adfTYPE *drive);
 void UpdateDriveStatus(void);
 void HandleFDD(unsigned char c1, unsigned char c2);
 
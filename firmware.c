@@ -25,6 +25,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "barriers.h"
 #include "fat_compat.h"
 #include "firmware.h"
+#include "crc32.h"
 
 #ifndef FW_ID
 #define FW_ID "MNMGUPG"
@@ -32,21 +33,6 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 static DWORD clmt[99];
 
-unsigned long CalculateCRC32(unsigned long crc, unsigned char *pBuffer, unsigned long nSize) {
-   int i, j;
-   unsigned long byte, mask;
-
-   while (nSize--) {
-      byte = *pBuffer++;            // Get next byte.
-      crc = crc ^ byte;
-      for (j = 7; j >= 0; j--) {    // Do eight times.
-         mask = -(crc & 1);
-         crc = (crc >> 1) ^ (0xEDB88320 & mask);
-      }
-   }
-   return crc;
-}
-
 unsigned char CheckFirmware(char *name)
 {
     UPGRADE *pUpgrade = (UPGRADE*)sector_buffer;
@@ -150,6 +136,10 @@ RAMFUNC void WriteFirmware(char *name)
     unsigned long page;
     unsigned long *pSrc;
     unsigned long *pDst;
+    unsigned long crc;
+    unsigned long rom_crc;
+    unsigned char pass;
+    FSIZE_t rom_size;
     FSIZE_t size;
     FIL file;
 
@@ -159,13 +149,19 @@ RAMFUNC void WriteFirmware(char *name)
     if (f_open(&file, name, FA_READ) != FR_OK) return;
     clmt[0] = 99;
     file.cltbl = clmt;
-    if ((f_lseek(&file, CREATE_LINKMAP) != FR_OK) ||
-        (f_lseek(&file, sizeof(UPGRADE)) != FR_OK) ||
+    if (f_lseek(&file, CREATE_LINKMAP) != FR_OK) {
+        f_close(&file);
+        return;
+    }
+    // the ROM CRC to verify the programmed flash against
+    FileReadNextBlock(&file, sector_buffer);
+    rom_crc = ((UPGRADE*)sector_buffer)->rom.crc;
+    if ((f_lseek(&file, sizeof(UPGRADE)) != FR_OK) ||
         (f_tell(&file) != sizeof(UPGRADE))) {
         f_close(&file);
         return;
     }
-    size = f_size(&file) - sizeof(UPGRADE);
+    rom_size = f_size(&file) - sizeof(UPGRADE);
     // All interrupts have to be disabled.
     arch_irq_disable();
 //    asm volatile ("mrs r12, CPSR; orr r12, r12, #0xC0; msr CPSR_c, r12"
@@ -176,49 +172,65 @@ RAMFUNC void WriteFirmware(char *name)
 
     // Hack to foul FatFs to not handle a final partial sector (to avoid a memcpy)
     file.obj.objsize = (file.obj.objsize + 511) & 0xfffffe00;
-    page = 0;
-    pDst = 0;
 
     UnlockFlash();
 
-    while (size)
+    // the flash is read back while programming, on a CRC mismatch the
+    // whole ROM is programmed once more
+    for (pass = 0; pass < 2; pass++)
     {
-        if (size > 512)
-            read_size = 512;
-        else
-            read_size = size;
+        // rewind without f_lseek(), which lives in the flash
+        file.fptr = sizeof(UPGRADE);
+        file.clust = file.obj.sclust;
+        size = rom_size;
+        page = 0;
+        pDst = 0;
+        crc = -1;
+
+        while (size)
+        {
+            if (size > 512)
+                read_size = 512;
+            else
+                read_size = size;
 
-        // On _any_ error the upgrade will fail :-(
-        // then the firmware needs to be upgraded by another way!
-        FileReadNextBlock(&file, sector_buffer);
+            // On _any_ error the upgrade will fail :-(
+            // then the firmware needs to be upgraded by another way!
+            FileReadNextBlock(&file, sector_buffer);
 
 #ifndef GCC_OPTIMZES_TOO_MUCH  // the latest gcc 4.8.0 calls memset for this
-        // it doesn't hurt to not do this at all
+            // it doesn't hurt to not do this at all
 
-        // fill the rest of buffer
-        for (i = read_size; i < 512; i++)
-            sector_buffer[i] = 0xFF;
+            // fill the rest of buffer
+            for (i = read_size; i < 512; i++)
+                sector_buffer[i] = 0xFF;
 #endif
 
-        // programming time: 13.2 ms per disk sector (512B)
-        pSrc = (unsigned long*)sector_buffer;
-        k = 512/FLASH_PAGESIZE;
-        while (k--)
-        {
-            if(size & 2048) DISKLED_ON
-            else DISKLED_OFF;
+            // programming time: 13.2 ms per disk sector (512B)
+            pSrc = (unsigned long*)sector_buffer;
+            k = 512/FLASH_PAGESIZE;
+            while (k--)
+            {
+                if(size & 2048) DISKLED_ON
+                else DISKLED_OFF;
+
+                i = FLASH_PAGESIZE / 4;
+                while (i--) {
+                    *pDst++ = *pSrc++;
+                    dmb();
+                }
 
-            i = FLASH_PAGESIZE / 4;
-            while (i--) {
-                *pDst++ = *pSrc++;
-                dmb();
+                WriteFlash(page);
+                page++;
             }
 
-            WriteFlash(page);
-            page++;
+            // read back the sector just programmed
+            crc = CalculateCRC32Ram(crc, (unsigned char*)(pDst - 512/4), read_size);
+            size -= read_size;
         }
 
-        size -= read_size;
+        if (~crc == rom_crc)
+            break;
     }
 
     DISKLED_OFF;
@@ -15,7 +15,6 @@ typedef struct
     unsigned long crc;
 } UPGRADE;
 
-unsigned long CalculateCRC32(unsigned long crc, unsigned char *pBuffer, unsigned long nSize);
 unsigned char CheckFirmware(char *name);
 void WriteFirmware(char *name) RAMFUNC;
 char *GetFirmwareVersion(char *name);
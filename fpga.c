@@ -33,11 +33,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "boot.h"
 #include "osd.h"
 #include "fpga.h"
+#include "kickstart.h"
 #include "tos.h"
 #include "arc_file.h"
 #include "mist_cfg.h"
 #include "settings.h"
 #include "usb/joymapping.h"
+#include "rbz.h"
+#ifdef HAVE_CORE_CACHE
+#include "core_cache.h"
+#endif
 
 #ifndef DEFAULT_CORE_NAME
 #define DEFAULT_CORE_NAME "CORE.RBF"
@@ -60,6 +65,8 @@ char minimig_ver_beta;
 char minimig_ver_major;
 char minimig_ver_minor;
 char minimig_ver_minion;
+// bytes the minimig_v2 core takes between the wait cycles of OSD_CMD_WR
+static unsigned int minimig_wr_burst = 2;
 
 char BootPrint(const char *text);
 
@@ -252,13 +259,85 @@ static inline void ShiftFpga(unsigned char data)
     }
 }
 
+/* One bit of a 32 bit word, the bitstream is sent LSB first */
+#define SHIFT_BIT(w, n) \
+        ALTERA_DATA0_RESET; \
+        ALTERA_DCLK_RESET; \
+        if((w) & (1UL << (n))) ALTERA_DATA0_SET; \
+        ALTERA_DCLK_SET;
+
+#define SHIFT_BYTE(w, n) \
+        SHIFT_BIT(w, n)   SHIFT_BIT(w, n+1) SHIFT_BIT(w, n+2) SHIFT_BIT(w, n+3) \
+        SHIFT_BIT(w, n+4) SHIFT_BIT(w, n+5) SHIFT_BIT(w, n+6) SHIFT_BIT(w, n+7)
+
+// the bytes of a little endian word in order, as ShiftFpga() would send them
+static inline void ShiftFpgaWord(uint32_t w)
+{
+    SHIFT_BYTE(w, 0)
+    SHIFT_BYTE(w, 8)
+    SHIFT_BYTE(w, 16)
+    SHIFT_BYTE(w, 24)
+}
+
+// shift a block of the bitstream, word-wide if it's aligned
+static void ShiftFpgaBlock(const unsigned char *buf, unsigned int len)
+{
+    if (!((uintptr_t)buf & 3)) {
+        const uint32_t *w = (const uint32_t*)buf;
+        for (; len >= 16; len -= 16) {
+            ShiftFpgaWord(*w++);
+            ShiftFpgaWord(*w++);
+            ShiftFpgaWord(*w++);
+            ShiftFpgaWord(*w++);
+        }
+        for (; len >= 4; len -= 4)
+            ShiftFpgaWord(*w++);
+        buf = (const unsigned char*)w;
+    }
+    while (len--)
+        ShiftFpga(*buf++);
+}
+
+static FIL *bitstream_file;
+static unsigned long bitstream_done;
+static unsigned long bitstream_read_time;
+
+static unsigned int ConfigureFpgaRead(unsigned char *buf, unsigned int len)
+{
+    unsigned long time = GetRTTC();
+    UINT br;
+
+    if (f_read(bitstream_file, buf, len, &br) != FR_OK)
+        br = 0;
+    bitstream_read_time += GetRTTC() - time;
+    return br;
+}
+
+static char ConfigureFpgaShift(const unsigned char *buf, unsigned int len)
+{
+    if (bitstream_done & (1<<13))
+        DISKLED_OFF
+    else
+        DISKLED_ON
+
+    if ((bitstream_done & (SECTOR_BUFFER_SIZE*4-1)) == 0)
+        iprintf("*");
+
+    bitstream_done += len;
+    ShiftFpgaBlock(buf, len);
+
+    /* Check for error through NSTATUS after every block */
+    return ALTERA_NSTATUS_STATE ? 1 : 0;
+}
+
 // Altera FPGA configuration
 unsigned char ConfigureFpga(const char *name)
 {
     unsigned long i;
-    unsigned char *ptr;
+    unsigned long time;
     FIL file;
     UINT br;
+    char compressed;
 
     // set outputs
     ALTERA_DCLK_SET;
@@ -268,18 +347,37 @@ unsigned char ConfigureFpga(const char *name)
     if(!name)
       name = DEFAULT_CORE_NAME;
 
-    // open bitstream file
+    // open bitstream file, or the compressed one with .RBZ extension
     if (f_open(&file, name, FA_READ) != FR_OK)
     {
-        iprintf("No FPGA configuration file found!\r");
-        return ERROR_BITSTREAM_OPEN;
+        const char *ext = GetExtension(name);
+        char rbzname[FF_LFN_BUF + 1];
+
+        if (!ext || strncasecmp(ext, "RBF", 3) || strlen(name) > FF_LFN_BUF) {
+            iprintf("No FPGA configuration file found!\r");
+            return ERROR_BITSTREAM_OPEN;
+        }
+        strcpy(rbzname, name);
+        strcpy(&rbzname[ext - name], "RBZ");
+        if (f_open(&file, rbzname, FA_READ) != FR_OK)
+        {
+            iprintf("No FPGA configuration file found!\r");
+            return ERROR_BITSTREAM_OPEN;
+        }
     }
 
     iprintf("FPGA bitstream file %s opened, file size = %llu\r", name, f_size(&file));
-    iprintf("[");
+#ifdef HAVE_CORE_CACHE
+    core_cache_linkmap(&file);
+#endif
 
-    // send all bytes to FPGA in loop
-    ptr = sector_buffer;
+    // compressed bitstreams are recognized by the header
+    if (f_read(&file, sector_buffer, RBZ_HDR_SIZE, &br) != FR_OK || f_lseek(&file, 0) != FR_OK) {
+        f_close(&file);
+        return ERROR_READ_BITSTREAM_FAILED;
+    }
+    compressed = (br == RBZ_HDR_SIZE) && rbz_is_compressed(sector_buffer);
+    iprintf("[");
 
     ALTERA_START_CONFIG
     /* Drive a transition of 0 to 1 to NCONFIG to indicate start of configuration */
@@ -304,57 +402,55 @@ unsigned char ConfigureFpga(const char *name)
 
     DISKLED_ON;
 
-    int t = 0;
-    int n = f_size(&file) >> 3;
-
-    /* Loop through every single byte */
-    for ( i = 0; i < f_size(&file); )
-    {
-        // read sector if SECTOR_BUFFER_SIZE bytes done
-        if ((i & (SECTOR_BUFFER_SIZE-1)) == 0)
-        {
-            if (i & (1<<13))
-                DISKLED_OFF
-            else
-                DISKLED_ON
-
-            if ((i & (SECTOR_BUFFER_SIZE*4-1)) == 0)
-                iprintf("*");
-
-            if (f_read(&file, sector_buffer, SECTOR_BUFFER_SIZE, &br) != FR_OK) {
-                f_close(&file);
-                return ERROR_READ_BITSTREAM_FAILED;
+    bitstream_file = &file;
+    bitstream_done = 0;
+    bitstream_read_time = 0;
+    time = GetRTTC();
+
+    char res = RBZ_OK;
+    if (compressed) {
+        // the decoder works in the sector buffer
+        res = rbz_decompress(sector_buffer, SECTOR_BUFFER_SIZE, ConfigureFpgaRead, ConfigureFpgaShift);
+    } else {
+        // read and send SECTOR_BUFFER_SIZE blocks
+        while (bitstream_done < f_size(&file)) {
+            if (!(br = ConfigureFpgaRead(sector_buffer, SECTOR_BUFFER_SIZE))) {
+                res = RBZ_ERR_READ;
+                break;
             }
-
-            ptr = sector_buffer;
-        }
-
-        int bytes2copy = (i < f_size(&file) - 8)?8:f_size(&file)-i;
-        i += bytes2copy;
-        while(bytes2copy) {
-          ShiftFpga(*ptr++);
-          bytes2copy--;
-        }
-
-        /* Check for error through NSTATUS for every 10KB programmed and the last byte */
-        if ( !(i % 10240) || (i == f_size(&file) - 1) ) {
-            if ( !ALTERA_NSTATUS_STATE ) {
-                ALTERA_STOP_CONFIG
-
-                iprintf("FPGA NSTATUS is NOT high!\r");
-                f_close(&file);
-                return ERROR_UPDATE_PROGRESS_FAILED;
+            if (!ConfigureFpgaShift(sector_buffer, br)) {
+                res = RBZ_ERR_WRITE;
+                break;
             }
         }
     }
     ALTERA_STOP_CONFIG
 
     f_close(&file);
+    time = GetRTTC() - time;
 
     iprintf("]\r");
-    iprintf("FPGA bitstream loaded\r");
     DISKLED_OFF;
 
+    switch (res) {
+        case RBZ_OK:
+            break;
+        case RBZ_ERR_WRITE:
+            iprintf("FPGA NSTATUS is NOT high!\r");
+            return ERROR_UPDATE_PROGRESS_FAILED;
+        case RBZ_ERR_CRC:
+            iprintf("FPGA bitstream CRC error!\r");
+            return ERROR_BITSTREAM_CRC;
+        default:
+            iprintf("FPGA bitstream read failed (%d)!\r", res);
+            return ERROR_READ_BITSTREAM_FAILED;
+    }
+
+    iprintf("FPGA bitstream loaded, %lu bytes in %lu ms (read: %lu ms)", bitstream_done, time, bitstream_read_time);
+    if (bitstream_done >= 1024)
+        iprintf(", %lu ms/MB", (time << 10) / (bitstream_done >> 10));
+    iprintf("\r");
+
     // check if DONE is high
     if (!ALTERA_DONE_STATE) {
       iprintf("FPGA Configuration done but contains error... CONF_DONE is LOW\r");
@@ -392,12 +488,40 @@ unsigned char ConfigureFpga(const char *name)
 #endif
 
 
+// wait until the minimig v1 core requests data, then send the sector buffer
+static void SendSector(void)
+{
+    unsigned char c1;
+
+    do
+    {
+        // read FPGA status
+        EnableFpga();
+        c1 = SPI(0);
+        SPI(0);
+        SPI(0);
+        SPI(0);
+        SPI(0);
+        SPI(0);
+        DisableFpga();
+    }
+    while (!(c1 & CMD_RDTRK));
+
+    // send data sector to FPGA
+    EnableFpga();
+    SPI(0);
+    SPI(0);
+    SPI(0);
+    SPI(0);
+    SPI(0);
+    SPI(0);
+    spi_block_write(sector_buffer);
+    DisableFpga();
+}
+
 void SendFile(FIL *file)
 {
-    unsigned char  c1, c2;
-    unsigned long  j;
     unsigned long  n;
-    unsigned char *p;
 
     iprintf("[");
     n = (f_size(file) + 511) >> 9; // sector count (rounded up)
@@ -406,37 +530,10 @@ void SendFile(FIL *file)
         // read data sector from memory card
         FileReadBlock(file,sector_buffer);
 
-        do
-        {
-            // read FPGA status
-            EnableFpga();
-            c1 = SPI(0);
-            c2 = SPI(0);
-            SPI(0);
-            SPI(0);
-            SPI(0);
-            SPI(0);
-            DisableFpga();
-        }
-        while (!(c1 & CMD_RDTRK));
-
         if ((n & 15) == 0)
             iprintf("*");
 
-        // send data sector to FPGA
-        EnableFpga();
-        c1 = SPI(0);
-        c2 = SPI(0);
-        SPI(0);
-        SPI(0);
-        SPI(0);
-        SPI(0);
-        p = sector_buffer;
-
-        for (j = 0; j < 512; j++)
-            SPI(*p++);
-
-        DisableFpga();
+        SendSector();
     }
     iprintf("]\r");
 }
@@ -445,13 +542,9 @@ void SendFile(FIL *file)
 void SendFileEncrypted(FIL *file,unsigned char *key,int keysize)
 {
     UINT br;
-    unsigned char  c1, c2;
     unsigned char headersize;
     unsigned int keyidx=0;
-    unsigned long  j;
     unsigned long  n;
-    unsigned char *p;
-    int badbyte=0;
 
     iprintf("[");
     headersize=f_size(file)&255;	// ROM should be a round number of kilobytes; overspill will likely be the Amiga Forever header.
@@ -462,43 +555,12 @@ void SendFileEncrypted(FIL *file,unsigned char *key,int keysize)
     while (n--)
     {
         FileReadBlock(file,sector_buffer);
-        for (j = 0; j < 512; j++)
-        {
-            sector_buffer[j]^=key[keyidx++];
-            if(keyidx>=keysize)
-            keyidx-=keysize;
-        }
-
-        do
-        {
-            // read FPGA status
-            EnableFpga();
-            c1 = SPI(0);
-            c2 = SPI(0);
-            SPI(0);
-            SPI(0);
-            SPI(0);
-            SPI(0);
-            DisableFpga();
-        }
-        while (!(c1 & CMD_RDTRK));
+        kick_decrypt(sector_buffer, 512, key, keysize, &keyidx);
 
         if ((n & 15) == 0)
             iprintf("*");
 
-        // send data sector to FPGA
-        EnableFpga();
-        c1 = SPI(0);
-        c2 = SPI(0);
-        SPI(0);
-        SPI(0);
-        SPI(0);
-        SPI(0);
-        p = sector_buffer;
-
-        for (j = 0; j < 512; j++)
-            SPI(*p++);
-        DisableFpga();
+        SendSector();
     }
     iprintf("]\r");
 }
@@ -534,12 +596,37 @@ out:
   return;
 }
 
+// ask the minimig_v2 core how many words it buffers for OSD_CMD_WR. Cores
+// without OSD_CMD_WR_CAPS don't answer 0xa5 and get a word at a time.
+static void GetMinimigWrBurst(void)
+{
+  unsigned char magic, burst, check;
+
+  EnableOsd();
+  SPI(OSD_CMD_WR_CAPS);
+  magic = SPI(0xff);
+  burst = SPI(0xff);
+  check = SPI(0xff);
+  DisableOsd();
+  SPIN(); SPIN(); SPIN(); SPIN();
+
+  minimig_wr_burst = 2;
+  if (magic == 0xa5 && burst == (unsigned char)~check && burst != 1) {
+    minimig_wr_burst = burst ? burst << 1 : 512;
+    // the sector must split into whole bursts
+    while (512 % minimig_wr_burst) minimig_wr_burst -= 2;
+    iprintf("Minimig: %d bytes write bursts\n", minimig_wr_burst);
+  }
+}
+
 // SendFileV2 (for minimig_v2)
-void SendFileV2(FIL* file, unsigned char* key, int keysize, int address, int size)
+// returns the Kickstart checksum of the data sent (before the 1.x patch)
+unsigned long SendFileV2(FIL* file, unsigned char* key, int keysize, int address, int size)
 {
   UINT br;
   int i,j;
   unsigned int keyidx=0;
+  unsigned long sum=0;
 
   iprintf("File size: %dkB\r", size>>1);
   iprintf("[");
@@ -550,13 +637,8 @@ void SendFileV2(FIL* file, unsigned char* key, int keysize, int address, int siz
   for (i=0; i<size; i++) {
     if (!(i&31)) iprintf("*");
     FileReadBlock(file, sector_buffer);
-    if (keysize) {
-      // decrypt ROM
-      for (j=0; j<512; j++) {
-        sector_buffer[j] ^= key[keyidx++];
-        if(keyidx >= keysize) keyidx -= keysize;
-      }
-    }
+    if (keysize) kick_decrypt(sector_buffer, 512, key, keysize, &keyidx);
+    sum = kick_checksum(sum, sector_buffer, 512);
 
     // patch kickstart 1.x to force memory detection every time the AMIGA is reset
     if (minimig_cfg.kick1x_memory_detection_patch && (i == 0 || i == 512)) {
@@ -575,13 +657,20 @@ void SendFileV2(FIL* file, unsigned char* key, int keysize, int address, int siz
     SPI(adr&0xff); adr = adr>>8;
     SPI(adr&0xff); adr = adr>>8;
     SPIN(); SPIN(); SPIN(); SPIN();
-    for (j=0; j<512; j=j+4) {
-      SPI(sector_buffer[j+0]);
-      SPI(sector_buffer[j+1]);
-      SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN();
-      SPI(sector_buffer[j+2]);
-      SPI(sector_buffer[j+3]);
-      SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN();
+    if (minimig_wr_burst == 2) {
+      for (j=0; j<512; j=j+4) {
+        SPI(sector_buffer[j+0]);
+        SPI(sector_buffer[j+1]);
+        SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN();
+        SPI(sector_buffer[j+2]);
+        SPI(sector_buffer[j+3]);
+        SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN();
+      }
+    } else {
+      for (j=0; j<512; j+=minimig_wr_burst) {
+        spi_write(sector_buffer+j, minimig_wr_burst);
+        SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN();
+      }
     }
     DisableOsd();
   }
@@ -593,6 +682,7 @@ void SendFileV2(FIL* file, unsigned char* key, int keysize, int address, int siz
   if (applypatchstr) {
     iprintf(applypatchstr);
   }
+  return sum;
 }
 
 
@@ -968,6 +1058,7 @@ unsigned char fpga_init(const char *name) {
       minimig_ver_minion = SPI(0xff);
       DisableOsd();
       SPIN(); SPIN(); SPIN(); SPIN();
+      GetMinimigWrBurst();
       EnableOsd();
       SPI(OSD_CMD_RST);
       rstval = (SPI_RST_USR | SPI_RST_CPU | SPI_CPU_HLT);
@@ -999,10 +1090,10 @@ unsigned char fpga_init(const char *name) {
     ChangeDirectoryName("/");
 
     //eject all disk
-    df[0].status = 0;
-    df[1].status = 0;
-    df[2].status = 0;
-    df[3].status = 0;
+    EjectFloppy(&df[0]);
+    EjectFloppy(&df[1]);
+    EjectFloppy(&df[2]);
+    EjectFloppy(&df[3]);
 
     config.kickstart[0]=0;
     SetConfigurationFilename(arc_get_cfg_file_n());
@@ -37,6 +37,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "fpga.h"
 #include "scsi.h"
 #include "cue_parser.h"
+#include "cd_cache.h"
 #ifdef HAVE_QSPI
 #include "qspi.h"
 #include "user_io.h"
@@ -414,16 +415,12 @@ static void cdrom_generate_ecc(unsigned char *pBuffer, unsigned int lba)
 
 static void cdrom_playaudio()
 {
-  UINT br;
   unsigned char track = cue_gettrackbylba(cdrom.currentlba);
   if ((toc.tracks[track].type != SECTOR_AUDIO) || (toc.tracks[track].sector_size != 2352)) {
     cdrom.audiostatus = AUDIO_ERROR;
     return;
   }
-  DISKLED_ON
-  int offset = (cdrom.currentlba - toc.tracks[track].start) * toc.tracks[track].sector_size + toc.tracks[track].offset;
-  f_lseek(&toc.file->file, offset);
-  f_read(&toc.file->file, sector_buffer, 2352, &br);
+  cd_read_sector(cdrom.currentlba, sector_buffer, CD_SECTOR_RAW);
   EnableFpga();
   SPI(CMD_IDE_CDDA_WR); // write cdda command
   SPI(0x00);
@@ -433,7 +430,6 @@ static void cdrom_playaudio()
   SPI(0x00);
   spi_write(sector_buffer, 2352);
   DisableFpga();
-  DISKLED_OFF
   if (cdrom.currentlba == cdrom.endlba)
     cdrom.audiostatus = AUDIO_COMPLETE;
   else
@@ -442,8 +438,6 @@ static void cdrom_playaudio()
 
 static void PKT_Read(unsigned char unit, unsigned int lba, unsigned int len, unsigned short bytelimit, unsigned short blocksize)
 {
-  UINT br;
-  unsigned char *pBuffer;
   if (!toc.valid) {
     cdrom_setsense(SENSEKEY_NOT_READY, 0x3a, 0);
     cdrom_send_error(unit);
@@ -455,7 +449,6 @@ static void PKT_Read(unsigned char unit, unsigned int lba, unsigned int len, uns
 
   while (len--) {
     unsigned char track = cue_gettrackbylba(lba);
-    int offset = (lba - toc.tracks[track].start) * toc.tracks[track].sector_size + toc.tracks[track].offset;
 
     if ((blocksize == 2048 && toc.tracks[track].type != SECTOR_DATA_MODE1 && toc.tracks[track].type != SECTOR_DATA_MODE2) ||
         (blocksize != 2048 && blocksize !=2352) ||
@@ -464,17 +457,12 @@ static void PKT_Read(unsigned char unit, unsigned int lba, unsigned int len, uns
       cdrom_send_error(unit);
       return;
     }
-    pBuffer = sector_buffer;
     cdrom.currentlba = lba;
-    if (blocksize == 2048 && toc.tracks[track].sector_size == 2352) offset+=16;
-    if (blocksize == 2048 && toc.tracks[track].sector_size >= 2336 && toc.tracks[track].type == SECTOR_DATA_MODE2) offset+=8; // CD-XA with 8 subheader bytes
     if (blocksize == 2352 && (toc.tracks[track].sector_size == 2048 || toc.tracks[track].sector_size == 2336)) {
-       cdrom_generate_header(pBuffer, lba);
-       pBuffer+=16;
+       cdrom_generate_header(sector_buffer, lba);
     }
-    hdd_debugf("lba: %d track: %d, offset: %d, blocksize: %d sector_size: %d", lba, track, offset, blocksize, toc.tracks[track].sector_size);
-    f_lseek(&toc.file->file, offset);
-    f_read(&toc.file->file, pBuffer, MIN(toc.tracks[track].sector_size, blocksize), &br);
+    hdd_debugf("lba: %d track: %d, blocksize: %d sector_size: %d", lba, track, blocksize, toc.tracks[track].sector_size);
+    cd_read_sector(lba, sector_buffer, blocksize);
     if (blocksize == 2352 && toc.tracks[track].sector_size == 2048) {
        cdrom_generate_ecc(sector_buffer, lba);
     }
@@ -1319,6 +1307,22 @@ static inline void ATA_ReadSectors(unsigned char* tfr, unsigned short sector, un
           ++lba;
           --blk;
         }
+#ifdef HAVE_IDX_CACHE
+        // small reads of the Archie go through the image cache
+        if(blk && blk < IDX_CACHE_LINE && user_io_core_type() == CORE_TYPE_ARCHIE)
+        {
+          IDXCacheRead(hdf[unit].idxfile, lba + hdf[unit].offset, sector_buffer, blk);
+          if (!verify) {
+            EnableFpga();
+            spi8(CMD_IDE_DATA_WR); // write data command
+            spi_n(0x00, 5);
+            spi_write(sector_buffer, 512*blk);
+            DisableFpga();
+          }
+          lba+=blk;
+          blk=0;
+        }
+#endif
         if(blk) // Any blocks left?
         {
           HardFileSeek(&hdf[unit], lba + hdf[unit].offset);
@@ -1456,6 +1460,9 @@ static inline void ATA_WriteSectors(unsigned char* tfr, unsigned short sector, u
           if (f_size(&hdf[unit].idxfile->file) && (lba>-1)) {
             // Don't attempt to write to fake RDB
             f_write(&hdf[unit].idxfile->file, sector_buffer, 512*block_size, &bw);
+#ifdef HAVE_IDX_CACHE
+            IDXCacheWrite(hdf[unit].idxfile, lba, sector_buffer, block_size);
+#endif
           }
           lba+=block_size;
           break;
@@ -142,6 +142,11 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #define SECTOR_BUFFER_SIZE   8192
 
+// CD image cache: 2 lines of 4 raw sectors, the current one and the one
+// read ahead (20K with the subchannel data)
+#define CD_CACHE_LINES        2
+#define CD_CACHE_LINE_SECTORS 4
+
 void __init_hardware();
 
 char mmc_inserted();
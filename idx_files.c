@@ -163,15 +163,7 @@ static int send_tap_header(uint8_t *header_buf, FSIZE_t program_size,
     iprintf("IDX: TAP header - version=%d, size=%u\n",
             *tap_version_out, (unsigned int)program_size);
 
-    EnableFpga();
-    SPI(DIO_FILE_TX_DAT);
-    // spi_write(header_buf, TAP_HEADER_SIZE);
-    {
-        int i;
-        for (i = 0; i < TAP_HEADER_SIZE; i++)
-            SPI(header_buf[i]);
-    }
-    DisableFpga();
+    data_io_file_tx_data((const char*)header_buf, TAP_HEADER_SIZE);
 
     return 0;
 }
@@ -203,16 +195,7 @@ static unsigned int send_tap_data(FSIZE_t program_size, unsigned int offset)
             break;
         }
 
-        EnableFpga();
-        SPI(DIO_FILE_TX_DAT);
-	// spi_write(sector_buffer, br);
-        {
-            unsigned int c;
-            char *p;
-            for (p = sector_buffer, c = 0; c < br; c++)
-                SPI(*p++);
-        }
-        DisableFpga();
+        data_io_file_tx_data(sector_buffer, br);
 
         total_sent += br;
         bytes_to_send -= br;
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include "idxfile.h"
 #include "hardware.h"
 
@@ -25,13 +26,111 @@ void IDXIndex(IDXFile *pIDXF) {
 }
 
 unsigned char IDXOpen(IDXFile *file, const char *name, char mode) {
+#ifdef HAVE_IDX_CACHE
+  IDXCacheInvalidate(file);
+#endif
   return f_open(&(file->file), name, mode);
 }
 
 void IDXClose(IDXFile *file) {
+#ifdef HAVE_IDX_CACHE
+  IDXCacheInvalidate(file);
+#endif
   f_close(&(file->file));
 }
 
 unsigned char IDXSeek(IDXFile *file, unsigned long lba) {
   return f_lseek(&(file->file), (FSIZE_t) lba << 9);
 }
+
+#ifdef HAVE_IDX_CACHE
+static struct {
+  IDXFile *file;       // 0 = free
+  unsigned long lba;
+  unsigned long used;  // time of last access
+  char pinned;
+  unsigned char data[IDX_CACHE_LINE * 512];
+} idx_cache[IDX_CACHE_LINES];
+
+static unsigned long idx_cache_time;
+static idx_pin_t idx_cache_pin;
+
+void IDXCacheSetPin(idx_pin_t pin) {
+  idx_cache_pin = pin;
+}
+
+void IDXCacheInvalidate(IDXFile *file) {
+  for (int i = 0; i < IDX_CACHE_LINES; i++) {
+    if (idx_cache[i].file == file) {
+      idx_cache[i].file = 0;
+      idx_cache[i].pinned = 0;
+    }
+  }
+}
+
+static int IDXCacheLoad(IDXFile *file, unsigned long lba) {
+  int i, victim = -1, oldest = -1, pinned = 0;
+  UINT br;
+
+  // free line or least recently used unpinned one
+  for (i = 0; i < IDX_CACHE_LINES; i++) {
+    if (idx_cache[i].pinned) {
+      pinned++;
+      if (oldest < 0 || idx_cache[i].used < idx_cache[oldest].used) oldest = i;
+    } else if (victim < 0 || (idx_cache[victim].file &&
+               (!idx_cache[i].file || idx_cache[i].used < idx_cache[victim].used))) {
+      victim = i;
+    }
+  }
+
+  idx_cache[victim].file = 0;
+  DISKLED_ON
+  if (f_lseek(&file->file, (FSIZE_t) lba << 9) != FR_OK ||
+      f_read(&file->file, idx_cache[victim].data, sizeof(idx_cache[victim].data), &br) != FR_OK || !br) {
+    DISKLED_OFF
+    return -1;
+  }
+  DISKLED_OFF
+  memset(idx_cache[victim].data + br, 0, sizeof(idx_cache[victim].data) - br);
+  idx_cache[victim].file = file;
+  idx_cache[victim].lba = lba;
+  idx_cache[victim].pinned = idx_cache_pin && idx_cache_pin(file, lba, idx_cache[victim].data);
+
+  // the oldest pinned line becomes an ordinary one
+  if (idx_cache[victim].pinned && pinned >= IDX_CACHE_PINNED)
+    idx_cache[oldest].pinned = 0;
+  return victim;
+}
+
+unsigned char IDXCacheRead(IDXFile *file, unsigned long lba, unsigned char *pBuffer, unsigned int count) {
+  while (count) {
+    unsigned long base = lba & ~(IDX_CACHE_LINE - 1);
+    unsigned int n = base + IDX_CACHE_LINE - lba;
+    int i;
+
+    if (n > count) n = count;
+    for (i = 0; i < IDX_CACHE_LINES; i++)
+      if (idx_cache[i].file == file && idx_cache[i].lba == base) break;
+    if (i == IDX_CACHE_LINES && (i = IDXCacheLoad(file, base)) < 0)
+      return FR_DISK_ERR;
+
+    idx_cache[i].used = ++idx_cache_time;
+    memcpy(pBuffer, idx_cache[i].data + (lba - base) * 512, n * 512);
+    pBuffer += n * 512;
+    lba += n;
+    count -= n;
+  }
+  return FR_OK;
+}
+
+void IDXCacheWrite(IDXFile *file, unsigned long lba, const unsigned char *pBuffer, unsigned int count) {
+  for (int i = 0; i < IDX_CACHE_LINES; i++) {
+    unsigned long first = idx_cache[i].lba, last = first + IDX_CACHE_LINE;
+
+    if (idx_cache[i].file != file || lba >= last || lba + count <= first) continue;
+    if (first < lba) first = lba;
+    if (last > lba + count) last = lba + count;
+    memcpy(idx_cache[i].data + (first - idx_cache[i].lba) * 512, pBuffer + (first - lba) * 512, (last - first) * 512);
+  }
+}
+#endif
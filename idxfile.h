@@ -57,4 +57,22 @@ void IDXClose(IDXFile *file);
 unsigned char IDXSeek(IDXFile *file, unsigned long lba);
 void IDXIndex(IDXFile *pIDXF);
 
+#ifdef HAVE_IDX_CACHE
+// Cache of image sectors for small random reads. Misses read a whole line,
+// lines the pin function marks (e.g. filesystem metadata) are only replaced
+// by each other once they fill their share of the cache.
+#define IDX_CACHE_LINE   4   // sectors
+#define IDX_CACHE_LINES  8
+#define IDX_CACHE_PINNED (IDX_CACHE_LINES/2)
+
+// data holds IDX_CACHE_LINE sectors from lba
+typedef char (*idx_pin_t)(IDXFile *file, unsigned long lba, const unsigned char *data);
+
+void IDXCacheSetPin(idx_pin_t pin);
+unsigned char IDXCacheRead(IDXFile *file, unsigned long lba, unsigned char *pBuffer, unsigned int count);
+// update the cached copies of sectors written to the image
+void IDXCacheWrite(IDXFile *file, unsigned long lba, const unsigned char *pBuffer, unsigned int count);
+void IDXCacheInvalidate(IDXFile *file);
+#endif
+
 #endif
@@ -52,11 +52,25 @@
 #define IKBD_DEFAULT IKBD_STATE_JOYSTICK_EVENT_REPORTING
 
 /* ------------------- transmit queue ------------------- */
+// Keyboard events and command replies are queued in order. Relative mouse
+// motion isn't queued, it's accumulated and sent as one packet whenever
+// the queue is empty, so keys never wait behind mouse packets.
 #define QUEUE_LEN 16    // power of 2!
 static unsigned short tx_queue[QUEUE_LEN];
 static unsigned char wptr = 0, rptr = 0;
 static unsigned long ikbd_timer = 0;
 
+#ifdef IKBD_DEBUG
+static unsigned short tx_time[QUEUE_LEN];  // ms when queued
+static struct {
+  unsigned char  depth;      // max queue depth
+  unsigned short latency;    // max ms from queueing to sending
+  unsigned int   drops;      // bytes lost to a full queue
+  unsigned int   reports;    // usb mouse reports
+  unsigned int   packets;    // relative mouse packets sent
+} tx_stat;
+#endif
+
 /* -------- main structure to keep track of ikbd state -------- */
 static struct {
   unsigned short state;
@@ -74,6 +88,10 @@ static struct {
     unsigned char but, but_prev;
     short x, y;
 
+    // relative packet waiting for the queue to empty, and being sent
+    unsigned char pending;
+    unsigned char packet[3], tx_len;
+
     struct {
       // absolute mouse state
       unsigned char  buttons;
@@ -121,11 +139,67 @@ unsigned short be16(unsigned short in) {
 }
 
 static void enqueue(unsigned short b) {
-  if(((wptr + 1)&(QUEUE_LEN-1)) == rptr)
+  if(((wptr + 1)&(QUEUE_LEN-1)) == rptr) {
+#ifdef IKBD_DEBUG
+    tx_stat.drops++;
+#endif
     return;
+  }
 
   tx_queue[wptr] = b;
+#ifdef IKBD_DEBUG
+  tx_time[wptr] = GetRTTC();
+#endif
   wptr = (wptr+1)&(QUEUE_LEN-1);
+#ifdef IKBD_DEBUG
+  if(((wptr - rptr)&(QUEUE_LEN-1)) > tx_stat.depth)
+    tx_stat.depth = (wptr - rptr)&(QUEUE_LEN-1);
+#endif
+}
+
+// build a relative mouse packet from the motion accumulated so far
+static void mouse_packet(void) {
+  unsigned char b = ikbd.mouse.but;
+  char x, y;
+
+  ikbd.mouse.pending = 0;
+  if((ikbd.state & (IKBD_STATE_WAIT4RESET | IKBD_STATE_PAUSED | IKBD_STATE_MOUSE_DISABLED |
+		    IKBD_STATE_MOUSE_ABSOLUTE | IKBD_STATE_MOUSE_KEYCODE)))
+    return;
+
+  // include joystick buttons into mouse state
+  if(ikbd.joy[0].state & 0x80) b |= 2;
+  if(ikbd.joy[1].state & 0x80) b |= 1;
+
+  if(ikbd.mouse.x < -128)      x = -128;
+  else if(ikbd.mouse.x >  127) x =  127;
+  else                         x =  ikbd.mouse.x;
+
+  if(ikbd.mouse.y < -128)      y = -128;
+  else if(ikbd.mouse.y >  127) y =  127;
+  else                         y =  ikbd.mouse.y;
+
+  //  iprintf("RMOUSE: %x %x %x\n", b, x&0xff, y&0xff);
+  ikbd.mouse.packet[0] = 0xf8|b;
+  ikbd.mouse.packet[1] = x;
+  ikbd.mouse.packet[2] = y;
+  ikbd.mouse.tx_len = 3;
+#ifdef IKBD_DEBUG
+  tx_stat.packets++;
+#endif
+
+  // the rest follows with the next packet
+  ikbd.mouse.x -= x;
+  ikbd.mouse.y -= y;
+  ikbd.mouse.pending = ikbd.mouse.x || ikbd.mouse.y;
+}
+
+static void ikbd_send(unsigned char b) {
+  spi_uio_cmd_cont(UIO_IKBD_OUT);
+  spi8(b);
+  DisableIO();
+
+  ikbd.tx_cnt++;
 }
 
 // convert internal joystick format into atari ikbd format
@@ -401,7 +475,10 @@ void ikbd_poll(void) {
     xtimer = GetTimer(2000);
     if(ikbd.tx_cnt != last_cnt) {
       ikbd_debugf("sent bytes: %d", ikbd.tx_cnt);
+      ikbd_debugf("queue depth %d, latency %d ms, %d dropped, %d mouse reports in %d packets",
+		  tx_stat.depth, tx_stat.latency, tx_stat.drops, tx_stat.reports, tx_stat.packets);
       last_cnt = ikbd.tx_cnt;
+      tx_stat.depth = tx_stat.latency = 0;
     }
   }
 #endif
@@ -486,26 +563,9 @@ void ikbd_poll(void) {
 	if(ikbd.joy[1].state & 0x80) b |= 1;
 
 	if(ikbd.mouse.x || ikbd.mouse.y || (b != ikbd.mouse.but_prev)) {
-	  do {
-	    char x, y;
-	    if(ikbd.mouse.x < -128)      x = -128;
-	    else if(ikbd.mouse.x >  127) x =  127;
-	    else                         x =  ikbd.mouse.x;
-	    
-	    if(ikbd.mouse.y < -128)      y = -128;
-	    else if(ikbd.mouse.y >  127) y =  127;
-	    else                         y =  ikbd.mouse.y;
-	    
-	    //	    iprintf("RMOUSE: %x %x %x\n", b, x&0xff, y&0xff);
-	    enqueue(0xf8|b);
-	    enqueue(x & 0xff);
-	    enqueue(y & 0xff);
-	    
-	    ikbd.mouse.x -= x;
-	    ikbd.mouse.y -= y;
-	    
-	  } while(ikbd.mouse.x || ikbd.mouse.y);
-	  
+	  // sent when the queue is empty, with the motion until then
+	  ikbd.mouse.pending = 1;
+
 	  // check if mouse buttons are supposed to be treated like keys
 	  if(ikbd.state & IKBD_STATE_MOUSE_BUTTON_AS_KEY) {
 	    
@@ -555,6 +615,16 @@ void ikbd_poll(void) {
     ikbd_timer = 0;
   }
 
+  // the line is free for the mouse only if nothing is queued
+  if(!ikbd.mouse.tx_len && rptr == wptr && ikbd.mouse.pending)
+    mouse_packet();
+
+  // a mouse packet in progress is completed first
+  if(ikbd.mouse.tx_len) {
+    ikbd_send(ikbd.mouse.packet[3 - ikbd.mouse.tx_len--]);
+    return;
+  }
+
   if(rptr == wptr) return;
 
   if(tx_queue[rptr] & 0x8000) {
@@ -567,12 +637,13 @@ void ikbd_poll(void) {
     return;
   }
   
+#ifdef IKBD_DEBUG
+  if((unsigned short)(GetRTTC() - tx_time[rptr]) > tx_stat.latency)
+    tx_stat.latency = GetRTTC() - tx_time[rptr];
+#endif
+
   // transmit data from queue
-  spi_uio_cmd_cont(UIO_IKBD_OUT);
-  spi8(tx_queue[rptr]);
-  DisableIO();
-  
-  ikbd.tx_cnt++;
+  ikbd_send(tx_queue[rptr]);
   
   rptr = (rptr+1)&(QUEUE_LEN-1);  
 }
@@ -595,6 +666,10 @@ void ikbd_mouse(unsigned char b, char x, char y) {
   if(ikbd.state & IKBD_STATE_MOUSE_Y_BOTTOM)
     y = -y;
 
+#ifdef IKBD_DEBUG
+  tx_stat.reports++;
+#endif
+
   // update relative mouse state
   ikbd.mouse.but = ((b&1)?2:0)|((b&2)?1:0);
   ikbd.mouse.x += x;
@@ -0,0 +1,334 @@
+// inflate.c
+// Streaming decoder of raw deflate data, based on the canonical decoding of
+// zlib's puff.c with a lookup table for the short codes
+
+#include <string.h>
+#include "inflate.h"
+
+#define MAXBITS   15   // longest code
+#define MAXLCODES 286  // literal/length codes in a dynamic block
+#define MAXDCODES 30   // distance codes
+#define FIXLCODES 288  // literal/length codes in the fixed block
+#define FASTBITS  9    // codes up to this length are decoded with one lookup
+
+typedef struct
+{
+  unsigned short count[MAXBITS+1];  // codes of each length
+  unsigned short symbol[FIXLCODES]; // symbols ordered by code
+  unsigned short fast[1 << FASTBITS]; // symbol << 4 | length by the next bits, 0 = longer code
+} huffman_t;
+
+typedef struct
+{
+  unsigned char   *window;
+  unsigned int    wpos;
+  unsigned long   total;   // output bytes, to validate the distances
+  unsigned char   *in;
+  unsigned int    in_size;
+  unsigned int    in_pos;
+  unsigned int    in_len;
+  unsigned int    overrun; // zero bytes fed after the end of the input
+  unsigned long   bitbuf;
+  unsigned int    bitcnt;
+  char            err;
+  inflate_read_t  read;
+  inflate_write_t write;
+  huffman_t       lencode;
+  huffman_t       distcode;
+} inflate_t;
+
+static inflate_t inf;
+
+unsigned char inflate_window[INFLATE_WINDOW] __attribute__ ((aligned (4)));
+
+static const unsigned short lbase[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const unsigned char lext[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const unsigned short dbase[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+  8193, 12289, 16385, 24577 };
+static const unsigned char dext[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static char inflate_fill(inflate_t *s) {
+  s->in_pos = 0;
+  s->in_len = s->read(s->in, s->in_size);
+  return s->in_len != 0;
+}
+
+// make at least n bits available. Past the end zeros are fed, which is only
+// an error if they are really consumed (checked by inflate_overrun()).
+static void inflate_need(inflate_t *s, unsigned int n) {
+  while (s->bitcnt < n) {
+    unsigned long c = 0;
+    if (s->in_pos < s->in_len || inflate_fill(s)) c = s->in[s->in_pos++];
+    else s->overrun++;
+    s->bitbuf |= c << s->bitcnt;
+    s->bitcnt += 8;
+  }
+}
+
+static char inflate_overrun(inflate_t *s) {
+  if (s->overrun * 8 > s->bitcnt) s->err = INFLATE_ERR_READ;
+  return s->err;
+}
+
+static unsigned int inflate_bits(inflate_t *s, unsigned int n) {
+  unsigned int val;
+
+  inflate_need(s, n);
+  val = s->bitbuf & ((1UL << n) - 1);
+  s->bitbuf >>= n;
+  s->bitcnt -= n;
+  return val;
+}
+
+static void inflate_flush(inflate_t *s) {
+  if (s->wpos && !s->write(s->window, s->wpos)) s->err = INFLATE_ERR_WRITE;
+  s->wpos = 0;
+}
+
+static void inflate_put(inflate_t *s, unsigned char c) {
+  s->window[s->wpos++] = c;
+  if (s->wpos == INFLATE_WINDOW) inflate_flush(s);
+}
+
+// build the canonical code from the code lengths, returns 0 for a complete
+// code, < 0 for an over-subscribed, > 0 for an incomplete one
+static int inflate_construct(huffman_t *h, const unsigned char *length, int n) {
+  unsigned short offs[MAXBITS+1];
+  unsigned int code, index;
+  int sym, len, left;
+
+  memset(h->count, 0, sizeof(h->count));
+  memset(h->fast, 0, sizeof(h->fast));
+  for (sym = 0; sym < n; sym++)
+    h->count[length[sym]]++;
+  if (h->count[0] == n) return 0;   // no codes, complete but decoding will fail
+
+  left = 1;
+  for (len = 1; len <= MAXBITS; len++) {
+    left <<= 1;
+    left -= h->count[len];
+    if (left < 0) return left;
+  }
+
+  offs[1] = 0;
+  for (len = 1; len < MAXBITS; len++)
+    offs[len + 1] = offs[len] + h->count[len];
+  for (sym = 0; sym < n; sym++)
+    if (length[sym]) h->symbol[offs[length[sym]]++] = sym;
+
+  // the codes are sent MSB first, the lookup is by the LSB first bit buffer
+  code = index = 0;
+  for (len = 1; len <= FASTBITS; len++) {
+    for (int i = 0; i < h->count[len]; i++, code++, index++) {
+      unsigned int rev = 0;
+      for (int b = 0; b < len; b++)
+        if (code & (1 << b)) rev |= 1 << (len - 1 - b);
+      for (; rev < (1 << FASTBITS); rev += 1 << len)
+        h->fast[rev] = h->symbol[index] << 4 | len;
+    }
+    code <<= 1;
+  }
+  return left;
+}
+
+static int inflate_decode(inflate_t *s, const huffman_t *h) {
+  unsigned int e, code, first, index, count;
+
+  inflate_need(s, FASTBITS);
+  e = h->fast[s->bitbuf & ((1 << FASTBITS) - 1)];
+  if (e) {
+    s->bitbuf >>= e & 15;
+    s->bitcnt -= e & 15;
+    return e >> 4;
+  }
+
+  code = first = index = 0;
+  for (int len = 1; len <= MAXBITS; len++) {
+    code |= inflate_bits(s, 1);
+    count = h->count[len];
+    if (code - first < count) return h->symbol[index + (code - first)];
+    index += count;
+    first += count;
+    first <<= 1;
+    code <<= 1;
+  }
+  s->err = INFLATE_ERR_FORMAT;   // ran out of codes
+  return -1;
+}
+
+static void inflate_stored(inflate_t *s) {
+  unsigned int len, n;
+
+  // skip to the byte boundary, the length may still sit in the bit buffer
+  inflate_bits(s, s->bitcnt & 7);
+  len = inflate_bits(s, 16);
+  if (inflate_bits(s, 16) != (~len & 0xffff)) {
+    s->err = INFLATE_ERR_FORMAT;
+    return;
+  }
+  if (inflate_overrun(s)) return;
+
+  s->total += len;
+  while (len && s->bitcnt) {
+    inflate_put(s, inflate_bits(s, 8));
+    len--;
+  }
+  while (len && !s->err) {
+    if (s->in_pos == s->in_len && !inflate_fill(s)) {
+      s->err = INFLATE_ERR_READ;
+      return;
+    }
+    n = s->in_len - s->in_pos;
+    if (n > len) n = len;
+    if (n > INFLATE_WINDOW - s->wpos) n = INFLATE_WINDOW - s->wpos;
+    memcpy(s->window + s->wpos, s->in + s->in_pos, n);
+    s->in_pos += n;
+    s->wpos += n;
+    len -= n;
+    if (s->wpos == INFLATE_WINDOW) inflate_flush(s);
+  }
+}
+
+static void inflate_codes(inflate_t *s, const huffman_t *lencode, const huffman_t *distcode) {
+  int sym;
+  unsigned int len, dist, pos;
+
+  while (!s->err) {
+    sym = inflate_decode(s, lencode);
+    if (inflate_overrun(s) || sym < 0) return;
+    if (sym < 256) {
+      inflate_put(s, sym);
+      s->total++;
+    } else if (sym == 256) {
+      return;
+    } else {
+      sym -= 257;
+      if (sym >= 29) break;
+      len = lbase[sym] + inflate_bits(s, lext[sym]);
+      sym = inflate_decode(s, distcode);
+      if (sym < 0 || sym >= 30) break;
+      dist = dbase[sym] + inflate_bits(s, dext[sym]);
+      if (inflate_overrun(s)) return;
+      if (dist > s->total) break;
+      s->total += len;
+      pos = (s->wpos - dist) & (INFLATE_WINDOW - 1);
+      while (len--) {
+        inflate_put(s, s->window[pos]);
+        pos = (pos + 1) & (INFLATE_WINDOW - 1);
+      }
+    }
+  }
+  if (!s->err) s->err = INFLATE_ERR_FORMAT;
+}
+
+static void inflate_fixed(inflate_t *s) {
+  static char built = 0;
+  static huffman_t lencode, distcode;
+  unsigned char lengths[FIXLCODES];
+  int sym;
+
+  if (!built) {
+    for (sym = 0; sym < 144; sym++) lengths[sym] = 8;
+    for (; sym < 256; sym++) lengths[sym] = 9;
+    for (; sym < 280; sym++) lengths[sym] = 7;
+    for (; sym < FIXLCODES; sym++) lengths[sym] = 8;
+    inflate_construct(&lencode, lengths, FIXLCODES);
+    for (sym = 0; sym < MAXDCODES; sym++) lengths[sym] = 5;
+    inflate_construct(&distcode, lengths, MAXDCODES);
+    built = 1;
+  }
+  inflate_codes(s, &lencode, &distcode);
+}
+
+static void inflate_dynamic(inflate_t *s) {
+  static const unsigned char order[19] =
+    { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+  unsigned char lengths[MAXLCODES + MAXDCODES];
+  int nlen, ndist, ncode, index, sym, len, err;
+
+  nlen = inflate_bits(s, 5) + 257;
+  ndist = inflate_bits(s, 5) + 1;
+  ncode = inflate_bits(s, 4) + 4;
+  if (nlen > MAXLCODES || ndist > MAXDCODES) goto bad;
+
+  // code length code lengths, must be complete
+  for (index = 0; index < ncode; index++)
+    lengths[order[index]] = inflate_bits(s, 3);
+  for (; index < 19; index++)
+    lengths[order[index]] = 0;
+  if (inflate_construct(&s->lencode, lengths, 19)) goto bad;
+
+  for (index = 0; index < nlen + ndist;) {
+    sym = inflate_decode(s, &s->lencode);
+    if (inflate_overrun(s) || sym < 0) return;
+    if (sym < 16) {
+      lengths[index++] = sym;
+      continue;
+    }
+    len = 0;
+    if (sym == 16) {
+      if (index == 0) goto bad;
+      len = lengths[index - 1];
+      sym = 3 + inflate_bits(s, 2);
+    } else if (sym == 17) {
+      sym = 3 + inflate_bits(s, 3);
+    } else {
+      sym = 11 + inflate_bits(s, 7);
+    }
+    if (index + sym > nlen + ndist) goto bad;
+    while (sym--) lengths[index++] = len;
+  }
+  if (lengths[256] == 0) goto bad;  // no end of block code
+
+  // incomplete codes are only allowed for a single length 1 code
+  err = inflate_construct(&s->lencode, lengths, nlen);
+  if (err && (err < 0 || nlen != s->lencode.count[0] + s->lencode.count[1])) goto bad;
+  err = inflate_construct(&s->distcode, lengths + nlen, ndist);
+  if (err && (err < 0 || ndist != s->distcode.count[0] + s->distcode.count[1])) goto bad;
+
+  inflate_codes(s, &s->lencode, &s->distcode);
+  return;
+
+bad:
+  s->err = INFLATE_ERR_FORMAT;
+}
+
+char inflate_stream(unsigned char *window, unsigned char *inbuf, unsigned int insize,
+                    inflate_read_t read, inflate_write_t write) {
+  inflate_t *s = &inf;
+  unsigned int last;
+
+  s->window = window;
+  s->wpos = 0;
+  s->total = 0;
+  s->in = inbuf;
+  s->in_size = insize;
+  s->in_pos = s->in_len = 0;
+  s->overrun = 0;
+  s->bitbuf = 0;
+  s->bitcnt = 0;
+  s->err = INFLATE_OK;
+  s->read = read;
+  s->write = write;
+
+  do {
+    last = inflate_bits(s, 1);
+    switch (inflate_bits(s, 2)) {
+      case 0: inflate_stored(s); break;
+      case 1: inflate_fixed(s); break;
+      case 2: inflate_dynamic(s); break;
+      default: s->err = INFLATE_ERR_FORMAT; break;
+    }
+  } while (!last && !s->err && !inflate_overrun(s));
+
+  if (!s->err) inflate_flush(s);
+  return s->err;
+}
@@ -0,0 +1,28 @@
+#ifndef INFLATE_H
+#define INFLATE_H
+
+// Streaming decoder of raw deflate data (RFC 1951), as stored in zip archives
+
+#define INFLATE_WINDOW     32768 // history needed by the decoder
+
+#define INFLATE_OK         0
+#define INFLATE_ERR_READ   1
+#define INFLATE_ERR_FORMAT 2
+#define INFLATE_ERR_WRITE  3
+
+// reads max. len bytes of the compressed stream, returns the bytes read
+typedef unsigned int (*inflate_read_t)(unsigned char *buf, unsigned int len);
+// receives the next part of the uncompressed data, returns 0 to abort
+typedef char (*inflate_write_t)(const unsigned char *buf, unsigned int len);
+
+// one window for the zip browser and the image unpacker, which never run at
+// the same time. The unpacker also keeps its MSA tracks and the DMS
+// history and tables in it.
+extern unsigned char inflate_window[INFLATE_WINDOW];
+
+// window is the INFLATE_WINDOW bytes history, the output is passed to write()
+// from there in blocks of max. INFLATE_WINDOW. inbuf is refilled by read().
+char inflate_stream(unsigned char *window, unsigned char *inbuf, unsigned int insize,
+                    inflate_read_t read, inflate_write_t write);
+
+#endif // INFLATE_H
@@ -0,0 +1,177 @@
+// inflate_test.c
+// Host side test of the streaming deflate decoder (inflate.c) against zlib
+//
+// inflatetest [file ...]
+//   compresses generated and the given files with all zlib strategies as raw
+//   deflate streams (like in zip archives), decompresses them with the
+//   firmware buffer layout and compares the result with the original
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "inflate.h"
+
+// firmware input buffer, the sector buffer on the SAMV71
+#define IN_SIZE 8192
+
+static const unsigned char *in_data;
+static size_t in_size, in_pos;
+static unsigned char *out_data;
+static size_t out_size, out_pos;
+
+static unsigned int test_read(unsigned char *buf, unsigned int len) {
+    // hand out odd chunk sizes to exercise the refills
+    if (len > 509) len = 509;
+    if (len > in_size - in_pos) len = in_size - in_pos;
+    memcpy(buf, in_data + in_pos, len);
+    in_pos += len;
+    return len;
+}
+
+static char test_write(const unsigned char *buf, unsigned int len) {
+    if (len > INFLATE_WINDOW || out_pos + len > out_size) return 0;
+    memcpy(out_data + out_pos, buf, len);
+    out_pos += len;
+    return 1;
+}
+
+static char decompress(const unsigned char *def, size_t size, unsigned char *out, size_t osize) {
+    static unsigned char window[INFLATE_WINDOW];
+    static unsigned char in[IN_SIZE];
+
+    in_data = def;
+    in_size = size;
+    in_pos = 0;
+    out_data = out;
+    out_size = osize;
+    out_pos = 0;
+    return inflate_stream(window, in, sizeof(in), test_read, test_write);
+}
+
+static size_t compress_raw(const unsigned char *data, size_t size, unsigned char *dst, size_t dsize,
+                           int level, int strategy) {
+    z_stream z;
+
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, level, Z_DEFLATED, -15, 8, strategy) != Z_OK) return 0;
+    z.next_in = (unsigned char*)data;
+    z.avail_in = size;
+    z.next_out = dst;
+    z.avail_out = dsize;
+    if (deflate(&z, Z_FINISH) != Z_STREAM_END) size = 0;
+    else size = z.total_out;
+    deflateEnd(&z);
+    return size;
+}
+
+static int test_buffer(const char *name, const unsigned char *data, size_t size) {
+    static const struct { const char *name; int level; int strategy; } modes[] = {
+        { "stored",  0, Z_DEFAULT_STRATEGY },
+        { "fast",    1, Z_DEFAULT_STRATEGY },
+        { "best",    9, Z_DEFAULT_STRATEGY },
+        { "fixed",   6, Z_FIXED },
+        { "huffman", 6, Z_HUFFMAN_ONLY },
+        { "rle",     6, Z_RLE },
+    };
+    size_t dsize = compressBound(size) + 64;
+    unsigned char *def = malloc(dsize);
+    unsigned char *out = malloc(size + 1);
+    int failed = 0;
+
+    for (int m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        size_t csize = compress_raw(data, size, def, dsize, modes[m].level, modes[m].strategy);
+        double t;
+        char res;
+        int ret = 0;
+
+        t = clock();
+        res = decompress(def, csize, out, size);
+        t = (clock() - t) / CLOCKS_PER_SEC;
+
+        if (!csize || res != INFLATE_OK || out_pos != size || memcmp(out, data, size)) {
+            printf("FAIL %s %s: result %d, %zu of %zu bytes\n", name, modes[m].name, res, out_pos, size);
+            ret = 1;
+        } else if (csize > 8) {
+            // truncated streams must be rejected, corrupted ones must not crash
+            if (decompress(def, csize / 2, out, size) == INFLATE_OK) {
+                printf("FAIL %s %s: truncation not detected\n", name, modes[m].name);
+                ret = 1;
+            }
+            def[csize / 2] ^= 0x55;
+            decompress(def, csize, out, size);
+        }
+
+        if (!ret)
+            printf("PASS %s %s: %zu -> %zu bytes, %.1f MB/s\n", name, modes[m].name, size, csize,
+                t > 0 ? size / t / 1e6 : 0.0);
+        failed += ret;
+    }
+    free(def);
+    free(out);
+    return failed;
+}
+
+// text like data with matches at all distances
+static void gen_text(unsigned char *buf, size_t size) {
+    static const char *words[] = { "mist ", "core ", "rom ", "archive ", "zip ", "deflate ", "\n" };
+
+    for (size_t pos = 0; pos < size; ) {
+        if (pos > 40000 && rand() % 4 == 0) {
+            size_t dist = 1 + rand() % 32768, len = 3 + rand() % 300;
+            for (; len && pos < size; len--, pos++) buf[pos] = buf[pos - dist];
+        } else {
+            const char *w = words[rand() % 7];
+            for (; *w && pos < size; pos++) buf[pos] = *w++;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    static const size_t sizes[] = { 0, 1, 2, 3, 258, 259, 32767, 32768, 32769, 65535, 65536, 100000, 3000000 };
+    char name[64];
+    int failed = 0;
+
+    srand(1);
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        unsigned char *buf = malloc(sizes[i] + 1);
+
+        memset(buf, 0, sizes[i]);
+        sprintf(name, "zero %zu", sizes[i]);
+        failed += test_buffer(name, buf, sizes[i]);
+
+        for (size_t j = 0; j < sizes[i]; j++) buf[j] = rand();
+        sprintf(name, "random %zu", sizes[i]);
+        failed += test_buffer(name, buf, sizes[i]);
+
+        gen_text(buf, sizes[i]);
+        sprintf(name, "text %zu", sizes[i]);
+        failed += test_buffer(name, buf, sizes[i]);
+        free(buf);
+    }
+
+    for (int i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        size_t size;
+        unsigned char *buf;
+
+        if (!f) {
+            printf("FAIL %s: cannot open\n", argv[i]);
+            failed++;
+            continue;
+        }
+        fseek(f, 0, SEEK_END);
+        size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        buf = malloc(size + 1);
+        if (fread(buf, 1, size, f) != size) size = 0;
+        fclose(f);
+        failed += test_buffer(argv[i], buf, size);
+        free(buf);
+    }
+
+    if (failed) printf("%d test(s) failed\n", failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,109 @@
+// kick_test.c
+// Host side test of the Kickstart helpers (kickstart.c)
+//
+// kicktest
+//   compares kick_decrypt() with a byte by byte XOR for every key size up
+//   to 64 bytes, key position and buffer alignment, then checks the
+//   Kickstart checksum of a generated ROM, also after decrypting it in
+//   sectors like the upload does
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kickstart.h"
+
+static int fail(const char *msg) {
+    printf("FAIL %s\n", msg);
+    return 1;
+}
+
+static void ref_decrypt(unsigned char *buf, unsigned int len, const unsigned char *key, unsigned int keysize, unsigned int *keyidx) {
+    while (len--) {
+        *buf++ ^= key[(*keyidx)++];
+        if (*keyidx == keysize) *keyidx = 0;
+    }
+}
+
+// the key is put at the end of its own allocation, so reading past it
+// shows up with -fsanitize=address
+static int test_decrypt(unsigned int keysize, unsigned int keyofs) {
+    static unsigned char data[600 + 4], ref[600 + 4];
+    static const unsigned int lens[] = { 0, 1, 3, 4, 5, 7, 8, 63, 64, 65, 512, 600 };
+    unsigned char *alloc = malloc(keysize + keyofs), *key = alloc + keyofs;
+    char msg[80];
+
+    for (unsigned int i = 0; i < keysize; i++) key[i] = i * 37 + 11;
+    for (unsigned int idx = 0; idx < keysize; idx++)
+        for (unsigned int align = 0; align < 4; align++)
+            for (unsigned int l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+                unsigned int len = lens[l], i1 = idx, i2 = idx;
+
+                for (unsigned int i = 0; i < len; i++) data[align + i] = ref[align + i] = i * 13;
+                kick_decrypt(data + align, len, key, keysize, &i1);
+                ref_decrypt(ref + align, len, key, keysize, &i2);
+                if (i1 != i2 || memcmp(data + align, ref + align, len)) {
+                    sprintf(msg, "decrypt key %u+%u, idx %u, align %u, len %u", keysize, keyofs, idx, align, len);
+                    free(alloc);
+                    return fail(msg);
+                }
+            }
+    free(alloc);
+    return 0;
+}
+
+static int test_checksum(void) {
+    const unsigned int size = 0x40000, keysize = 1131;
+    unsigned char *rom = malloc(size), *enc = malloc(size), *key = malloc(keysize);
+    unsigned long sum = 0;
+    unsigned int keyidx = 0;
+    int failed = 0;
+
+    srand(1);
+    for (unsigned int i = 0; i < size; i++) rom[i] = rand();
+    // the checksum longword at size - 24 makes the sum 0xffffffff
+    memset(rom + size - 24, 0, 4);
+    sum = ~kick_checksum(0, rom, size) & 0xffffffff;
+    for (int i = 0; i < 4; i++) rom[size - 24 + i] = sum >> (24 - 8 * i);
+
+    sum = 0;
+    for (unsigned int i = 0; i < size; i += 512) sum = kick_checksum(sum, rom + i, 512);
+    if (sum != KICK_CHECKSUM_OK) failed += fail("checksum");
+    else printf("PASS checksum %08lx\n", sum);
+
+    rom[1000] ^= 0x10;
+    if (kick_checksum(0, rom, size) == KICK_CHECKSUM_OK) failed += fail("checksum of a damaged ROM");
+    rom[1000] ^= 0x10;
+
+    // encrypt, then decrypt and sum a sector at a time
+    for (unsigned int i = 0; i < keysize; i++) key[i] = rand();
+    memcpy(enc, rom, size);
+    ref_decrypt(enc, size, key, keysize, &keyidx);
+    keyidx = 0;
+    sum = 0;
+    for (unsigned int i = 0; i < size; i += 512) {
+        kick_decrypt(enc + i, 512, key, keysize, &keyidx);
+        sum = kick_checksum(sum, enc + i, 512);
+    }
+    if (sum != KICK_CHECKSUM_OK || memcmp(enc, rom, size)) failed += fail("decrypted checksum");
+    else printf("PASS decrypted checksum, %u bytes key\n", keysize);
+
+    free(rom);
+    free(enc);
+    free(key);
+    return failed;
+}
+
+int main(int argc, char **argv) {
+    int failed = 0;
+
+    for (unsigned int keysize = 1; keysize <= 64; keysize++)
+        for (unsigned int keyofs = 0; keyofs < 4; keyofs++)
+            failed += test_decrypt(keysize, keyofs);
+    if (!failed) printf("PASS decrypt, key sizes 1-64, all positions and alignments\n");
+    failed += test_decrypt(1131, 0);
+    failed += test_checksum();
+
+    if (failed) printf("%d test(s) failed\n", failed);
+    return failed ? 1 : 0;
+}
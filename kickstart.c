@@ -0,0 +1,97 @@
+// kickstart.c
+// Amiga Kickstart ROM decryption and checksum
+
+#include <stdint.h>
+#include <string.h>
+
+#include "kickstart.h"
+
+// aligned 32 bit load, without the pointer cast
+static inline uint32_t load32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, __builtin_assume_aligned(p, 4), 4);
+    return v;
+}
+
+// Words are XORed where buf is aligned. Key words that aren't aligned are
+// assembled from two aligned loads (little endian), as long as both lie
+// inside the key, the rest goes byte by byte.
+void kick_decrypt(unsigned char *buf, unsigned int len, const unsigned char *key, unsigned int keysize, unsigned int *keyidx)
+{
+    unsigned int idx = *keyidx;
+
+    while (len)
+    {
+        // up to the end of the key
+        unsigned int n = keysize - idx;
+        if (n > len)
+            n = len;
+        len -= n;
+
+        while (n && ((uintptr_t)buf & 3))
+        {
+            *buf++ ^= key[idx++];
+            n--;
+        }
+        if (n >= 4 && !((uintptr_t)key & 3))
+        {
+            unsigned int shift = (idx & 3) << 3;
+            unsigned int kw = idx >> 2;
+            unsigned int words = n >> 2;
+            uint32_t b;
+
+            if (!shift)
+            {
+                n -= words << 2;
+                idx += words << 2;
+                while (words--)
+                {
+                    memcpy(&b, __builtin_assume_aligned(buf, 4), 4);
+                    b ^= load32(key + (kw++ << 2));
+                    memcpy(__builtin_assume_aligned(buf, 4), &b, 4);
+                    buf += 4;
+                }
+            }
+            else
+            {
+                // the last word needs key word kw + words
+                unsigned int avail = keysize >> 2;
+                uint32_t lo, hi;
+
+                if (kw + words >= avail)
+                    words = kw + 1 < avail ? avail - kw - 1 : 0;
+                n -= words << 2;
+                idx += words << 2;
+                lo = load32(key + (kw << 2));
+                while (words--)
+                {
+                    hi = load32(key + (++kw << 2));
+                    memcpy(&b, __builtin_assume_aligned(buf, 4), 4);
+                    b ^= (lo >> shift) | (hi << (32 - shift));
+                    memcpy(__builtin_assume_aligned(buf, 4), &b, 4);
+                    buf += 4;
+                    lo = hi;
+                }
+            }
+        }
+        while (n--)
+            *buf++ ^= key[idx++];
+        if (idx == keysize)
+            idx = 0;
+    }
+    *keyidx = idx;
+}
+
+unsigned long kick_checksum(unsigned long sum, const unsigned char *buf, unsigned int len)
+{
+    uint32_t s = sum, w;
+
+    for (; len >= 4; len -= 4, buf += 4)
+    {
+        w = ((uint32_t)buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+        s += w;
+        if (s < w)
+            s++;
+    }
+    return s;
+}
@@ -0,0 +1,17 @@
+#ifndef KICKSTART_H
+#define KICKSTART_H
+
+// Amiga Kickstart ROM helpers for the minimig uploads
+
+// sum of an intact Kickstart ROM, see kick_checksum()
+#define KICK_CHECKSUM_OK 0xffffffff
+
+// XOR a block with the repeating Amiga Forever key. The key position is
+// kept in *keyidx across the blocks.
+void kick_decrypt(unsigned char *buf, unsigned int len, const unsigned char *key, unsigned int keysize, unsigned int *keyidx);
+// add len bytes (a multiple of 4) of a ROM to the Kickstart checksum, start
+// with sum = 0. It's the sum of all big endian longwords with the carries
+// added back in.
+unsigned long kick_checksum(unsigned long sum, const unsigned char *buf, unsigned int len);
+
+#endif // KICKSTART_H
@@ -28,6 +28,12 @@
 #include "data_io.h"
 #include "hdd.h"
 #include "fat_compat.h"
+#ifdef HAVE_ZIP
+#include "zip.h"
+#endif
+#ifdef HAVE_PATCH
+#include "patch.h"
+#endif
 #include "cue_parser.h"
 #include "menu_info.h"
 #include "idx_files.h"
@@ -159,15 +165,50 @@ static char RomFileSelected(uint8_t idx, const char *SelectedName) {
 	char ext_idx = user_io_ext_idx(SelectedName, fs_pFileExt);
 
 	iprintf("RomFileSelected romType=%d\n", romtype);
+	// processors may have their own menu on the OSD
+	if (romtype != ROM_PROCESSED) data_io_set_progress(ProgressBar);
+#ifdef HAVE_ZIP
+	if (zip_active()) {
+		// member of the archive being browsed
+		char res = data_io_zip_tx(SelectedName, ext_idx << 6 | selected_drive_slot, GetExtension(SelectedName));
+		data_io_set_progress(0);
+		if (res != ZIP_OK) {
+			ErrorMessage("\n   Error reading the\n   archive member!\n", 0);
+			return 0;
+		}
+	} else
+#endif
 	// this assumes that further file entries only exist if the first one also exists
 	if (f_open(&file, SelectedName, FA_READ) == FR_OK) {
 		if (romtype == ROM_PROCESSED) {
 			data_io_file_tx_processor(&file, ext_idx << 6 | selected_drive_slot, GetExtension(SelectedName), SelectedName, data_processor_id);
 		} else {
+#ifdef HAVE_PATCH
+			// apply name.IPS or name.BPS while uploading
+			char res = patch_open(SelectedName, f_size(&file));
+			if (res != PATCH_OK && res != PATCH_NONE) {
+				f_close(&file);
+				data_io_set_progress(0);
+				ErrorMessage("\n   Unsupported or\n   invalid ROM patch!\n", res);
+				return 0;
+			}
+#endif
+#ifdef HAVE_PATCH
+			res = data_io_file_tx(&file, ext_idx << 6 | selected_drive_slot, GetExtension(SelectedName));
+			patch_close();
+			f_close(&file);
+			if (res != PATCH_OK) {
+				data_io_set_progress(0);
+				ErrorMessage("\n   Error patching\n   the ROM!\n", res);
+				return 0;
+			}
+#else
 			data_io_file_tx(&file, ext_idx << 6 | selected_drive_slot, GetExtension(SelectedName));
 			f_close(&file);
+#endif
 		}
 	}
+	data_io_set_progress(0);
 	// close menu afterwards (but allow custom processor to have its own menu)
 	if (romtype != ROM_PROCESSED) CloseMenu();
 	return 0;
@@ -249,7 +290,7 @@ static char GetMenuItem_8bit(uint8_t idx, char action, menu_item_t *item) {
 				while(strlen(ext) < 3) strcat(ext, " ");
 				selected_drive_slot = 1;
 				romtype = ROM_NORMAL;
-				SelectFileNG(ext, SCAN_DIR | SCAN_LFN, RomFileSelected, 1);
+				SelectFileNG(ext, SCAN_DIR | SCAN_LFN | SCAN_ZIP, RomFileSelected, 1);
 			} else if (action == MENU_ACT_GET) {
 				//menumask = 1;
 				strcpy(s, " Load *.");
@@ -349,7 +390,9 @@ static char GetMenuItem_8bit(uint8_t idx, char action, menu_item_t *item) {
 			}
 			substrcpy(ext, p, 1);
 			while(strlen(ext) < 3) strcat(ext, " ");
-			SelectFileNG(ext, SCAN_DIR | SCAN_LFN, (p[0] == 'F')?RomFileSelected:iscue?CueFileSelected:ImageFileSelected, 1);
+			// processors seek in the file, archives can only be streamed
+			SelectFileNG(ext, SCAN_DIR | SCAN_LFN | ((p[0] == 'F' && romtype != ROM_PROCESSED) ? SCAN_ZIP : 0),
+			             (p[0] == 'F')?RomFileSelected:iscue?CueFileSelected:ImageFileSelected, 1);
 		} else if (action == MENU_ACT_BKSP) {
 			if (p[0] == 'S' && p[1] && p[2] == 'U') {
 				// umount image
@@ -14,6 +14,9 @@
 #include "user_io.h"
 #include "misc_cfg.h"
 #include "cue_parser.h"
+#ifdef HAVE_UNPACK
+#include "unpack.h"
+#endif
 
 // TODO!
 #define SPIN() asm volatile ( "mov r0, r0\n\t" \
@@ -87,6 +90,19 @@ static void InsertFloppy(adfTYPE *drive, const unsigned char *name)
 	unsigned long tracks;
 	FRESULT res;
 
+	EjectFloppy(drive);
+#ifdef HAVE_UNPACK
+	if (unpack_format(name)) { // decoded into a scratch image for each drive
+		char scratch[] = "/DF0.TMP";
+		scratch[3] += drive - df;
+		if ((res = unpack_open(name, scratch, &drive->file, ProgressBar)) != UNPACK_OK) {
+			ErrorMessage("\n   Unpacking failed!\n", res);
+			return;
+		}
+		readonly = true;
+		InfoMessage(UNPACK_WRPROT_MSG);
+	} else
+#endif
 	if ((res = f_open(&drive->file, name, FA_READ | FA_WRITE)) != FR_OK) {
 		iprintf("Disk open failed (%d), trying read only mode\n", res);
 		readonly = true;
@@ -382,6 +398,8 @@ static char GetMenuItem_Minimig(uint8_t idx, char action, menu_item_t *item) {
 								strncpy(&s[6], df[idx].name, sizeof(df[0].name));
 								if(!(df[idx].status & DSK_WRITABLE))
 									strcpy(&s[6 + sizeof(df[idx].name)-1], " \x17"); // padlock icon for write-protected disks
+								else if(FloppyDirty(&df[idx]))
+									strcpy(&s[6 + sizeof(df[idx].name)-1], " *"); // writes not yet flushed to the image
 								else
 									strcpy(&s[6 + sizeof(df[idx].name)-1], "  "); // clear padlock icon for write-enabled disks
 							} else {// no floppy disk
@@ -612,10 +630,14 @@ static char GetMenuItem_Minimig(uint8_t idx, char action, menu_item_t *item) {
 				case 2:
 				case 3:
 					if (df[idx].status & DSK_INSERTED) {// eject selected floppy
-						df[idx].status = 0;
+						EjectFloppy(&df[idx]);
 					} else {
 						df[idx].status = 0;
+#ifdef HAVE_UNPACK
+						SelectFileNG("ADFADZDMS", SCAN_DIR | SCAN_LFN, FloppyFileSelected, 0);
+#else
 						SelectFileNG("ADF", SCAN_DIR | SCAN_LFN, FloppyFileSelected, 0);
+#endif
 					}
 					break;
 				case 4:
@@ -869,7 +891,7 @@ static char GetMenuItem_Minimig(uint8_t idx, char action, menu_item_t *item) {
 		case MENU_ACT_BKSP:
 			if (page_idx == 0) { // eject all floppies
 				for (int i = 0; i <= drives; i++)
-					df[i].status = 0;
+					EjectFloppy(&df[i]);
 			}
 			break;
 		case MENU_ACT_RIGHT:
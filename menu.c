@@ -38,6 +38,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "config.h"
 #include "menu.h"
 #include "user_io.h"
+#ifdef HAVE_ZIP
+#include "zip.h"
+#endif
 #include "data_io.h"
 #include "tos.h"
 #include "debug.h"
@@ -914,7 +917,7 @@ static char GetMenuItem_System(uint8_t idx, char action, menu_item_t *item) {
 					}
 					break;
 				case 13:
-					SelectFileNG("RBFARC", SCAN_LFN | SCAN_SYSDIR, CoreFileSelected, 0);
+					SelectFileNG("RBFRBZARC", SCAN_LFN | SCAN_SYSDIR, CoreFileSelected, 0);
 					break;
 				case 21:
 				case 22:
@@ -1036,6 +1039,10 @@ void SelectFile(char* pFileExt, unsigned char Options, unsigned char MenuSelect,
 
 	menu_debugf("%s - %s\n", pFileExt, fs_pFileExt);
 
+#ifdef HAVE_ZIP
+	if (zip_active() && !(Options & SCAN_ZIP)) // don't show the members of an archive
+		fs_pFileExt[0] = 0;
+#endif
 	if (strncmp(pFileExt, fs_pFileExt, 12) != 0) // check desired file extension
 	{ // if different from the current one go to the root directory and init entry buffer
 		ChangeDirectoryName("/");
@@ -1048,7 +1055,7 @@ void SelectFile(char* pFileExt, unsigned char Options, unsigned char MenuSelect,
 
 	menu_debugf("pFileExt = %3s\n", pFileExt);
 	strcpy(fs_pFileExt, pFileExt);
-	fs_ShowExt = ((strlen(fs_pFileExt)>3 && strncmp(fs_pFileExt, "RBFARC", 6)) || strchr(fs_pFileExt, '*') || strchr(fs_pFileExt, '?'));
+	fs_ShowExt = ((strlen(fs_pFileExt)>3 && strncmp(fs_pFileExt, "RBFRBZARC", 9)) || strchr(fs_pFileExt, '*') || strchr(fs_pFileExt, '?'));
 	fs_Options = Options;
 	fs_MenuSelect = MenuSelect;
 
@@ -1265,7 +1272,7 @@ void HandleUI(void)
 					}
 					// the "menu" core is special in jumps directly to the core selection menu
 					if(!strcmp(user_io_get_core_name(), "MENU") || (user_io_get_core_features() & FEAT_MENU)) {
-						SelectFileNG("RBFARC", SCAN_LFN | SCAN_SYSDIR, CoreFileSelected, 0);
+						SelectFileNG("RBFRBZARC", SCAN_LFN | SCAN_SYSDIR, CoreFileSelected, 0);
 					}
 				}
 
@@ -1594,7 +1601,11 @@ void HandleUI(void)
 
 			if (c == KEY_BACK)
 			{
+#ifdef HAVE_ZIP
+				if (iCurrentDirectory || zip_active()) // if not root directory
+#else
 				if (iCurrentDirectory) // if not root directory
+#endif
 				{
 					ChangeDirectoryName("..");
 					if (ScanDirectory(SCAN_INIT_FIRST, fs_pFileExt, fs_Options))
@@ -1927,7 +1938,7 @@ static void PrintDirectory(void)
                 strncpy(s + 1, lfn, len); // display only name
 
             if (DirEntries[k].fattrib & AM_DIR) // mark directory with suffix
-                strcpy(&s[22], " <DIR>");
+                strcpy(&s[22], (DirEntries[k].fattrib & AM_ZIP) ? " <ZIP>" : " <DIR>");
         }
         else
         {
@@ -1961,6 +1972,27 @@ void ErrorMessage(const char *message, unsigned char code) {
 	OsdEnable(DISABLE_KEYBOARD);
 }
 
+// upload progress on the bottom line of the OSD
+void ProgressBar(unsigned long done, unsigned long total) {
+	static unsigned char last = 0xff;
+	unsigned char percent, cells, i;
+	char bar[32];
+
+	if (!done) last = 0xff;  // a new transfer
+	if (!user_io_osd_is_visible() || total < 100) return;
+	percent = (done >= total) ? 100 : done / (total / 100);
+	if (percent > 100) percent = 100;
+	if (percent == last) return;
+	last = percent;
+
+	cells = percent / 4;
+	bar[0] = ' ';
+	for (i = 0; i < 25; i++)
+		bar[i + 1] = (i < cells) ? '\x1c' : '\x1d';
+	siprintf(&bar[26], " %3d%%", percent);
+	OsdWrite(OsdLines() - 1, bar, 0, 0);
+}
+
 void InfoMessage(const char *message) {
 	if (menustate != MENU_DIALOG2) {
 		OsdSetTitle("Message",0);
@@ -82,6 +82,7 @@ void ChangePage(char);
 void HandleUI(void);
 void ErrorMessage(const char *message, unsigned char code);
 void InfoMessage(const char *message);
+void ProgressBar(unsigned long done, unsigned long total);
 
 extern const char *config_cpu_msg[];
 extern const char *config_autofire_msg[];
@@ -14,15 +14,16 @@
 
 extern FIL ini_file;
 
-// call data_io_rom_upload but reload sector_buffer afterwards since the io
-// operations in data_io_rom_upload may have overwritten the buffer
+// call data_io_rom_upload and reload sector_buffer if it did io operations,
+// which may have overwritten the buffer
 // mode = 0: prepare for rom upload, mode = 1: rom upload, mode = 2, end rom upload
 char ini_rom_upload(char *s, char action, int tag) {
   if(action == INI_SAVE) return 0;
 #ifndef INI_PARSER_TEST
-  data_io_rom_upload(s, 1);
-  f_lseek(&ini_file, (((f_tell(&ini_file)+511)>>9)-1)<<9);
-  FileReadBlock(&ini_file, sector_buffer);
+  if (data_io_rom_upload(s, 1)) {
+    f_lseek(&ini_file, (((f_tell(&ini_file)+511)>>9)-1)<<9);
+    FileReadBlock(&ini_file, sector_buffer);
+  }
 #endif
   return 0;
 }
@@ -126,6 +127,10 @@ const ini_var_t mist_ini_vars[] = {
   {"ROM", (void*)ini_rom_upload, CUSTOM_HANDLER, 0, 0, 1},
   {"AMIGA_MOD_KEYS", (void*)(&(mist_cfg.amiga_mod_keys)), UINT8, 0, 3, 1},
   {"USB_STORAGE", (void*)(&(mist_cfg.usb_storage)), UINT8, 0, 1, 1},
+  {"DIO_FAST", (void*)(&(mist_cfg.dio_fast)), UINT8, 0, 1, 1},
+#ifdef HAVE_TOC_CACHE
+  {"TOC_CACHE", (void*)(&(mist_cfg.toc_cache)), UINT8, 0, 1, 1},
+#endif
   // [MINIMIG_CONFIG]
   {"KICK1X_MEMORY_DETECTION_PATCH", (void*)(&(minimig_cfg.kick1x_memory_detection_patch)), UINT8, 0, 1, 2},
   {"CLOCK_FREQ", (void*)(&(minimig_cfg.clock_freq)), UINT8, 0, 2, 2},
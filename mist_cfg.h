@@ -41,6 +41,10 @@ typedef struct {
   uint8_t sdram64;
   uint8_t amiga_mod_keys;
   uint8_t usb_storage;
+  uint8_t dio_fast;
+#ifdef HAVE_TOC_CACHE
+  uint8_t toc_cache;
+#endif
 } mist_cfg_t;
 
 
@@ -0,0 +1,180 @@
+// mkrbz.c
+// mkrbz - creates compressed FPGA bitstreams (.RBZ) for the firmware
+// The format is described in rbz.h
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "rbz.h"
+
+#define HASH_BITS  16
+#define MAX_CHAIN  256
+
+// Initial CRC value is -1 (0xFFFFFFFF)
+// Final CRC value is bitwise negation of the last calculated value
+unsigned long CalculateCRC32(unsigned long crc, unsigned char *pBuffer, unsigned long nSize)
+{
+    int j;
+    unsigned long mask;
+
+    while (nSize--) {
+        crc ^= *pBuffer++;
+        for (j = 0; j < 8; j++) {
+            mask = -(crc & 1);
+            crc = (crc >> 1) ^ (0xEDB88320 & mask);
+        }
+    }
+    return crc & 0xffffffff;
+}
+
+static unsigned char *put32(unsigned char *p, unsigned long v)
+{
+    *p++ = v; *p++ = v >> 8; *p++ = v >> 16; *p++ = v >> 24;
+    return p;
+}
+
+static unsigned char *putlen(unsigned char *p, size_t len)
+{
+    while (len >= 255) {
+        *p++ = 255;
+        len -= 255;
+    }
+    *p++ = len;
+    return p;
+}
+
+static unsigned int hash4(const unsigned char *p)
+{
+    unsigned long v = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long)p[3] << 24);
+    return ((v * 2654435761UL) & 0xffffffff) >> (32 - HASH_BITS);
+}
+
+static unsigned char *put_sequence(unsigned char *p, const unsigned char *lit, size_t nlit, size_t offset, size_t mlen)
+{
+    unsigned char *token = p++;
+    size_t ml = mlen ? mlen - RBZ_MINMATCH : 0;
+
+    *token = ((nlit < 15 ? nlit : 15) << 4) | (ml < 15 ? ml : 15);
+    if (nlit >= 15) p = putlen(p, nlit - 15);
+    memcpy(p, lit, nlit);
+    p += nlit;
+    if (mlen) {
+        *p++ = offset;
+        *p++ = offset >> 8;
+        if (ml >= 15) p = putlen(p, ml - 15);
+    }
+    return p;
+}
+
+// returns the size of the compressed stream written to dst,
+// dst must hold at least rbz_bound(size) bytes
+size_t rbz_bound(size_t size)
+{
+    return RBZ_HDR_SIZE + size + size / 255 + 16;
+}
+
+size_t rbz_compress(const unsigned char *src, size_t size, unsigned char *dst)
+{
+    static int head[1 << HASH_BITS];
+    static int prev[RBZ_WINDOW];
+    unsigned char *p = dst;
+    size_t pos = 0, anchor = 0;
+
+    memcpy(p, RBZ_MAGIC, 4);
+    p = put32(p + 4, size);
+    p = put32(p, ~CalculateCRC32(-1, (unsigned char*)src, size));
+    p = put32(p, 0);
+
+    for (int i = 0; i < (1 << HASH_BITS); i++) head[i] = -1;
+
+    while (pos + RBZ_MINMATCH <= size) {
+        unsigned int h = hash4(src + pos);
+        int cand = head[h];
+        size_t best_len = 0, best_off = 0;
+
+        // greedy search along the hash chain, inside the window
+        for (int chain = 0; cand >= 0 && pos - cand <= RBZ_WINDOW && chain < MAX_CHAIN; chain++) {
+            size_t len = 0;
+            while (pos + len < size && src[cand + len] == src[pos + len]) len++;
+            if (len > best_len) {
+                best_len = len;
+                best_off = pos - cand;
+                if (pos + len == size) break;
+            }
+            int next = prev[cand & (RBZ_WINDOW - 1)];
+            if (next >= cand) break;
+            cand = next;
+        }
+
+        if (best_len >= RBZ_MINMATCH) {
+            p = put_sequence(p, src + anchor, pos - anchor, best_off, best_len);
+            for (size_t end = pos + best_len; pos < end; pos++) {
+                if (pos + RBZ_MINMATCH <= size) {
+                    h = hash4(src + pos);
+                    prev[pos & (RBZ_WINDOW - 1)] = head[h];
+                    head[h] = pos;
+                }
+            }
+            anchor = pos;
+        } else {
+            prev[pos & (RBZ_WINDOW - 1)] = head[h];
+            head[h] = pos;
+            pos++;
+        }
+    }
+
+    // trailing literals
+    if (anchor < size) p = put_sequence(p, src + anchor, size - anchor, 0, 0);
+    return p - dst;
+}
+
+#ifndef RBZ_TEST
+int main(int argc, char **argv)
+{
+    FILE *inf, *outf;
+    size_t size, csize;
+    unsigned char *bin, *rbz;
+
+    printf("mkrbz - compressed FPGA bitstream creator\n");
+
+    if (argc != 3) {
+        printf("Usage: mkrbz <infile>.rbf <outfile>.rbz\n");
+        return -1;
+    }
+
+    inf = fopen(argv[1], "rb");
+    if (!inf) {
+        printf("Unable to open %s\n", argv[1]);
+        return -1;
+    }
+    fseek(inf, 0, SEEK_END);
+    size = ftell(inf);
+    fseek(inf, 0, SEEK_SET);
+
+    bin = malloc(size + 1);
+    rbz = malloc(rbz_bound(size));
+    if (fread(bin, 1, size, inf) != size) {
+        printf("Read error on %s\n", argv[1]);
+        fclose(inf);
+        return -1;
+    }
+    fclose(inf);
+
+    csize = rbz_compress(bin, size, rbz);
+    printf("Bitstream size        : %zu\n", size);
+    printf("Compressed size       : %zu (%.1f%%)\n", csize, size ? 100.0 * csize / size : 0.0);
+
+    outf = fopen(argv[2], "wb");
+    if (!outf) {
+        printf("Unable to open %s for writing\n", argv[2]);
+        return -1;
+    }
+    fwrite(rbz, 1, csize, outf);
+    fclose(outf);
+
+    free(bin);
+    free(rbz);
+    return 0;
+}
+#endif
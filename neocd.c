@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include "neocd.h"
 #include "cue_parser.h"
+#include "cd_cache.h"
 #include "user_io.h"
 #include "utils.h"
 #include "debug.h"
@@ -91,19 +92,17 @@ static void SeekToLBA(int lba, int play) {
 
 	neocdd.latency += (abs(lba - neocdd.lba) * 120) / 270000 / neocdd.speed;
 
-	neocdd.lba = lba;
-
 	while ((toc.tracks[index].end <= lba) && (index < toc.last)) index++;
 	neocdd.index = index;
 
+	// the pregap isn't in the image, start at the track
 	if (lba < toc.tracks[index].start)
 	{
 		lba = toc.tracks[index].start;
 	}
+	neocdd.lba = lba;
 
-	int offset = (lba - toc.tracks[index].start) * toc.tracks[index].sector_size + toc.tracks[index].offset;
-	f_lseek(&toc.file->file, offset);
-	neocd_debugf("SeekToLBA lba=%lu offset=%08x", lba, offset);
+	neocd_debugf("SeekToLBA lba=%lu index=%d", lba, index);
 	if (play)
 	{
 		neocdd.audioOffset = 0;
@@ -113,16 +112,14 @@ static void SeekToLBA(int lba, int play) {
 static int SectorSend(uint8_t* header)
 {
 	int len = 2352;
-	UINT br;
 	if (header) {
 		memcpy(sector_buffer + 12, header, 4);
 	}
-	DISKLED_ON
-	if (toc.tracks[neocdd.index].sector_size == 2048)
-		f_read(&toc.file->file, sector_buffer+16, 2048, &br);
-	else
-		f_read(&toc.file->file, sector_buffer, 2352, &br);
-	DISKLED_OFF
+	cd_read_sector(neocdd.lba, sector_buffer, CD_SECTOR_RAW);
+	if (user_io_get_core_features() & FEAT_CDSUB) {
+		cd_read_subchannel(neocdd.lba, sector_buffer + len);
+		len += CD_SUBCHANNEL;
+	}
 
 	SendData(sector_buffer, len, toc.tracks[neocdd.index].type);
 	return 0;
@@ -237,7 +234,6 @@ static void neocd_run() {
 		{
 			neocdd.index++;
 			neocdd.isData = 0x01;
-			f_lseek(&toc.file->file, toc.tracks[neocdd.index].offset);
 		}
 	}
 	else if (neocdd.status == CD_STAT_SCAN) {
@@ -272,8 +268,6 @@ static void neocd_run() {
 		}
 
 		neocdd.isData = toc.tracks[neocdd.index].type;
-		int offset = (neocdd.lba - toc.tracks[neocdd.index].start) * toc.tracks[neocdd.index].sector_size + toc.tracks[neocdd.index].offset;
-		f_lseek(&toc.file->file, offset);
 	}
 }
 
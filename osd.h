@@ -44,6 +44,7 @@
 #define OSD_CMD_OSD_WR    0x0c
 #define OSD_CMD_WR        0x1c
 #define OSD_CMD_VERSION   0x88
+#define OSD_CMD_WR_CAPS   0x8c // minimig_v2: 0xa5, burst length in words and its complement
 
 #define DISABLE_KEYBOARD 0x02        // disable keyboard while OSD is active
 
@@ -0,0 +1,387 @@
+// patch.c
+// IPS and BPS patches applied on the fly during the ROM upload
+
+#include <stdio.h>
+#include <string.h>
+#include "patch.h"
+#include "crc32.h"
+#ifndef PATCH_TEST
+#include "hardware.h"
+#include "fat_compat.h"
+#include "FatFs/ff.h"
+#endif
+
+typedef struct
+{
+  uint32_t offset;  // in the patched ROM
+  uint32_t len;
+  uint32_t data;    // position in the patch file, or the fill byte of RLE records
+  uint16_t index;   // order in the patch, later records win
+  uint8_t  rle;
+} patch_record_t;
+
+// patches which are not in offset order are indexed into the table
+static patch_record_t patch_records[PATCH_RECORDS];
+static unsigned int   patch_count = 0;
+static unsigned int   patch_first;    // first record not yet passed by patch_apply()
+static char           patch_streamed; // records are read from the file while applied
+static patch_record_t patch_cur;      // next streamed record
+static unsigned long  patch_start;    // first record in the file
+static char           patch_overlaps; // records have to be applied in patch order
+static char           patch_opened = 0;
+static unsigned long  patch_out_size;
+static unsigned long  patch_rom_size;
+static patch_read_t   patch_read;
+
+// BPS checksums, of the ROM and of the patched data
+static char           patch_bps;
+static unsigned long  patch_src_crc, patch_dst_crc;
+static unsigned long  patch_src_expect, patch_dst_expect;
+static unsigned long  patch_bps_out, patch_bps_src_rel, patch_bps_end;
+
+// buffered sequential reading while parsing
+static unsigned char  patch_buf[256];
+static unsigned long  patch_buf_pos;
+static unsigned int   patch_buf_len, patch_buf_idx;
+static unsigned long  patch_file_size;
+
+static void patch_seek(unsigned long pos) {
+  patch_buf_pos = pos;
+  patch_buf_len = patch_buf_idx = 0;
+}
+
+static unsigned long patch_tell(void) {
+  return patch_buf_pos + patch_buf_idx;
+}
+
+static int patch_getc(void) {
+  if (patch_buf_idx == patch_buf_len) {
+    unsigned int len = sizeof(patch_buf);
+    patch_buf_pos += patch_buf_len;
+    patch_buf_idx = 0;
+    if (patch_buf_pos >= patch_file_size) return -1;
+    if (len > patch_file_size - patch_buf_pos) len = patch_file_size - patch_buf_pos;
+    patch_buf_len = patch_read(patch_buf_pos, patch_buf, len);
+    if (!patch_buf_len) return -1;
+  }
+  return patch_buf[patch_buf_idx++];
+}
+
+// big endian IPS numbers
+static long patch_get(int bytes) {
+  long val = 0;
+  while (bytes--) {
+    int c = patch_getc();
+    if (c < 0) return -1;
+    val = (val << 8) | c;
+  }
+  return val;
+}
+
+// BPS variable length numbers
+static char patch_getnum(unsigned long *val) {
+  unsigned long data = 0, shift = 1;
+  for (int i = 0; i < 5; i++) {
+    int c = patch_getc();
+    if (c < 0) return 0;
+    data += (c & 0x7f) * shift;
+    if (c & 0x80) {
+      *val = data;
+      return 1;
+    }
+    shift <<= 7;
+    data += shift;
+  }
+  return 0;
+}
+
+static unsigned long patch_get32le(void) {
+  unsigned long val = 0;
+  for (int i = 0; i < 4; i++) val |= (unsigned long)(patch_getc() & 0xff) << (8 * i);
+  return val;
+}
+
+// the next record which changes the output, r->len is 0 after the last one.
+// BPS source reads and copies leave the ROM data where it is.
+static char patch_next(patch_record_t *r) {
+  unsigned long data, len;
+  long offset, val;
+
+  r->len = 0;
+  while (!patch_bps) {
+    if ((offset = patch_get(3)) < 0) return PATCH_ERR_FORMAT;
+    if (offset == 0x454f46) return PATCH_OK;   // "EOF"
+    if ((val = patch_get(2)) < 0) return PATCH_ERR_FORMAT;
+    r->offset = offset;
+    if (val) {
+      r->len = val;
+      r->data = patch_tell();
+      r->rle = 0;
+      patch_seek(patch_tell() + val);
+      if (patch_tell() > patch_file_size) return PATCH_ERR_FORMAT;
+    } else {
+      // run length encoded
+      if ((val = patch_get(2)) < 0) return PATCH_ERR_FORMAT;
+      r->len = val;
+      if ((val = patch_getc()) < 0) return PATCH_ERR_FORMAT;
+      r->data = val;
+      r->rle = 1;
+    }
+    if (r->len) return PATCH_OK;
+  }
+
+  while (patch_tell() < patch_bps_end) {
+    if (!patch_getnum(&data)) return PATCH_ERR_FORMAT;
+    len = (data >> 2) + 1;
+    switch (data & 3) {
+      case 0: // source read, the ROM data stays where it is
+        if (patch_bps_out + len > patch_rom_size) return PATCH_ERR_FORMAT;
+        break;
+      case 1: // target read
+        r->offset = patch_bps_out;
+        r->len = len;
+        r->data = patch_tell();
+        r->rle = 0;
+        patch_seek(patch_tell() + len);
+        break;
+      case 2: // source copy, only from the same offset
+        if (!patch_getnum(&data)) return PATCH_ERR_FORMAT;
+        patch_bps_src_rel += (data & 1) ? -(data >> 1) : (data >> 1);
+        if (patch_bps_src_rel != patch_bps_out || patch_bps_out + len > patch_rom_size) return PATCH_ERR_BPS;
+        patch_bps_src_rel += len;
+        break;
+      default: // target copy
+        return PATCH_ERR_BPS;
+    }
+    patch_bps_out += len;
+    if (patch_bps_out > patch_out_size) return PATCH_ERR_FORMAT;
+    if (r->len) return PATCH_OK;
+  }
+  return PATCH_OK;
+}
+
+// back to the first record
+static char patch_rewind(void) {
+  patch_seek(patch_start);
+  patch_bps_out = patch_bps_src_rel = 0;
+  return patch_next(&patch_cur);
+}
+
+// sort by offset, most patches are already in order, which makes the
+// insertion sort linear. Equal offsets stay in patch order.
+static void patch_sort(void) {
+  unsigned long end = 0;
+
+  for (unsigned int i = 1; i < patch_count; i++) {
+    patch_record_t r = patch_records[i];
+    unsigned int j = i;
+    while (j && patch_records[j - 1].offset > r.offset) {
+      patch_records[j] = patch_records[j - 1];
+      j--;
+    }
+    patch_records[j] = r;
+  }
+
+  patch_overlaps = 0;
+  for (unsigned int i = 0; i < patch_count; i++) {
+    if (patch_records[i].offset < end) patch_overlaps = 1;
+    if (patch_records[i].offset + patch_records[i].len > end)
+      end = patch_records[i].offset + patch_records[i].len;
+  }
+}
+
+// check all records. Patches in offset order without overlaps are streamed
+// from the file by patch_apply(), all others have to fit into the table.
+static char patch_index(void) {
+  patch_record_t r;
+  unsigned long end = 0;
+  char res;
+
+  patch_streamed = 1;
+  while ((res = patch_next(&r)) == PATCH_OK && r.len) {
+    if (r.offset < end) patch_streamed = 0;
+    if (r.offset + r.len > end) end = r.offset + r.len;
+    if (patch_count < PATCH_RECORDS) {
+      r.index = patch_count;
+      patch_records[patch_count] = r;
+    }
+    patch_count++;
+  }
+  if (res != PATCH_OK) return res;
+  if (!patch_bps && end > patch_out_size) patch_out_size = end;
+  if (!patch_streamed && patch_count > PATCH_RECORDS) return PATCH_ERR_SIZE;
+  return PATCH_OK;
+}
+
+char patch_parse(unsigned long size, unsigned long rom_size, patch_read_t read) {
+  unsigned long src_size, meta;
+  long trunc;
+  char res = PATCH_ERR_FORMAT;
+  char magic[5];
+
+  patch_opened = 0;
+  patch_count = 0;
+  patch_first = 0;
+  patch_bps = 0;
+  patch_read = read;
+  patch_rom_size = rom_size;
+  patch_file_size = size;
+  patch_seek(0);
+
+  for (int i = 0; i < 5; i++) magic[i] = patch_getc();
+  if (!memcmp(magic, "PATCH", 5)) {
+    patch_start = 5;
+    patch_out_size = rom_size;
+    if ((res = patch_index()) == PATCH_OK) {
+      // optional size of the patched ROM
+      if ((trunc = patch_get(3)) >= 0) patch_out_size = trunc;
+    }
+  } else if (!memcmp(magic, "BPS1", 4) && size >= 16) {
+    patch_seek(4);
+    patch_bps = 1;
+    patch_bps_end = size - 12;
+    patch_src_crc = patch_dst_crc = -1;
+    if (!patch_getnum(&src_size) || !patch_getnum(&patch_out_size) || !patch_getnum(&meta))
+      res = PATCH_ERR_FORMAT;
+    else if (src_size != rom_size)
+      res = PATCH_ERR_SOURCE;
+    else {
+      patch_start = patch_tell() + meta;
+      patch_seek(patch_start);
+      patch_bps_out = patch_bps_src_rel = 0;
+      res = patch_index();
+      if (res == PATCH_OK && (patch_tell() != patch_bps_end || patch_bps_out != patch_out_size))
+        res = PATCH_ERR_FORMAT;
+      patch_src_expect = patch_get32le();
+      patch_dst_expect = patch_get32le();
+    }
+  }
+  if (res == PATCH_OK) {
+    if (patch_streamed) res = patch_rewind();
+    else patch_sort();
+  }
+  if (res != PATCH_OK) {
+    iprintf("Patch: error %d\n", res);
+    return res;
+  }
+  iprintf("Patch: %s, %d records%s, %lu -> %lu bytes\n", patch_bps ? "BPS" : "IPS", patch_count,
+          patch_streamed ? "" : " (unordered)", patch_rom_size, patch_out_size);
+  patch_opened = 1;
+  return PATCH_OK;
+}
+
+char patch_active(void) {
+  return patch_opened;
+}
+
+unsigned long patch_size(void) {
+  return patch_out_size;
+}
+
+static char patch_record(patch_record_t *r, unsigned char *buf, unsigned long pos, unsigned int len) {
+  unsigned long start = (r->offset > pos) ? r->offset : pos;
+  unsigned long end = r->offset + r->len;
+
+  if (end > pos + len) end = pos + len;
+  if (r->rle) {
+    memset(buf + (start - pos), r->data, end - start);
+  } else if (patch_read(r->data + (start - r->offset), buf + (start - pos), end - start) != end - start) {
+    return PATCH_ERR_READ;
+  }
+  return PATCH_OK;
+}
+
+char patch_apply(unsigned char *buf, unsigned long pos, unsigned int len) {
+  unsigned long end = pos + len;
+  unsigned int i;
+
+  if (patch_bps && pos < patch_rom_size)
+    patch_src_crc = CalculateCRC32(patch_src_crc, buf, (end > patch_rom_size) ? patch_rom_size - pos : len);
+
+  if (patch_streamed) {
+    while (patch_cur.len && patch_cur.offset < end) {
+      if (patch_record(&patch_cur, buf, pos, len) != PATCH_OK) return PATCH_ERR_READ;
+      if (patch_cur.offset + patch_cur.len > end) break;  // continues in the next chunk
+      if (patch_next(&patch_cur) != PATCH_OK) return PATCH_ERR_READ;
+    }
+  } else {
+    while (patch_first < patch_count &&
+           patch_records[patch_first].offset + patch_records[patch_first].len <= pos)
+      patch_first++;
+
+    if (!patch_overlaps) {
+      for (i = patch_first; i < patch_count && patch_records[i].offset < end; i++)
+        if (patch_records[i].offset + patch_records[i].len > pos &&
+            patch_record(&patch_records[i], buf, pos, len) != PATCH_OK)
+          return PATCH_ERR_READ;
+    } else {
+      // overlapping records, apply the ones in this chunk in patch order
+      long last = -1;
+      while (1) {
+        patch_record_t *next = 0;
+        for (i = patch_first; i < patch_count && patch_records[i].offset < end; i++)
+          if (patch_records[i].offset + patch_records[i].len > pos && patch_records[i].index > last &&
+              (!next || patch_records[i].index < next->index))
+            next = &patch_records[i];
+        if (!next) break;
+        if (patch_record(next, buf, pos, len) != PATCH_OK) return PATCH_ERR_READ;
+        last = next->index;
+      }
+    }
+  }
+
+  if (patch_bps) {
+    patch_dst_crc = CalculateCRC32(patch_dst_crc, buf, len);
+    // the ROM is only read completely if the output is not shorter
+    if (end == patch_out_size &&
+        (((~patch_src_crc & 0xffffffff) != patch_src_expect && patch_out_size >= patch_rom_size) ||
+         (~patch_dst_crc & 0xffffffff) != patch_dst_expect)) {
+      iprintf("Patch: BPS checksum mismatch\n");
+      return PATCH_ERR_CRC;
+    }
+  }
+  return PATCH_OK;
+}
+
+#ifndef PATCH_TEST
+static FIL patch_file;
+
+static unsigned int patch_file_read(unsigned long pos, unsigned char *buf, unsigned int len) {
+  UINT br;
+
+  if (f_lseek(&patch_file, pos) != FR_OK || f_read(&patch_file, buf, len, &br) != FR_OK) return 0;
+  return br;
+}
+
+char patch_open(const char *rom_name, unsigned long rom_size) {
+  static const char *exts[] = { "IPS", "BPS" };
+  char name[FF_LFN_BUF + 1];
+  const char *ext = GetExtension(rom_name);
+  unsigned int len = ext ? ext - rom_name : strlen(rom_name) + 1;
+  char res;
+
+  patch_close();
+  if (len + 3 > FF_LFN_BUF) return PATCH_NONE;
+  memcpy(name, rom_name, len);
+  name[len - 1] = '.';
+  name[len + 3] = 0;
+
+  for (int i = 0; i < 2; i++) {
+    memcpy(name + len, exts[i], 3);
+    if (f_open(&patch_file, name, FA_READ) != FR_OK) continue;
+
+    iprintf("Patch: %s\n", name);
+    DISKLED_ON
+    res = patch_parse(f_size(&patch_file), rom_size, patch_file_read);
+    DISKLED_OFF
+    if (res != PATCH_OK) f_close(&patch_file);
+    return res;
+  }
+  return PATCH_NONE;
+}
+
+void patch_close(void) {
+  if (patch_opened) f_close(&patch_file);
+  patch_opened = 0;
+}
+#endif
@@ -0,0 +1,45 @@
+#ifndef PATCH_H
+#define PATCH_H
+
+// ROM patches (.IPS, .BPS) applied while the ROM is uploaded. The patch
+// records are checked when the patch is opened, then spliced into the ROM
+// data chunk by chunk, so the ROM is read only once. Records in offset order
+// are read from the patch file as the upload passes them, IPS patches with
+// records out of order are indexed and sorted in a small table.
+//
+// BPS patches are only supported if they can be streamed: source reads,
+// target reads and source copies from the same offset. Target copies and
+// moved source data need random access to the ROM or the patched output.
+
+#include <inttypes.h>
+
+#define PATCH_RECORDS 512   // max. records of a patch which is not in order
+
+#define PATCH_OK         0
+#define PATCH_NONE       1  // no patch next to the ROM
+#define PATCH_ERR_READ   2
+#define PATCH_ERR_FORMAT 3
+#define PATCH_ERR_SIZE   4  // too many records out of order
+#define PATCH_ERR_BPS    5  // BPS patch which can't be streamed
+#define PATCH_ERR_SOURCE 6  // BPS patch for another ROM
+#define PATCH_ERR_CRC    7  // BPS checksum mismatch, after the last chunk
+
+// reads len bytes of the patch file from pos, returns the bytes read
+typedef unsigned int (*patch_read_t)(unsigned long pos, unsigned char *buf, unsigned int len);
+
+// index a patch of the given size
+char patch_parse(unsigned long size, unsigned long rom_size, patch_read_t read);
+char patch_active(void);
+// size of the patched ROM
+unsigned long patch_size(void);
+// splice the records into the next chunk of the ROM, bytes past the end of
+// the ROM have to be zeroed. Chunks must be passed in order.
+char patch_apply(unsigned char *buf, unsigned long pos, unsigned int len);
+
+#ifndef PATCH_TEST
+// look for name.IPS or name.BPS next to the ROM
+char patch_open(const char *rom_name, unsigned long rom_size);
+void patch_close(void);
+#endif
+
+#endif // PATCH_H
@@ -0,0 +1,381 @@
+// patch_test.c
+// Host side test of the streaming ROM patcher (patch.c). The output of
+// patch_apply() is compared with an offline patched ROM.
+//
+// patchtest [rom patch patched ...]
+//   checks the CRC32 routines (crc32.c) used for the BPS checksums, tests
+//   generated IPS and BPS patches, then the given triples of ROM, patch and
+//   offline patched ROM
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "patch.h"
+#include "crc32.h"
+
+static const unsigned char *patch_data;
+
+// bitwise reference
+static unsigned long crc32(const unsigned char *buf, size_t len) {
+    unsigned long crc = 0xffffffff;
+    while (len--) {
+        crc ^= *buf++;
+        for (int j = 0; j < 8; j++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc & 0xffffffff;
+}
+
+// the table and the RAM variant, fed in odd chunks
+static int test_crc(const char *name, const unsigned char *buf, size_t len, unsigned long expect) {
+    unsigned long crc = -1, crc_ram = -1;
+    size_t pos = 0, chunk = 1;
+
+    while (pos < len) {
+        if (chunk > len - pos) chunk = len - pos;
+        crc = CalculateCRC32(crc, buf + pos, chunk);
+        crc_ram = CalculateCRC32Ram(crc_ram, buf + pos, chunk);
+        pos += chunk;
+        chunk = chunk * 3 + 1;
+    }
+    crc = ~crc & 0xffffffff;
+    crc_ram = ~crc_ram & 0xffffffff;
+    if (crc != expect || crc_ram != expect) {
+        printf("FAIL crc32 %s: %08lX/%08lX, expected %08lX\n", name, crc, crc_ram, expect);
+        return 1;
+    }
+    printf("PASS crc32 %s: %08lX\n", name, crc);
+    return 0;
+}
+
+static unsigned int test_read(unsigned long pos, unsigned char *buf, unsigned int len) {
+    memcpy(buf, patch_data + pos, len);
+    return len;
+}
+
+typedef struct {
+    unsigned char *data;
+    size_t size, alloc;
+} buffer_t;
+
+static void put(buffer_t *b, const void *data, size_t len) {
+    if (b->size + len > b->alloc) {
+        b->alloc = (b->size + len) * 2;
+        b->data = realloc(b->data, b->alloc);
+    }
+    memcpy(b->data + b->size, data, len);
+    b->size += len;
+}
+
+static void putc_(buffer_t *b, int c) {
+    unsigned char x = c;
+    put(b, &x, 1);
+}
+
+static void putbe(buffer_t *b, unsigned long val, int bytes) {
+    while (bytes--) putc_(b, val >> (8 * bytes));
+}
+
+static void putnum(buffer_t *b, unsigned long data) {
+    while (1) {
+        unsigned char x = data & 0x7f;
+        data >>= 7;
+        if (!data) {
+            putc_(b, 0x80 | x);
+            break;
+        }
+        putc_(b, x);
+        data--;
+    }
+}
+
+// offline patchers
+static size_t ips_apply(const unsigned char *rom, size_t size, const unsigned char *ips, size_t ips_size,
+                        unsigned char *out) {
+    size_t pos = 5, out_size = size;
+
+    memcpy(out, rom, size);
+    while (pos + 3 <= ips_size) {
+        size_t offset = ips[pos] << 16 | ips[pos + 1] << 8 | ips[pos + 2], len;
+        pos += 3;
+        if (offset == 0x454f46) {
+            if (pos + 3 <= ips_size) out_size = ips[pos] << 16 | ips[pos + 1] << 8 | ips[pos + 2];
+            break;
+        }
+        len = ips[pos] << 8 | ips[pos + 1];
+        pos += 2;
+        if (offset > out_size) memset(out + out_size, 0, offset - out_size);
+        if (len) {
+            memcpy(out + offset, ips + pos, len);
+            pos += len;
+        } else {
+            len = ips[pos] << 8 | ips[pos + 1];
+            memset(out + offset, ips[pos + 2], len);
+            pos += 3;
+        }
+        if (offset + len > out_size) out_size = offset + len;
+    }
+    return out_size;
+}
+
+static unsigned long getnum(const unsigned char *p, size_t *pos) {
+    unsigned long data = 0, shift = 1;
+    while (1) {
+        unsigned char x = p[(*pos)++];
+        data += (x & 0x7f) * shift;
+        if (x & 0x80) break;
+        shift <<= 7;
+        data += shift;
+    }
+    return data;
+}
+
+static size_t bps_apply(const unsigned char *rom, const unsigned char *bps, size_t bps_size, unsigned char *out) {
+    size_t pos = 4, out_pos = 0, src_rel = 0, dst_rel = 0;
+    unsigned long len, data;
+
+    getnum(bps, &pos);
+    getnum(bps, &pos);
+    pos += getnum(bps, &pos);
+    while (pos < bps_size - 12) {
+        data = getnum(bps, &pos);
+        len = (data >> 2) + 1;
+        switch (data & 3) {
+        case 0: memcpy(out + out_pos, rom + out_pos, len); break;
+        case 1: memcpy(out + out_pos, bps + pos, len); pos += len; break;
+        case 2:
+            data = getnum(bps, &pos);
+            src_rel += (data & 1) ? -(data >> 1) : (data >> 1);
+            memcpy(out + out_pos, rom + src_rel, len);
+            src_rel += len;
+            break;
+        case 3:
+            data = getnum(bps, &pos);
+            dst_rel += (data & 1) ? -(data >> 1) : (data >> 1);
+            while (len--) out[out_pos++] = out[dst_rel++];
+            continue;
+        }
+        out_pos += len;
+    }
+    return out_pos;
+}
+
+// streaming patcher, as in data_io_file_tx_patch()
+static char stream(const unsigned char *rom, size_t size, const unsigned char *patch, size_t patch_size_,
+                   unsigned int chunk, unsigned char *out, size_t *out_size) {
+    char res;
+
+    patch_data = patch;
+    if ((res = patch_parse(patch_size_, size, test_read)) != PATCH_OK) return res;
+    *out_size = patch_size();
+    for (size_t pos = 0; pos < *out_size; pos += chunk) {
+        unsigned int len = (*out_size - pos > chunk) ? chunk : *out_size - pos;
+        unsigned int n = (pos < size) ? ((size - pos > len) ? len : size - pos) : 0;
+        memcpy(out + pos, rom + pos, n);
+        memset(out + pos + n, 0, len - n);
+        if ((res = patch_apply(out + pos, pos, len)) != PATCH_OK) return res;
+    }
+    return PATCH_OK;
+}
+
+static int compare(const char *name, const unsigned char *rom, size_t size, const unsigned char *patch,
+                   size_t psize, const unsigned char *ref, size_t ref_size) {
+    static const unsigned int chunks[] = { 8192, 4096, 1000 };
+    unsigned char *out = malloc(ref_size + 0x1000000);
+    int ret = 0;
+
+    for (int i = 0; i < 3 && !ret; i++) {
+        size_t out_size = 0;
+        char res = stream(rom, size, patch, psize, chunks[i], out, &out_size);
+        if (res != PATCH_OK || out_size != ref_size || memcmp(out, ref, ref_size)) {
+            printf("FAIL %s: chunk %u, result %d, %zu/%zu bytes\n", name, chunks[i], res, out_size, ref_size);
+            ret = 1;
+        }
+    }
+    if (!ret) printf("PASS %s: %zu -> %zu bytes, %zu bytes patch\n", name, size, ref_size, psize);
+    free(out);
+    return ret;
+}
+
+static int expect(const char *name, const unsigned char *rom, size_t size, const buffer_t *patch, char result) {
+    unsigned char *out = malloc(0x1000000 + size);
+    size_t out_size;
+    char res = stream(rom, size, patch->data, patch->size, 8192, out, &out_size);
+
+    free(out);
+    if (res != result) {
+        printf("FAIL %s: result %d, expected %d\n", name, res, result);
+        return 1;
+    }
+    printf("PASS %s: rejected (%d)\n", name, res);
+    return 0;
+}
+
+// records at random offsets, or in order without overlaps
+static void gen_ips(buffer_t *b, size_t size, int records, int trunc, int sorted) {
+    size_t next = 0;
+
+    b->size = 0;
+    put(b, "PATCH", 5);
+    for (int i = 0; i < records; i++) {
+        size_t offset = rand() % (size + 5000), len = 1 + rand() % 3000;
+        if (sorted) {
+            offset = next + rand() % (size / records + 100);
+            len = 1 + rand() % 1000;
+            if (offset <= 0x454f46 && offset + len > 0x454f46) offset = 0x454f46 + 1;
+            next = offset + len;
+        }
+        if (offset == 0x454f46) offset++;
+        putbe(b, offset, 3);
+        if (rand() % 4) {
+            putbe(b, len, 2);
+            for (size_t j = 0; j < len; j++) putc_(b, rand());
+        } else {
+            putbe(b, 0, 2);
+            putbe(b, len, 2);
+            putc_(b, rand());
+        }
+    }
+    put(b, "EOF", 3);
+    if (trunc) putbe(b, size / 2, 3);
+}
+
+// streamable BPS: source reads, target reads and source copies in place
+static void gen_bps(buffer_t *b, const unsigned char *rom, size_t size, size_t dst_size, unsigned char *dst,
+                    int target_copy) {
+    size_t out = 0, src_rel = 0;
+    unsigned long crc;
+
+    b->size = 0;
+    put(b, "BPS1", 4);
+    putnum(b, size);
+    putnum(b, dst_size);
+    putnum(b, 3);
+    put(b, "abc", 3);
+    while (out < dst_size) {
+        size_t len = 1 + rand() % 5000;
+        int action = rand() % 3;
+        if (len > dst_size - out) len = dst_size - out;
+        if (out + len > size && action != 1) action = 1;
+        if (target_copy && out > 100 && action == 2) {
+            putnum(b, (len - 1) << 2 | 3);
+            putnum(b, (out - 100) << 1);
+            for (size_t j = 0; j < len; j++) dst[out + j] = dst[out - 100 + j];
+            target_copy = 0;
+        } else if (action == 0) {
+            putnum(b, (len - 1) << 2);
+            memcpy(dst + out, rom + out, len);
+        } else if (action == 1) {
+            putnum(b, (len - 1) << 2 | 1);
+            for (size_t j = 0; j < len; j++) dst[out + j] = rand();
+            put(b, dst + out, len);
+        } else {
+            long d = out - src_rel;
+            putnum(b, (len - 1) << 2 | 2);
+            putnum(b, (d < 0 ? -d : d) << 1 | (d < 0));
+            memcpy(dst + out, rom + out, len);
+            src_rel = out + len;
+        }
+        out += len;
+    }
+    crc = crc32(rom, size);
+    for (int i = 0; i < 4; i++) putc_(b, crc >> (8 * i));
+    crc = crc32(dst, dst_size);
+    for (int i = 0; i < 4; i++) putc_(b, crc >> (8 * i));
+    crc = crc32(b->data, b->size);
+    for (int i = 0; i < 4; i++) putc_(b, crc >> (8 * i));
+}
+
+static unsigned char *load(const char *name, size_t *size) {
+    FILE *f = fopen(name, "rb");
+    unsigned char *buf;
+
+    if (!f) return 0;
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(*size + 1);
+    if (fread(buf, 1, *size, f) != *size) *size = 0;
+    fclose(f);
+    return buf;
+}
+
+int main(int argc, char **argv) {
+    static const size_t sizes[] = { 1, 1000, 8192, 65536, 1000000, 4194304 };
+    buffer_t patch = { 0 };
+    char name[64];
+    int failed = 0;
+
+    srand(1);
+    failed += test_crc("check", (const unsigned char*)"123456789", 9, 0xCBF43926);
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t size = sizes[i], ref_size;
+        unsigned char *rom = malloc(size);
+        unsigned char *ref = malloc(size + 0x1000000);
+
+        for (size_t j = 0; j < size; j++) rom[j] = rand();
+        sprintf(name, "%zu", size);
+        failed += test_crc(name, rom, size, crc32(rom, size));
+
+        for (int t = 0; t < 4; t++) {
+            int records = (t == 0) ? 1 : (t == 1) ? 50 : (t == 2) ? PATCH_RECORDS : 5000;
+            gen_ips(&patch, size, records, 0, t == 3);
+            ref_size = ips_apply(rom, size, patch.data, patch.size, ref);
+            sprintf(name, "ips %zu/%d%s", size, records, (t == 3) ? " in order" : "");
+            failed += compare(name, rom, size, patch.data, patch.size, ref, ref_size);
+        }
+        gen_ips(&patch, size, 20, 1, 0);
+        ref_size = ips_apply(rom, size, patch.data, patch.size, ref);
+        sprintf(name, "ips %zu truncated", size);
+        failed += compare(name, rom, size, patch.data, patch.size, ref, ref_size);
+
+        for (int t = 0; t < 3; t++) {
+            size_t dst_size = (t == 0) ? size : (t == 1) ? size + 12345 : size / 2 + 1;
+            gen_bps(&patch, rom, size, dst_size, ref, 0);
+            ref_size = bps_apply(rom, patch.data, patch.size, ref);
+            sprintf(name, "bps %zu -> %zu", size, dst_size);
+            failed += compare(name, rom, size, patch.data, patch.size, ref, ref_size);
+        }
+
+        if (size > 1000) {
+            gen_bps(&patch, rom, size, size, ref, 1);
+            sprintf(name, "bps %zu target copy", size);
+            failed += expect(name, rom, size, &patch, PATCH_ERR_BPS);
+
+            gen_bps(&patch, rom, size, size, ref, 0);
+            sprintf(name, "bps %zu wrong rom", size);
+            failed += expect(name, rom, size - 1, &patch, PATCH_ERR_SOURCE);
+
+            gen_ips(&patch, size, 20, 0, 1);
+            patch.size -= 3;
+            sprintf(name, "ips %zu without EOF", size);
+            failed += expect(name, rom, size, &patch, PATCH_ERR_FORMAT);
+        }
+        free(rom);
+        free(ref);
+    }
+
+    gen_ips(&patch, 1000, PATCH_RECORDS + 1, 0, 0);
+    failed += expect("ips too many records", (unsigned char*)"x", 1, &patch, PATCH_ERR_SIZE);
+    free(patch.data);
+
+    for (int i = 1; i + 2 < argc; i += 3) {
+        size_t size, psize, ref_size;
+        unsigned char *rom = load(argv[i], &size);
+        unsigned char *p = load(argv[i + 1], &psize);
+        unsigned char *ref = load(argv[i + 2], &ref_size);
+
+        if (!rom || !p || !ref) {
+            printf("FAIL %s: cannot open\n", argv[i + 1]);
+            failed++;
+        } else {
+            failed += compare(argv[i + 1], rom, size, p, psize, ref, ref_size);
+        }
+        free(rom);
+        free(p);
+        free(ref);
+    }
+
+    if (failed) printf("%d test(s) failed\n", failed);
+    return failed ? 1 : 0;
+}
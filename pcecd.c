@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include "pcecd.h"
 #include "cue_parser.h"
+#include "cd_cache.h"
 #include "user_io.h"
 #include "utils.h"
 #include "debug.h"
@@ -136,28 +137,21 @@ static void SendData(char *buf, uint16_t len, unsigned char dm) {
 }
 
 static void SendSector(uint16_t len, unsigned char dm) {
-	UINT br;
-	DISKLED_ON;
 	if (toc.tracks[pcecdd.index].type && (pcecdd.lba >= 0)) {
 		// data sector
-
-		if (toc.tracks[pcecdd.index].sector_size != 2048)
-			f_lseek(&toc.file->file, f_tell(&toc.file->file) + 16);
-
-		pcecd_debugf("Send data sector, lba: %d pos: %llu", pcecdd.lba, f_tell(&toc.file->file));
-		f_read(&toc.file->file, sector_buffer, 2048, &br);
-
-		if (toc.tracks[pcecdd.index].sector_size != 2048)
-			f_lseek(&toc.file->file, f_tell(&toc.file->file) + (toc.tracks[pcecdd.index].sector_size - 2048 - 16));
-		//pcecd_debugf("Send data sector, post pos: %llu", f_tell(&toc.file->file));
-
-		SendData(sector_buffer, 2048, dm);
+		pcecd_debugf("Send data sector, lba: %d", pcecdd.lba);
+		cd_read_sector(pcecdd.lba, sector_buffer, CD_SECTOR_DATA);
+		len = 2048;
 		//hexdump(buffer, 2048, 0);
 	} else {
-		f_read(&toc.file->file, sector_buffer, 2352, &br);
-		SendData(sector_buffer, 2352, dm);
+		cd_read_sector(pcecdd.lba, sector_buffer, CD_SECTOR_RAW);
+		len = 2352;
+	}
+	if (user_io_get_core_features() & FEAT_CDSUB) {
+		cd_read_subchannel(pcecdd.lba, sector_buffer + len);
+		len += CD_SUBCHANNEL;
 	}
-	DISKLED_OFF;
+	SendData(sector_buffer, len, dm);
 }
 
 static char CheckDisk() {
@@ -225,7 +219,6 @@ static void pcecd_run() {
 		if (pcecdd.lba >=toc.tracks[pcecdd.index].end) {
 			pcecdd.index++;
 			pcecdd.isData = 0x01;
-			f_lseek(&toc.file->file, toc.tracks[pcecdd.index].offset);
 		}
 	} else if (pcecdd.state == PCECD_STATE_PLAY) {
 
@@ -256,8 +249,7 @@ static void pcecd_run() {
 		} else if (!pcecdd.cdda_fifo_halffull) {
 			for (int i = 0; i <= pcecdd.CDDAFirst; i++) {
 				if (!toc.tracks[pcecdd.index].type) {
-					f_lseek(&toc.file->file, toc.tracks[pcecdd.index].offset + (pcecdd.lba - toc.tracks[pcecdd.index].start) * 2352);
-					//pcecd_debugf("Audio sector send = %i, track = %i, offset = %llu", pcecdd.lba, pcecdd.index, f_tell(&toc.file->file));
+					//pcecd_debugf("Audio sector send = %i, track = %i", pcecdd.lba, pcecdd.index);
 					SendSector(2352, 0);
 				}
 				pcecdd.lba++;
@@ -393,10 +385,7 @@ static void pcecd_command() {
 		pcecdd.lba = new_lba;
 		pcecdd.cnt = cnt_;
 
-		int offset = (new_lba - toc.tracks[pcecdd.index].start) * toc.tracks[pcecdd.index].sector_size + toc.tracks[pcecdd.index].offset;
-		f_lseek(&toc.file->file, offset);
-
-		pcecd_debugf("lba: %d index: %d, offset: %d", new_lba, pcecdd.index, offset);
+		pcecd_debugf("lba: %d index: %d", new_lba, pcecdd.index);
 
 		pcecdd.audioOffset = 0;
 
@@ -4,6 +4,7 @@
 #include <string.h>
 #include "psx.h"
 #include "cue_parser.h"
+#include "cd_cache.h"
 #include "user_io.h"
 #include "data_io.h"
 #include "utils.h"
@@ -19,6 +20,9 @@ typedef enum
 
 static char *region_str[] = {"Unknown", "JP", "US", "EU"};
 
+// last sector served to the core, to detect sequential streaming
+static unsigned int psx_last_lba = 0xffffffff;
+
 typedef struct
 {
 	uint32_t track_count;
@@ -78,25 +82,45 @@ static uint16_t psx_libCryptMask(FIL* sbi_file)
 	return mask;
 }
 
+// CRC-16-CCITT of the Q subchannel, stored inverted
+static uint16_t psx_subq_crc(const uint8_t *q)
+{
+	uint16_t crc = 0;
+	for (int i = 0; i < 10; i++) {
+		crc ^= q[i] << 8;
+		for (int b = 0; b < 8; b++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+	}
+	return ~crc;
+}
+
+// without an SBI file, the protected sectors can be found in the
+// subchannel data: LibCrypt modifies their Q channel, so the CRC doesn't match
+static uint16_t psx_libCryptMaskSub()
+{
+	uint8_t sub[CD_SUBCHANNEL];
+	uint16_t mask = 0;
+	for (int m = 0; m < 16; m++) {
+		if (cd_read_subchannel(libCryptSectors[m] - 150, sub) != CD_RES_OK) continue;
+		const uint8_t *q = sub + 12;
+		if (psx_subq_crc(q) != ((q[10] << 8) | q[11])) mask |= (1 << (15 - m));
+	}
+	return mask;
+}
+
 static void psx_read_sector(char* buffer, unsigned int lba)
 {
-	UINT br;
 	if (!toc.valid) {
 		memset(buffer, 0, 2352);
 		return;
 	}
 
 	int index = cue_gettrackbylba(lba);
-	int offset = (lba - toc.tracks[index].start) * toc.tracks[index].sector_size + toc.tracks[index].offset;
-	//psx_debugf("read CD lba=%d, track=%d offset=%d (trackstart=%d tracoffset=%d tracksectorsize=%d)", lba, index, offset, toc.tracks[index].start, toc.tracks[index].offset, toc.tracks[index].sector_size);
+	//psx_debugf("read CD lba=%d, track=%d (trackstart=%d tracoffset=%d tracksectorsize=%d)", lba, index, toc.tracks[index].start, toc.tracks[index].offset, toc.tracks[index].sector_size);
 	if (toc.tracks[index].sector_size != 2352) {
 		// unsupported sector size by the core
 		memset(buffer, 0, 2352);
 	} else {
-		DISKLED_ON
-		f_lseek(&toc.file->file, offset);
-		f_read(&toc.file->file, buffer, 2352, &br);
-		DISKLED_OFF
+		cd_read_sector(lba, buffer, CD_SECTOR_RAW);
 	}
 	return;
 }
@@ -177,19 +201,33 @@ void psx_mount_cd(const unsigned char *name)
 		if(f_open(&sbi_f, sbi, FA_READ) == FR_OK) {
 			libcrypt_mask = psx_libCryptMask(&sbi_f);
 			f_close(&sbi_f);
+		} else if (cd_has_subchannel()) {
+			libcrypt_mask = psx_libCryptMaskSub();
 		}
 	}
 
+	psx_last_lba = 0xffffffff;
 	iprintf("PSX: CD region: %s crypt_mask: %04x\n", region_str[region], libcrypt_mask);
 	psx_send_cue_and_metadata(libcrypt_mask, region, 0);
 }
 
 void psx_read_cd(uint8_t drive_index, unsigned int lba)
 {
+	uint16_t len = 2352;
 	user_io_sd_ack(drive_index);
 	if (lba>=150) lba-=150;
 	psx_read_sector(sector_buffer, lba);
+	if (user_io_get_core_features() & FEAT_CDSUB) {
+		cd_read_subchannel(lba, sector_buffer + 2352);
+		len += CD_SUBCHANNEL;
+	}
 	spi_uio_cmd_cont(UIO_SECTOR_RD);
-	spi_write(sector_buffer, 2352);
+	spi_write(sector_buffer, len);
 	DisableIO();
+
+	// XA audio and FMV streaming is strictly sequential: read the following
+	// sectors ahead while the core is busy with this one, so the next
+	// request is answered from the cache
+	if (lba == psx_last_lba + 1) cd_cache_prefetch(lba + 1);
+	psx_last_lba = lba;
 }
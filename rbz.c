@@ -0,0 +1,126 @@
+// rbz.c
+// Streaming decoder of compressed FPGA bitstreams
+
+#include <string.h>
+#include "rbz.h"
+#include "crc32.h"
+
+typedef struct
+{
+  unsigned char *window;
+  unsigned int  wpos;
+  unsigned char *in;
+  unsigned int  in_size;
+  unsigned int  in_pos;
+  unsigned int  in_len;
+  unsigned long crc;
+  rbz_read_t    read;
+  rbz_write_t   write;
+} rbz_t;
+
+static unsigned long rbz_get32(const unsigned char *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static char rbz_fill(rbz_t *z) {
+  z->in_pos = 0;
+  z->in_len = z->read(z->in, z->in_size);
+  return z->in_len != 0;
+}
+
+static int rbz_getc(rbz_t *z) {
+  if (z->in_pos == z->in_len && !rbz_fill(z)) return -1;
+  return z->in[z->in_pos++];
+}
+
+// extended length of a literal run or a match
+static long rbz_getlen(rbz_t *z, long len) {
+  int c;
+
+  if (len == 15) do {
+    if ((c = rbz_getc(z)) < 0) return -1;
+    len += c;
+  } while (c == 255);
+  return len;
+}
+
+static char rbz_flush(rbz_t *z) {
+  if (!z->wpos) return 1;
+  z->crc = CalculateCRC32(z->crc, z->window, z->wpos);
+  if (!z->write(z->window, z->wpos)) return 0;
+  z->wpos = 0;
+  return 1;
+}
+
+char rbz_is_compressed(const unsigned char *hdr) {
+  return !memcmp(hdr, RBZ_MAGIC, 4);
+}
+
+char rbz_decompress(unsigned char *buffer, unsigned int size, rbz_read_t read, rbz_write_t write) {
+  unsigned char hdr[RBZ_HDR_SIZE];
+  unsigned long total, remaining, crc;
+  long len;
+  int c, i;
+  rbz_t z;
+
+  z.window = buffer;
+  z.wpos = 0;
+  z.in = buffer + RBZ_WINDOW;
+  z.in_size = size - RBZ_WINDOW;
+  z.in_pos = z.in_len = 0;
+  z.crc = ~0UL;
+  z.read = read;
+  z.write = write;
+
+  for (i = 0; i < RBZ_HDR_SIZE; i++) {
+    if ((c = rbz_getc(&z)) < 0) return RBZ_ERR_READ;
+    hdr[i] = c;
+  }
+  if (!rbz_is_compressed(hdr)) return RBZ_ERR_FORMAT;
+  total = remaining = rbz_get32(&hdr[4]);
+  crc = rbz_get32(&hdr[8]);
+
+  while (remaining) {
+    int token = rbz_getc(&z);
+    if (token < 0) return RBZ_ERR_READ;
+
+    // literals, copied in blocks from the input buffer
+    if ((len = rbz_getlen(&z, token >> 4)) < 0) return RBZ_ERR_READ;
+    if (len > remaining) return RBZ_ERR_FORMAT;
+    remaining -= len;
+    while (len) {
+      if (z.in_pos == z.in_len && !rbz_fill(&z)) return RBZ_ERR_READ;
+      unsigned int n = z.in_len - z.in_pos;
+      if (n > len) n = len;
+      if (n > RBZ_WINDOW - z.wpos) n = RBZ_WINDOW - z.wpos;
+      memcpy(z.window + z.wpos, z.in + z.in_pos, n);
+      z.in_pos += n;
+      z.wpos += n;
+      len -= n;
+      if (z.wpos == RBZ_WINDOW && !rbz_flush(&z)) return RBZ_ERR_WRITE;
+    }
+    if (!remaining) break;
+
+    // match from the window
+    unsigned int offset;
+    if ((c = rbz_getc(&z)) < 0) return RBZ_ERR_READ;
+    offset = c;
+    if ((c = rbz_getc(&z)) < 0) return RBZ_ERR_READ;
+    offset |= c << 8;
+    if (!offset || offset > RBZ_WINDOW || offset > total - remaining) return RBZ_ERR_FORMAT;
+    if ((len = rbz_getlen(&z, token & 15)) < 0) return RBZ_ERR_READ;
+    len += RBZ_MINMATCH;
+    if (len > remaining) return RBZ_ERR_FORMAT;
+    remaining -= len;
+
+    unsigned int src = (z.wpos - offset) & (RBZ_WINDOW - 1);
+    while (len--) {
+      z.window[z.wpos++] = z.window[src];
+      src = (src + 1) & (RBZ_WINDOW - 1);
+      if (z.wpos == RBZ_WINDOW && !rbz_flush(&z)) return RBZ_ERR_WRITE;
+    }
+  }
+
+  if (!rbz_flush(&z)) return RBZ_ERR_WRITE;
+  return ((~z.crc & 0xffffffff) == crc) ? RBZ_OK : RBZ_ERR_CRC;
+}
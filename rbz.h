@@ -0,0 +1,34 @@
+#ifndef RBZ_H
+#define RBZ_H
+
+// Compressed FPGA bitstream (.RBZ), created by mkrbz
+// 16 bytes header, little endian: "RBZ1", size and CRC32 of the
+// uncompressed bitstream, reserved. It's followed by LZ4 style sequences:
+//   token    - literal count (high nibble), match length - 4 (low nibble),
+//              15 means extra length bytes follow, until one is below 255
+//   literals
+//   offset   - 2 bytes, 1..RBZ_WINDOW back in the uncompressed data
+// The last sequence may end after its literals, when the size is reached.
+
+#define RBZ_MAGIC      "RBZ1"
+#define RBZ_HDR_SIZE   16
+#define RBZ_WINDOW     2048  // history needed by the decoder
+#define RBZ_MINMATCH   4
+
+#define RBZ_OK         0
+#define RBZ_ERR_READ   1
+#define RBZ_ERR_FORMAT 2
+#define RBZ_ERR_CRC    3
+#define RBZ_ERR_WRITE  4
+
+// reads max. len bytes of the compressed stream, returns the bytes read
+typedef unsigned int (*rbz_read_t)(unsigned char *buf, unsigned int len);
+// receives the next part of the uncompressed data, returns 0 to abort
+typedef char (*rbz_write_t)(const unsigned char *buf, unsigned int len);
+
+char rbz_is_compressed(const unsigned char *hdr);
+// buffer is the work area (size > RBZ_WINDOW): the decoder window and the
+// input buffer. Output is passed to write() in blocks of max. RBZ_WINDOW.
+char rbz_decompress(unsigned char *buffer, unsigned int size, rbz_read_t read, rbz_write_t write);
+
+#endif // RBZ_H
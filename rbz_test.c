@@ -0,0 +1,163 @@
+// rbz_test.c
+// Host side round trip test of the RBZ compressor (mkrbz.c) and the
+// firmware decoder (rbz.c)
+//
+// rbztest [file.rbf ...]
+//   compresses generated and the given bitstreams, decompresses them with
+//   the firmware buffer layout and compares the result with the original
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rbz.h"
+
+// firmware work area, as in ConfigureFpga() on the AT91SAM
+#define WORK_SIZE 4096
+
+size_t rbz_bound(size_t size);
+size_t rbz_compress(const unsigned char *src, size_t size, unsigned char *dst);
+unsigned long CalculateCRC32(unsigned long crc, unsigned char *pBuffer, unsigned long nSize);
+
+static const unsigned char *in_data;
+static size_t in_size, in_pos;
+static unsigned char *out_data;
+static size_t out_size, out_pos;
+
+static unsigned int test_read(unsigned char *buf, unsigned int len) {
+    // hand out odd chunk sizes to exercise the refills
+    if (len > 509) len = 509;
+    if (len > in_size - in_pos) len = in_size - in_pos;
+    memcpy(buf, in_data + in_pos, len);
+    in_pos += len;
+    return len;
+}
+
+static char test_write(const unsigned char *buf, unsigned int len) {
+    if (len > RBZ_WINDOW || out_pos + len > out_size) return 0;
+    memcpy(out_data + out_pos, buf, len);
+    out_pos += len;
+    return 1;
+}
+
+static char decompress(const unsigned char *rbz, size_t size, unsigned char *out, size_t osize) {
+    static unsigned char work[WORK_SIZE];
+
+    in_data = rbz;
+    in_size = size;
+    in_pos = 0;
+    out_data = out;
+    out_size = osize;
+    out_pos = 0;
+    return rbz_decompress(work, sizeof(work), test_read, test_write);
+}
+
+static int test_buffer(const char *name, const unsigned char *data, size_t size) {
+    unsigned char *rbz = malloc(rbz_bound(size));
+    unsigned char *out = malloc(size + 1);
+    size_t csize;
+    double t;
+    int ret = 0;
+    char res;
+
+    csize = rbz_compress(data, size, rbz);
+
+    t = clock();
+    res = decompress(rbz, csize, out, size);
+    t = (clock() - t) / CLOCKS_PER_SEC;
+
+    if (res != RBZ_OK || out_pos != size || memcmp(out, data, size)) {
+        printf("FAIL %s: result %d, %zu of %zu bytes\n", name, res, out_pos, size);
+        ret = 1;
+    } else if (csize > RBZ_HDR_SIZE + 8) {
+        // corrupted streams must be rejected, unless the damage
+        // happens to decode to the same data
+        rbz[csize / 2] ^= 0x55;
+        res = decompress(rbz, csize, out, size);
+        if (res == RBZ_OK && (out_pos != size || memcmp(out, data, size))) {
+            printf("FAIL %s: corruption not detected\n", name);
+            ret = 1;
+        }
+        if (decompress(rbz, csize / 2, out, size) == RBZ_OK) {
+            printf("FAIL %s: truncation not detected\n", name);
+            ret = 1;
+        }
+    }
+
+    if (!ret)
+        printf("PASS %s: %zu -> %zu bytes (%.1f%%), %.1f MB/s\n", name, size, csize,
+            size ? 100.0 * csize / size : 0.0, t > 0 ? size / t / 1e6 : 0.0);
+    free(rbz);
+    free(out);
+    return ret;
+}
+
+// looks like a bitstream: long zero runs, repeated frames and random data
+static void gen_bitstream(unsigned char *buf, size_t size) {
+    size_t pos = 0;
+
+    while (pos < size) {
+        size_t len = 1 + rand() % 5000;
+        if (len > size - pos) len = size - pos;
+        switch (rand() % 4) {
+        case 0: memset(buf + pos, 0, len); break;
+        case 1: memset(buf + pos, 0xff, len); break;
+        case 2:
+            for (size_t i = 0; i < len; i++) buf[pos + i] = rand();
+            break;
+        case 3:
+            for (size_t i = 0; i < len; i++)
+                buf[pos + i] = pos + i > 1000 ? buf[pos + i - 1 - rand() % 1000] : 0;
+            break;
+        }
+        pos += len;
+    }
+}
+
+int main(int argc, char **argv) {
+    static const size_t sizes[] = { 0, 1, 3, 4, 5, 15, 16, 19, 270, 2047, 2048, 2049, 4096, 100000, 3000000 };
+    char name[64];
+    int failed = 0;
+
+    srand(1);
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        unsigned char *buf = malloc(sizes[i] + 1);
+
+        memset(buf, 0, sizes[i]);
+        sprintf(name, "zero %zu", sizes[i]);
+        failed += test_buffer(name, buf, sizes[i]);
+
+        for (size_t j = 0; j < sizes[i]; j++) buf[j] = rand();
+        sprintf(name, "random %zu", sizes[i]);
+        failed += test_buffer(name, buf, sizes[i]);
+
+        gen_bitstream(buf, sizes[i]);
+        sprintf(name, "bitstream %zu", sizes[i]);
+        failed += test_buffer(name, buf, sizes[i]);
+        free(buf);
+    }
+
+    for (int i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        size_t size;
+        unsigned char *buf;
+
+        if (!f) {
+            printf("FAIL %s: cannot open\n", argv[i]);
+            failed++;
+            continue;
+        }
+        fseek(f, 0, SEEK_END);
+        size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        buf = malloc(size + 1);
+        if (fread(buf, 1, size, f) != size) size = 0;
+        fclose(f);
+        failed += test_buffer(argv[i], buf, size);
+        free(buf);
+    }
+
+    if (failed) printf("%d test(s) failed\n", failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,106 @@
+// st_probe.c
+// Geometry of Atari ST floppy images
+
+#include "st_probe.h"
+
+static struct {
+  unsigned short id;     // mount ID of the volume
+  unsigned long sclust;  // 0 = free
+  unsigned long size;
+  st_geometry_t geo;
+} st_probe_cache[ST_PROBE_CACHE];
+static unsigned char st_probe_next;
+
+static unsigned short le16(const unsigned char *p) {
+  return p[0] | (p[1] << 8);
+}
+
+char st_probe_bpb(const unsigned char *boot, unsigned long size, st_geometry_t *geo) {
+  unsigned short bps = le16(boot + 11);
+  unsigned char spc = boot[13];
+  unsigned short res = le16(boot + 14);
+  unsigned char nfats = boot[16];
+  unsigned short ndirs = le16(boot + 17);
+  unsigned short nsects = le16(boot + 19);
+  unsigned short spt = le16(boot + 24);
+  unsigned short sides = le16(boot + 26);
+  unsigned int tracks;
+
+  // the emulated FDC only knows 512 byte sectors
+  if (bps != 512 || !spc || (spc & (spc - 1)) || !res || !nfats || nfats > 2 ||
+      !ndirs || (ndirs & 15) || spt < 8 || spt > 48 || !sides || sides > 2)
+    return 0;
+
+  tracks = nsects / (spt * sides);
+  if (tracks < 1 || tracks > 86 || (unsigned long)nsects * 512 > size)
+    return 0;
+
+  geo->spt = spt;
+  geo->sides = sides;
+  return 1;
+}
+
+char st_probe_size(unsigned long size, st_geometry_t *geo) {
+  unsigned char sides = (size > 85*11*512) ? 2 : 1;
+
+  // double, high and extra density with 9 to 12 sectors on 78 to 85 tracks
+  for (int m = 0; m <= 2; m++)
+    for (int s = 9; s <= 12; s++)
+      for (int t = 78; t <= 85; t++)
+        if (512UL * (s << m) * t * sides == size) {
+          geo->spt = s << m;
+          geo->sides = sides;
+          return 1;
+        }
+  return 0;
+}
+
+void st_probe(const unsigned char *boot, unsigned long size, st_geometry_t *geo) {
+  st_geometry_t bpb;
+  char valid = st_probe_bpb(boot, size, &bpb);
+
+  // a BPB describing the whole image first, then the size, then any
+  // BPB that fits (images with extra data)
+  if (valid && 512UL * bpb.spt * bpb.sides * (le16(boot + 19) / (bpb.spt * bpb.sides)) == size)
+    *geo = bpb;
+  else if (!st_probe_size(size, geo)) {
+    if (valid) {
+      *geo = bpb;
+    } else {
+      geo->spt = 0;
+      geo->sides = (size > 85*11*512) ? 2 : 1;
+    }
+  }
+}
+
+char st_probe_get(unsigned short id, unsigned long sclust, unsigned long size, st_geometry_t *geo) {
+  for (int i = 0; i < ST_PROBE_CACHE; i++) {
+    if (sclust && st_probe_cache[i].sclust == sclust && st_probe_cache[i].id == id &&
+        st_probe_cache[i].size == size) {
+      *geo = st_probe_cache[i].geo;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void st_probe_put(unsigned short id, unsigned long sclust, unsigned long size, const st_geometry_t *geo) {
+  int i;
+
+  if (!sclust) return;
+  for (i = 0; i < ST_PROBE_CACHE; i++)
+    if (st_probe_cache[i].sclust == sclust && st_probe_cache[i].id == id) break;
+  if (i == ST_PROBE_CACHE) {
+    i = st_probe_next;
+    st_probe_next = (st_probe_next + 1) % ST_PROBE_CACHE;
+  }
+  st_probe_cache[i].id = id;
+  st_probe_cache[i].sclust = sclust;
+  st_probe_cache[i].size = size;
+  st_probe_cache[i].geo = *geo;
+}
+
+void st_probe_drop(unsigned short id, unsigned long sclust) {
+  for (int i = 0; i < ST_PROBE_CACHE; i++)
+    if (st_probe_cache[i].sclust == sclust && st_probe_cache[i].id == id) st_probe_cache[i].sclust = 0;
+}
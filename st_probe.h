@@ -0,0 +1,33 @@
+#ifndef ST_PROBE_H
+#define ST_PROBE_H
+
+// Geometry of Atari ST floppy images (.ST). The boot sector BPB of the
+// image is used if it's valid and matches the image size, otherwise the
+// size is matched against common sector and track counts. Results are
+// kept for the last images, keyed by the mount ID of the card, the start
+// cluster and the size, so inserting a disk again needs no probing. A new
+// card gets a new mount ID.
+
+#define ST_PROBE_CACHE 4
+
+typedef struct
+{
+  unsigned char spt;    // sectors per track, 0 = unknown
+  unsigned char sides;
+} st_geometry_t;
+
+// geometry from the BPB of the boot sector, 0 if it isn't valid or
+// doesn't fit into an image of size bytes
+char st_probe_bpb(const unsigned char *boot, unsigned long size, st_geometry_t *geo);
+// geometry from the image size alone, 0 if it's no common one
+char st_probe_size(unsigned long size, st_geometry_t *geo);
+// both of the above, boot is the first sector of the image
+void st_probe(const unsigned char *boot, unsigned long size, st_geometry_t *geo);
+
+// geometry of a previously probed image
+char st_probe_get(unsigned short id, unsigned long sclust, unsigned long size, st_geometry_t *geo);
+void st_probe_put(unsigned short id, unsigned long sclust, unsigned long size, const st_geometry_t *geo);
+// forget an image, after its boot sector has been written
+void st_probe_drop(unsigned short id, unsigned long sclust);
+
+#endif // ST_PROBE_H
@@ -0,0 +1,135 @@
+// st_probe_test.c
+// Host side test of the ST floppy image geometry probe (st_probe.c)
+//
+// stprobetest [image.st ...]
+//   checks generated boot sectors and sizes, then prints the geometry
+//   probed for each given image
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "st_probe.h"
+
+static void put16(unsigned char *p, unsigned int v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void bpb(unsigned char *boot, int spt, int sides, int tracks) {
+    memset(boot, 0, 512);
+    put16(boot + 11, 512);
+    boot[13] = 2;
+    put16(boot + 14, 1);
+    boot[16] = 2;
+    put16(boot + 17, 112);
+    put16(boot + 19, spt * sides * tracks);
+    put16(boot + 24, spt);
+    put16(boot + 26, sides);
+}
+
+static int check(const char *name, const unsigned char *boot, unsigned long size, int spt, int sides) {
+    st_geometry_t geo;
+
+    st_probe(boot, size, &geo);
+    if (geo.spt != spt || geo.sides != sides) {
+        printf("FAIL %s: %d spt, %d sides (expected %d, %d)\n", name, geo.spt, geo.sides, spt, sides);
+        return 1;
+    }
+    printf("PASS %s: %d spt, %d sides\n", name, geo.spt, geo.sides);
+    return 0;
+}
+
+static int test_generated(void) {
+    unsigned char boot[512];
+    st_geometry_t geo, got;
+    int failed = 0;
+
+    // a valid BPB matching the size
+    bpb(boot, 9, 2, 80);
+    failed += check("DS/DD BPB", boot, 9*2*80*512, 9, 2);
+    bpb(boot, 18, 2, 80);
+    failed += check("HD BPB", boot, 18*2*80*512, 18, 2);
+
+    // odd geometries only the BPB tells
+    bpb(boot, 10, 2, 83);
+    failed += check("10 spt 83 tracks BPB", boot, 10*2*83*512, 10, 2);
+    bpb(boot, 9, 1, 40);
+    failed += check("40 track BPB", boot, 9*40*512, 9, 1);
+
+    // the size wins over a BPB not describing the image
+    bpb(boot, 9, 2, 80);
+    failed += check("10 spt image with 9 spt BPB", boot, 10*2*80*512, 10, 2);
+
+    // no BPB at all
+    memset(boot, 0, sizeof(boot));
+    failed += check("no BPB", boot, 9*1*80*512, 9, 1);
+    failed += check("no BPB, 11 spt", boot, 11*2*82*512, 11, 2);
+    failed += check("no BPB, odd size", boot, 12345, 0, 1);
+
+    // invalid BPBs
+    bpb(boot, 9, 2, 80);
+    put16(boot + 11, 1024);
+    failed += check("1024 byte sectors", boot, 700000, 0, 2);
+    bpb(boot, 9, 3, 80);
+    failed += check("3 sides", boot, 700000, 0, 2);
+    bpb(boot, 9, 2, 80);
+    boot[13] = 3;
+    failed += check("3 sectors per cluster", boot, 700000, 0, 2);
+    bpb(boot, 9, 2, 80);
+    failed += check("BPB larger than image", boot, 9*2*79*512 + 1, 0, 2);
+
+    // cache
+    geo.spt = 10;
+    geo.sides = 2;
+    st_probe_put(1, 100, 819200, &geo);
+    if (!st_probe_get(1, 100, 819200, &got) || got.spt != 10 || got.sides != 2)
+        failed++, printf("FAIL cache hit\n");
+    else if (st_probe_get(1, 100, 737280, &got) || st_probe_get(1, 101, 819200, &got))
+        failed++, printf("FAIL cache key\n");
+    else if (st_probe_get(2, 100, 819200, &got))
+        failed++, printf("FAIL cache after a card change\n");
+    else {
+        for (int i = 0; i < ST_PROBE_CACHE; i++) st_probe_put(1, 200 + i, 819200, &geo);
+        if (st_probe_get(1, 100, 819200, &got)) failed++, printf("FAIL cache replacement\n");
+        else printf("PASS cache\n");
+    }
+    st_probe_drop(1, 200);
+    if (st_probe_get(1, 200, 819200, &got) || !st_probe_get(1, 201, 819200, &got))
+        failed++, printf("FAIL cache drop\n");
+    st_probe_put(1, 0, 819200, &geo);
+    if (st_probe_get(1, 0, 819200, &got)) failed++, printf("FAIL uncached file\n");
+
+    return failed;
+}
+
+int main(int argc, char **argv) {
+    int failed = test_generated();
+
+    for (int i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        unsigned char boot[512] = { 0 };
+        st_geometry_t geo, bpb;
+        char valid;
+        long size;
+
+        if (!f) {
+            printf("FAIL %s\n", argv[i]);
+            failed++;
+            continue;
+        }
+        fseek(f, 0, SEEK_END);
+        size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        if (fread(boot, 1, sizeof(boot), f) != sizeof(boot)) memset(boot, 0, sizeof(boot));
+        fclose(f);
+
+        st_probe(boot, size, &geo);
+        valid = st_probe_bpb(boot, size, &bpb);
+        printf("%s: %ld bytes, %d spt, %d sides%s\n", argv[i], size, geo.spt, geo.sides,
+               valid ? ", valid BPB" : "");
+    }
+
+    if (failed) printf("%d test(s) failed\n", failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,290 @@
+// stx.c
+// Pasti (.STX) floppy images, read track by track from the image
+
+#include <stdio.h>
+#include <string.h>
+#include "stx.h"
+
+#define STX_HEADER       16
+#define STX_TRACK_HEADER 16
+#define STX_SECTOR_DESC  16
+
+// track flags
+#define STX_TRACK_SECTORS    0x01  // sector descriptors present
+#define STX_TRACK_IMAGE      0x40
+#define STX_TRACK_IMAGE_SYNC 0x80
+
+// sector FDC status
+#define STX_SECTOR_FUZZY     0x80
+
+typedef struct
+{
+  unsigned long  data;    // in the image
+  unsigned long  fuzzy;   // fuzzy mask in the image, 0 = none
+  unsigned char  id[6];   // track, side, sector, size, CRC
+  unsigned char  status;
+} stx_sector_t;
+
+// Nothing is indexed: the track records are searched from the last one
+// found, which is usually followed by the next track, and the sector
+// descriptors are read again for each access.
+typedef struct
+{
+  stx_read_t     read;
+  unsigned long  size;
+  unsigned short records;   // track records, less if a bad one is found
+  unsigned short idx;       // last record found
+  unsigned long  pos;
+
+  // current track
+  unsigned char  track, side, loaded;
+  unsigned char  standard;  // no descriptors, 512 byte sectors from 1
+  unsigned char  count;
+  unsigned char  next;      // next sector passing the head
+  unsigned long  desc;      // sector descriptors
+  unsigned long  fuzzy;     // fuzzy masks
+  unsigned long  data;      // track data
+  unsigned long  image;     // raw track, 0 = none
+  unsigned short image_size;
+} stx_drive_t;
+
+static stx_drive_t stx[2];
+static char stx_opened[2];
+static unsigned long stx_random = 1;
+
+static unsigned short stx_get16(const unsigned char *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static unsigned long stx_get32(const unsigned char *p) {
+  return p[0] | (p[1] << 8) | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+// CRC of the ID field, including the sync marks and the address mark
+static unsigned short stx_crc(const unsigned char *p, unsigned int len) {
+  unsigned short crc = 0xb230;  // after A1 A1 A1 FE
+
+  while (len--) {
+    crc ^= *p++ << 8;
+    for (int i = 0; i < 8; i++)
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+char stx_open(unsigned char drive, unsigned long size, stx_read_t read) {
+  stx_drive_t *d = &stx[drive];
+  unsigned char header[STX_HEADER];
+
+  stx_opened[drive] = 0;
+  if (size < STX_HEADER || read(drive, 0, header, STX_HEADER) != STX_HEADER ||
+      memcmp(header, "RSY", 4) || stx_get16(header + 4) != 3)
+    return 0;
+
+  d->read = read;
+  d->size = size;
+  d->records = header[10];
+  d->idx = 0;
+  d->pos = STX_HEADER;
+  d->loaded = 0;
+
+  iprintf("STX: %u tracks, revision %u\n", d->records, header[11]);
+  stx_opened[drive] = 1;
+  return 1;
+}
+
+void stx_close(unsigned char drive) {
+  stx_opened[drive] = 0;
+}
+
+char stx_active(unsigned char drive) {
+  return stx_opened[drive];
+}
+
+// the record of a track into t, 0 if it's missing or unreadable
+static unsigned long stx_find_track(stx_drive_t *d, unsigned char drive, unsigned char track,
+                                    unsigned char side, unsigned char *t) {
+  unsigned long pos = d->pos;
+  unsigned int idx = d->idx;
+
+  for (unsigned int n = 0; n < d->records; n++, idx++) {
+    unsigned long len;
+
+    if (idx >= d->records) {
+      idx = 0;
+      pos = STX_HEADER;
+    }
+    if (pos + STX_TRACK_HEADER > d->size || d->read(drive, pos, t, STX_TRACK_HEADER) != STX_TRACK_HEADER)
+      return 0;
+    len = stx_get32(t);
+    if (len < STX_TRACK_HEADER || pos + len > d->size) {
+      // the records from here on are ignored
+      iprintf("STX: bad track record %u\n", idx);
+      d->records = idx;
+      d->idx = 0;
+      d->pos = STX_HEADER;
+      return 0;
+    }
+    if (t[14] == (side << 7 | track)) {
+      d->idx = idx;
+      d->pos = pos;
+      return pos;
+    }
+    pos += len;
+  }
+  return 0;
+}
+
+static char stx_load(stx_drive_t *d, unsigned char drive, unsigned char track, unsigned char side) {
+  unsigned char t[STX_TRACK_HEADER];
+  unsigned long pos, fuzzy_size, data;
+  unsigned short flags, count;
+
+  if (d->loaded && d->track == track && d->side == side) return 1;
+
+  d->loaded = 0;
+  d->count = 0;
+  d->next = 0;
+  d->image = 0;
+  d->track = track;
+  d->side = side;
+  pos = (track < 0x80 && side < 2) ? stx_find_track(d, drive, track, side, t) : 0;
+  if (!pos) {
+    // unformatted track
+    d->loaded = 1;
+    return 1;
+  }
+
+  fuzzy_size = stx_get32(t + 4);
+  count = stx_get16(t + 8);
+  flags = stx_get16(t + 10);
+  pos += STX_TRACK_HEADER;
+  d->count = (count > STX_MAX_SECTORS) ? STX_MAX_SECTORS : count;
+  d->standard = !(flags & STX_TRACK_SECTORS);
+
+  if (d->standard) {
+    d->data = pos;
+    d->loaded = 1;
+    return 1;
+  }
+
+  // the fuzzy masks of the sectors follow the descriptors, then the track data
+  d->desc = pos;
+  d->fuzzy = pos + count * STX_SECTOR_DESC;
+  d->data = d->fuzzy + fuzzy_size;
+
+  if (flags & STX_TRACK_IMAGE) {
+    unsigned char size[2];
+    data = d->data;
+    if (flags & STX_TRACK_IMAGE_SYNC) data += 2;
+    if (d->read(drive, data, size, 2) != 2) return 0;
+    d->image_size = stx_get16(size);
+    d->image = data + 2;
+  }
+  d->loaded = 1;
+  return 1;
+}
+
+// the first sector from the next one passing the head on with the given
+// track and sector number, or the next one if sector < 0. Returns its
+// index, -1 if there's none.
+static int stx_find_sector(stx_drive_t *d, unsigned char drive, unsigned char track, int sector,
+                           stx_sector_t *s) {
+  unsigned char desc[4 * STX_SECTOR_DESC];
+  unsigned long fuzzy = d->fuzzy;
+  int found = -1;
+
+  for (int i = 0; i < d->count; i++) {
+    stx_sector_t c;
+
+    if (d->standard) {
+      unsigned short crc;
+      c.data = d->data + i * 512;
+      c.fuzzy = 0;
+      c.status = 0;
+      c.id[0] = d->track;
+      c.id[1] = d->side;
+      c.id[2] = i + 1;
+      c.id[3] = 2;
+      crc = stx_crc(c.id, 4);
+      c.id[4] = crc >> 8;
+      c.id[5] = crc;
+    } else {
+      unsigned char *t = desc + (i & 3) * STX_SECTOR_DESC;
+      if (!(i & 3)) {
+        unsigned int len = ((d->count - i > 4) ? 4 : d->count - i) * STX_SECTOR_DESC;
+        if (d->read(drive, d->desc + i * STX_SECTOR_DESC, desc, len) != len) return -1;
+      }
+      c.data = d->data + stx_get32(t);
+      memcpy(c.id, t + 8, 6);
+      c.status = t[14];
+      c.fuzzy = 0;
+      if (c.status & STX_SECTOR_FUZZY) {
+        c.fuzzy = fuzzy;
+        fuzzy += 128 << (c.id[3] & 3);
+      }
+    }
+
+    if (sector < 0 ? i != d->next : (c.id[0] != track || c.id[2] != sector)) continue;
+    // duplicate IDs are returned in turn, like passing under the head
+    if (found < 0 || i >= d->next) {
+      *s = c;
+      found = i;
+    }
+    if (i >= d->next) break;
+  }
+  return found;
+}
+
+unsigned int stx_read_sector(unsigned char drive, unsigned char track, unsigned char side,
+                             unsigned char sector, unsigned char *buf, unsigned char *status) {
+  stx_drive_t *d = &stx[drive];
+  stx_sector_t s;
+  unsigned int size;
+  int idx;
+
+  *status = STX_RNF;
+  if (!stx_load(d, drive, track, side)) return 0;
+
+  idx = stx_find_sector(d, drive, track, sector, &s);
+  if (idx < 0) return 0;
+  d->next = (idx + 1) % d->count;
+  if (s.status & STX_RNF) return 0;
+
+  size = 128 << (s.id[3] & 3);
+  if (d->read(drive, s.data, buf, size) != size) return 0;
+
+  // fuzzy bits read differently each time
+  if (s.fuzzy) {
+    unsigned char mask[64];
+    for (unsigned int i = 0; i < size; i += sizeof(mask)) {
+      if (d->read(drive, s.fuzzy + i, mask, sizeof(mask)) != sizeof(mask)) break;
+      for (unsigned int j = 0; j < sizeof(mask); j++) {
+        stx_random = stx_random * 1103515245 + 12345;
+        buf[i + j] = (buf[i + j] & mask[j]) | ((stx_random >> 16) & ~mask[j]);
+      }
+    }
+  }
+  *status = s.status & (STX_RECORD_TYPE | STX_CRC_ERROR);
+  return size;
+}
+
+char stx_read_address(unsigned char drive, unsigned char track, unsigned char side, unsigned char *id) {
+  stx_drive_t *d = &stx[drive];
+  stx_sector_t s;
+
+  if (!stx_load(d, drive, track, side) || !d->count) return 0;
+  if (stx_find_sector(d, drive, track, -1, &s) < 0) return 0;
+  memcpy(id, s.id, 6);
+  d->next = (d->next + 1) % d->count;
+  return 1;
+}
+
+unsigned int stx_read_track(unsigned char drive, unsigned char track, unsigned char side,
+                            unsigned char *buf, unsigned int len) {
+  stx_drive_t *d = &stx[drive];
+
+  if (!stx_load(d, drive, track, side) || !d->image) return 0;
+  if (len > d->image_size) len = d->image_size;
+  return d->read(drive, d->image, buf, len);
+}
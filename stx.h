@@ -0,0 +1,40 @@
+#ifndef STX_H
+#define STX_H
+
+// Pasti (.STX) images of Atari ST floppies. Only the image header is read
+// when it's inserted, the track records are searched when the FDC steps to
+// a track and its sector descriptors are read again for each access.
+//
+// Sectors are looked up by their ID fields, so duplicate and missing
+// sectors, odd sizes, CRC errors and fuzzy bits are reproduced. Bit timing
+// isn't, and the image is read-only.
+//
+// Built with HAVE_STX. Nothing is kept but the position in the image, about
+// 100 bytes of static RAM for both drives, so it fits the AT91SAM7S too.
+
+#define STX_MAX_SECTORS 32  // sectors per track
+
+// FDC status bits of a sector read (WD1772)
+#define STX_RECORD_TYPE 0x20  // deleted data mark
+#define STX_RNF         0x10  // record not found
+#define STX_CRC_ERROR   0x08
+
+// reads len bytes of the image of drive from pos, returns the bytes read
+typedef unsigned int (*stx_read_t)(unsigned char drive, unsigned long pos, unsigned char *buf, unsigned int len);
+
+// locate the tracks of the image, 0 if it isn't a Pasti image
+char stx_open(unsigned char drive, unsigned long size, stx_read_t read);
+void stx_close(unsigned char drive);
+char stx_active(unsigned char drive);
+
+// read the next sector passing the head with the given track and sector
+// number, returns its size, 0 if there's none
+unsigned int stx_read_sector(unsigned char drive, unsigned char track, unsigned char side,
+                             unsigned char sector, unsigned char *buf, unsigned char *status);
+// the next ID field passing the head (track, side, sector, size, CRC)
+char stx_read_address(unsigned char drive, unsigned char track, unsigned char side, unsigned char *id);
+// the raw track if the image contains it, returns its length
+unsigned int stx_read_track(unsigned char drive, unsigned char track, unsigned char side,
+                            unsigned char *buf, unsigned int len);
+
+#endif // STX_H
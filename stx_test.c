@@ -0,0 +1,246 @@
+// stx_test.c
+// Host side test of the Pasti image engine (stx.c)
+//
+// stxtest [image.stx ...]
+//   builds an image with standard, protected and missing tracks and checks
+//   the sectors, IDs and raw tracks read from it. All the sectors of the
+//   given images are read, with the number of image reads.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stx.h"
+
+static unsigned char *image;
+static size_t image_size;
+static unsigned long reads;
+
+static unsigned int test_read(unsigned char drive, unsigned long pos, unsigned char *buf, unsigned int len) {
+    reads++;
+    if (pos >= image_size) return 0;
+    if (len > image_size - pos) len = image_size - pos;
+    memcpy(buf, image + pos, len);
+    return len;
+}
+
+static unsigned char *put16(unsigned char *p, unsigned int v) {
+    *p++ = v;
+    *p++ = v >> 8;
+    return p;
+}
+
+static unsigned char *put32(unsigned char *p, unsigned long v) {
+    p = put16(p, v);
+    return put16(p, v >> 16);
+}
+
+static unsigned char pattern(int track, int side, int sector, int i) {
+    return track * 7 + side * 13 + sector * 31 + i;
+}
+
+// track 0/0 standard, track 0/1 protected with a track image, track 1/0
+// missing, track 2/0 standard
+static size_t build(unsigned char *buf) {
+    static const struct { unsigned char sector, size, status, dup; } prot[] = {
+        { 1, 2, 0x00, 0 }, { 2, 2, 0x00, 0 }, { 4, 2, 0x00, 0 }, { 4, 2, 0x00, 1 },
+        { 5, 2, 0x08, 0 }, { 6, 2, 0x10, 0 }, { 7, 3, 0x00, 0 }, { 8, 0, 0x80, 0 },
+    };
+    int nprot = sizeof(prot) / sizeof(prot[0]);
+    unsigned char *p = buf, *rec;
+    unsigned long data;
+
+    memcpy(p, "RSY", 4);
+    put16(p + 4, 3);
+    p[10] = 3;  // tracks
+    p[11] = 2;  // revision
+    memset(p + 12, 0, 4);
+    p += 16;
+
+    for (int t = 0; t < 3; t += 2) {
+        rec = p;
+        memset(p, 0, 16);
+        put32(p, 16 + 9 * 512);
+        put16(p + 8, 9);
+        p[14] = t;
+        p += 16;
+        for (int s = 1; s <= 9; s++)
+            for (int i = 0; i < 512; i++) *p++ = pattern(t, 0, s, i);
+        if (t == 0) {
+            // protected track 0 side 1
+            unsigned char *desc, *fuzzy, *trk;
+            rec = p;
+            memset(p, 0, 16);
+            put32(p + 4, 128);  // fuzzy mask of sector 8
+            put16(p + 8, nprot);
+            put16(p + 10, 0x01 | 0x40 | 0x80);
+            put16(p + 12, 6256);
+            p[14] = 0x80;
+            desc = p + 16;
+            fuzzy = desc + nprot * 16;
+            for (int i = 0; i < 128; i++) fuzzy[i] = (i & 1) ? 0xff : 0x0f;
+            trk = fuzzy + 128;
+            put16(trk, 123);    // first sync
+            put16(trk + 2, 100); // track image
+            for (int i = 0; i < 100; i++) trk[4 + i] = 0x4e ^ i;
+            data = 104;
+            for (int i = 0; i < nprot; i++) {
+                unsigned char *d = desc + i * 16;
+                unsigned int size = 128 << prot[i].size;
+                memset(d, 0, 16);
+                put32(d, data);
+                put16(d + 4, i * 5000);
+                d[8] = 0;
+                d[9] = 1;
+                d[10] = prot[i].sector;
+                d[11] = prot[i].size;
+                d[12] = 0x12;
+                d[13] = 0x34 + i;
+                d[14] = prot[i].status;
+                for (unsigned int j = 0; j < size; j++)
+                    trk[data + j] = pattern(0, 1 + prot[i].dup, prot[i].sector, j);
+                data += size;
+            }
+            p = trk + data;
+            put32(rec, p - rec);
+        }
+    }
+    return p - buf;
+}
+
+static int fail(const char *msg) {
+    printf("FAIL %s\n", msg);
+    return 1;
+}
+
+static int check_sector(int track, int side, int sector, int dup, unsigned int size, unsigned char status) {
+    static unsigned char buf[1024];
+    unsigned char st;
+    unsigned int len = stx_read_sector(0, track, side, sector, buf, &st);
+    char msg[80];
+
+    sprintf(msg, "sector %d/%d/%d", track, side, sector);
+    if (len != size || st != status) {
+        printf("FAIL %s: size %u, status %02x\n", msg, len, st);
+        return 1;
+    }
+    for (unsigned int i = 0; i < len; i++)
+        if (buf[i] != pattern(track, side + dup, sector, i)) return fail(msg);
+    printf("PASS %s: %u bytes, status %02x\n", msg, len, st);
+    return 0;
+}
+
+static int test_generated(void) {
+    unsigned char buf[1024], id[6], st;
+    int failed = 0;
+
+    image = malloc(65536);
+    image_size = build(image);
+    reads = 0;
+    if (!stx_open(0, image_size, test_read)) return fail("open");
+    printf("PASS open: %zu bytes, %lu reads\n", image_size, reads);
+
+    // standard tracks
+    for (int s = 1; s <= 9; s++) failed += check_sector(0, 0, s, 0, 512, 0);
+    failed += check_sector(2, 0, 9, 0, 512, 0);
+    if (stx_read_sector(0, 2, 0, 10, buf, &st) || st != STX_RNF) failed += fail("sector 10 not found");
+    if (!stx_read_address(0, 0, 0, id) || id[0] || id[1] || id[2] != 1 || id[3] != 2 ||
+        id[4] != 0xca || id[5] != 0x6f)
+        failed += fail("read address standard");
+    else
+        printf("PASS read address standard\n");
+
+    // protected track: duplicates in turn, errors, sizes, fuzzy bits
+    failed += check_sector(0, 1, 1, 0, 512, 0);
+    failed += check_sector(0, 1, 4, 0, 512, 0);
+    failed += check_sector(0, 1, 4, 1, 512, 0);
+    failed += check_sector(0, 1, 4, 0, 512, 0);
+    failed += check_sector(0, 1, 5, 0, 512, STX_CRC_ERROR);
+    if (stx_read_sector(0, 0, 1, 6, buf, &st) || st != STX_RNF) failed += fail("rnf sector");
+    if (stx_read_sector(0, 0, 1, 3, buf, &st) || st != STX_RNF) failed += fail("missing sector");
+    failed += check_sector(0, 1, 7, 0, 1024, 0);
+    {
+        unsigned char first[128];
+        int differs = 0, stable = 1;
+        stx_read_sector(0, 0, 1, 8, first, &st);
+        for (int n = 0; n < 8; n++) {
+            stx_read_sector(0, 0, 1, 8, buf, &st);
+            for (int i = 0; i < 128; i++) {
+                unsigned char mask = (i & 1) ? 0xff : 0x0f;
+                if ((buf[i] ^ pattern(0, 1, 8, i)) & mask) stable = 0;
+                if (buf[i] != first[i]) differs = 1;
+            }
+        }
+        if (!stable || !differs) failed += fail("fuzzy sector");
+        else printf("PASS fuzzy sector\n");
+    }
+    for (int n = 0; n < 8; n++) {
+        stx_read_address(0, 0, 1, id);
+        if (n == 0 && (id[0] != 0 || id[1] != 1 || id[4] != 0x12)) failed += fail("read address protected");
+    }
+    if (stx_read_track(0, 0, 1, buf, sizeof(buf)) != 100 || buf[0] != 0x4e || buf[99] != (0x4e ^ 99))
+        failed += fail("read track");
+    else
+        printf("PASS read track\n");
+    if (stx_read_track(0, 0, 0, buf, sizeof(buf))) failed += fail("read track without image");
+
+    // unformatted track
+    if (stx_read_sector(0, 1, 0, 1, buf, &st) || st != STX_RNF || stx_read_address(0, 1, 0, id))
+        failed += fail("unformatted track");
+    else
+        printf("PASS unformatted track\n");
+
+    // bad length of the last record: it's ignored, the tracks before it
+    // still read, from any position in the search
+    {
+        unsigned long pos = 16;
+        for (int i = 0; i < 2; i++)
+            pos += image[pos] | image[pos + 1] << 8 | (unsigned long)image[pos + 2] << 16;
+        put32(image + pos, image_size);
+        stx_open(0, image_size, test_read);
+        if (stx_read_sector(0, 2, 0, 1, buf, &st) || st != STX_RNF) failed += fail("bad track record");
+        else failed += check_sector(0, 1, 1, 0, 512, 0) + check_sector(0, 0, 1, 0, 512, 0);
+    }
+
+    // not a Pasti image
+    image[0] = 'X';
+    if (stx_open(0, image_size, test_read)) failed += fail("bad magic");
+    free(image);
+    return failed;
+}
+
+int main(int argc, char **argv) {
+    int failed = test_generated();
+
+    for (int i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        unsigned char buf[1024], st;
+        unsigned int sectors = 0;
+
+        if (!f) {
+            failed += fail(argv[i]);
+            continue;
+        }
+        fseek(f, 0, SEEK_END);
+        image_size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        image = malloc(image_size);
+        if (fread(image, 1, image_size, f) != image_size) image_size = 0;
+        fclose(f);
+
+        reads = 0;
+        if (!stx_open(0, image_size, test_read)) {
+            failed += fail(argv[i]);
+        } else {
+            for (int t = 0; t < 86; t++)
+                for (int s = 0; s < 2; s++)
+                    for (int n = 0; n < 32; n++)
+                        if (stx_read_sector(0, t, s, n, buf, &st)) sectors++;
+            printf("PASS %s: %u sectors, %lu reads\n", argv[i], sectors, reads);
+        }
+        free(image);
+    }
+
+    if (failed) printf("%d test(s) failed\n", failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,167 @@
+// toc_cache.c
+// Binary cache of parsed CUE sheets and image cluster maps
+
+#include <string.h>
+#include <stdio.h>
+#include "toc_cache.h"
+#include "cue_parser.h"
+#include "mist_cfg.h"
+#include "utils.h"
+#include "debug.h"
+
+#define TOC_CACHE_MAGIC 0x32434f54 // "TOC2"
+
+typedef struct
+{
+  uint64_t size;
+  uint16_t date;
+  uint16_t time;
+} __attribute__ ((packed)) toc_cache_stamp_t;
+
+typedef struct
+{
+  uint32_t magic;
+  toc_cache_stamp_t stamp[2];  // of the CUE and the image
+  uint32_t bin_sclust;   // first cluster of the image, the link map depends on it
+  uint32_t clmt_len;     // number of DWORDs in the cluster link map, 0 = not indexed
+  int32_t  end;
+  int32_t  last;
+  char     bin_name[FF_LFN_BUF + 1];
+} __attribute__ ((packed)) toc_cache_hdr_t;
+
+// kept off the stack, a mount doesn't nest
+static FIL toc_cache_file;
+static FILINFO toc_cache_fno;
+static toc_cache_hdr_t toc_cache_hdr;
+static char toc_cache_path[FF_LFN_BUF + 1];
+
+// length of the directory part of name, -1 if there's none
+static int toc_cache_dirlen(const char *name) {
+  const char *fname = strrchr(name, '/');
+  return fname ? MIN(fname - name, FF_LFN_BUF) : -1;
+}
+
+// f_stat() is not available (FF_FS_MINIMIZE), look up the directory entries
+// of the CUE and the image, with a single walk if they share the directory
+static char toc_cache_stat(const char *cue, const char *bin, toc_cache_stamp_t *stamp) {
+  const char *name[2] = { cue, bin };
+  char found = 0;
+
+  for (int i = 0; i < 2; i++) {
+    int len = toc_cache_dirlen(name[i]);
+    char wanted = 0;
+    DIR dir;
+
+    if (found & (1 << i)) continue;
+    for (int j = i; j < 2; j++)
+      if (toc_cache_dirlen(name[j]) == len && !_strnicmp(name[i], name[j], len)) wanted |= 1 << j;
+
+    if (len < 0) {
+      strcpy(toc_cache_path, ".");
+    } else {
+      memcpy(toc_cache_path, name[i], len);
+      toc_cache_path[len] = 0;
+    }
+    if (f_opendir(&dir, toc_cache_path) != FR_OK) return 0;
+    while (wanted && f_readdir(&dir, &toc_cache_fno) == FR_OK && toc_cache_fno.fname[0]) {
+      for (int j = i; j < 2; j++) {
+        const char *fname = name[j] + len + 1;
+        if ((wanted & (1 << j)) &&
+            (!_strnicmp(toc_cache_fno.fname, fname, FF_LFN_BUF + 1) || !_strnicmp(toc_cache_fno.altname, fname, FF_SFN_BUF + 1))) {
+          stamp[j].size = toc_cache_fno.fsize;
+          stamp[j].date = toc_cache_fno.fdate;
+          stamp[j].time = toc_cache_fno.ftime;
+          wanted &= ~(1 << j);
+          found |= 1 << j;
+        }
+      }
+    }
+    f_closedir(&dir);
+    if (!(found & (1 << i))) return 0;
+  }
+  return 1;
+}
+
+static char toc_cache_name(const char *filename) {
+  if (strlen(filename) + strlen(TOC_CACHE_EXT) > FF_LFN_BUF) return 0;
+  strcpy(toc_cache_path, filename);
+  strcat(toc_cache_path, TOC_CACHE_EXT);
+  return 1;
+}
+
+char toc_cache_load(const char *filename, IDXFile *image) {
+  FIL *file = &toc_cache_file;
+  toc_cache_hdr_t *hdr = &toc_cache_hdr;
+  toc_cache_stamp_t stamp[2];
+  unsigned long time = GetRTTC();
+  UINT br;
+
+  if (!mist_cfg.toc_cache || !toc_cache_name(filename)) return 0;
+  if (f_open(file, toc_cache_path, FA_READ) != FR_OK) return 0;
+
+  if (f_read(file, hdr, sizeof(*hdr), &br) != FR_OK || br != sizeof(*hdr) ||
+      hdr->magic != TOC_CACHE_MAGIC || hdr->last < 1 || hdr->last > 99 || hdr->clmt_len > SZ_TBL) {
+    f_close(file);
+    return 0;
+  }
+  hdr->bin_name[FF_LFN_BUF] = 0;
+
+  // validate against the CUE and the image
+  if (!toc_cache_stat(filename, hdr->bin_name, stamp) || memcmp(stamp, hdr->stamp, sizeof(stamp))) {
+    f_close(file);
+    iprintf("TOC cache of %s is outdated\n", filename);
+    return 0;
+  }
+
+  if (IDXOpen(image, hdr->bin_name, FA_READ) != FR_OK) {
+    f_close(file);
+    return 0;
+  }
+
+  if (image->file.obj.sclust != hdr->bin_sclust ||
+      f_read(file, toc.tracks, hdr->last * sizeof(cd_track_t), &br) != FR_OK || br != hdr->last * sizeof(cd_track_t) ||
+      (hdr->clmt_len && (f_read(file, image->clmt, hdr->clmt_len * sizeof(DWORD), &br) != FR_OK || br != hdr->clmt_len * sizeof(DWORD)))) {
+    f_close(file);
+    IDXClose(image);
+    memset(&toc, 0, sizeof(toc));
+    return 0;
+  }
+  f_close(file);
+
+  if (hdr->clmt_len) image->file.cltbl = image->clmt;
+
+  toc.file = image;
+  toc.end = hdr->end;
+  toc.last = hdr->last;
+  toc.valid = 1;
+
+  iprintf("TOC loaded from cache in %lu ms\n", GetRTTC() - time);
+  return 1;
+}
+
+void toc_cache_save(const char *filename, const char *binname, IDXFile *image) {
+  FIL *file = &toc_cache_file;
+  toc_cache_hdr_t *hdr = &toc_cache_hdr;
+  UINT bw;
+  FRESULT res;
+
+  if (!mist_cfg.toc_cache || !toc.valid) return;
+
+  memset(hdr, 0, sizeof(*hdr));
+  hdr->magic = TOC_CACHE_MAGIC;
+  if (!toc_cache_stat(filename, binname, hdr->stamp)) return;
+  hdr->bin_sclust = image->file.obj.sclust;
+  hdr->clmt_len = image->file.cltbl ? image->clmt[0] : 0;
+  hdr->end = toc.end;
+  hdr->last = toc.last;
+  strncpy(hdr->bin_name, binname, FF_LFN_BUF);
+
+  if (!toc_cache_name(filename) || f_open(file, toc_cache_path, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) return;
+  res = f_write(file, hdr, sizeof(*hdr), &bw);
+  if (res == FR_OK) res = f_write(file, toc.tracks, toc.last * sizeof(cd_track_t), &bw);
+  if (res == FR_OK && hdr->clmt_len) res = f_write(file, image->clmt, hdr->clmt_len * sizeof(DWORD), &bw);
+  f_close(file);
+
+  if (res != FR_OK) iprintf("Error writing TOC cache (%d)\n", res);
+  else iprintf("TOC cache written to %s\n", toc_cache_path);
+}
@@ -0,0 +1,21 @@
+#ifndef TOC_CACHE_H
+#define TOC_CACHE_H
+
+#include "idxfile.h"
+
+// Persisted TOC cache
+// The parsed toc_t and the cluster link map of the image are stored in
+// a small binary file next to the CUE/ISO (<name>.tcache). It's validated
+// by the size and timestamp of both the CUE and the image file, so a
+// remount doesn't need to parse the CUE and index the image again.
+//
+// Built with HAVE_TOC_CACHE, and only used when toc_cache=1 in mist.ini
+// as it writes to the card.
+
+#define TOC_CACHE_EXT ".tcache"
+
+// returns 1 if toc and image were restored from the cache
+char toc_cache_load(const char *filename, IDXFile *image);
+void toc_cache_save(const char *filename, const char *binname, IDXFile *image);
+
+#endif // TOC_CACHE_H
@@ -18,10 +18,29 @@
 #include "font.h"
 #include "mmc.h"
 #include "utils.h"
+#include "crc32.h"
+#include "st_probe.h"
 #include "FatFs/diskio.h"
+#ifdef HAVE_UNPACK
+#include "unpack.h"
+#endif
+#ifdef HAVE_STX
+#include "stx.h"
+#endif
 
 #define CONFIG_FILENAME  "MIST    CFG"
 
+// floppy images offered by the file selector
+#if defined(HAVE_UNPACK) && defined(HAVE_STX)
+#define TOS_FDD_EXT "ST STXMSAGZ "
+#elif defined(HAVE_UNPACK)
+#define TOS_FDD_EXT "ST MSAGZ "
+#elif defined(HAVE_STX)
+#define TOS_FDD_EXT "ST STX"
+#else
+#define TOS_FDD_EXT "ST "
+#endif
+
 extern bool eth_present;
 extern char s[FF_LFN_BUF + 1];
 
@@ -55,6 +74,19 @@ unsigned long hdd_direct = 0;
 // 0-1 floppy, 2-3 hdd
 char disk_inserted[4];
 
+#ifdef HAVE_ACSI_READAHEAD
+// sequential ACSI reads: the sectors following a read are fetched from the
+// card after the command has been acknowledged, while the ST is busy with
+// the data. The next read is served from here.
+static struct {
+  unsigned long  lba;     // first sector in the buffer
+  unsigned long  next;    // sector after the last read, to detect sequential reads
+  unsigned short count;   // sectors in the buffer, 0 = empty
+  unsigned char  target;
+  char           data[SECTOR_BUFFER_SIZE] __attribute__ ((aligned (4)));
+} acsi_ra;
+#endif
+
 unsigned char spi_speed;
 unsigned char spi_newspeed;
 
@@ -180,6 +212,18 @@ static void mist_memory_read_block(char *data) {
   mist2_spi_set_speed(spi_speed);
 }
 
+static void mist_memory_read_blocks(char *data, int count) {
+  spi_speed = spi_get_speed();
+  mist2_spi_set_speed(spi_newspeed);
+  EnableFpga();
+  SPI(MIST_READ_MEMORY);
+
+  spi_read(data, 512*count);
+
+  DisableFpga();
+  mist2_spi_set_speed(spi_speed);
+}
+
 static void mist_memory_write_block(const char *data) {
   EnableFpga();
   SPI(MIST_WRITE_MEMORY);
@@ -213,9 +257,53 @@ void mist_memory_set(char data, unsigned long words) {
   DisableFpga();
 }
 
+// Stream size bytes (whole sectors) of a file into memory at base, a
+// sector buffer at a time. The dma address is set every 64k (128 sectors)
+// as it can't transfer more than 255 sectors at once. Returns the CRC32 of
+// the data sent.
+static unsigned long mist_memory_upload(FIL *file, unsigned long base, unsigned long size) {
+  unsigned long crc = ~0, done, len;
+  UINT br;
+
+  for(done = 0; done < size; done += len) {
+    len = MIN(size - done, SECTOR_BUFFER_SIZE);
+    if(f_read(file, sector_buffer, len, &br) != FR_OK || br != len)
+      break;
+
+    if(!(done & 0xffff))
+      mist_memory_set_address(base + done, 128, 0);
+
+    mist_memory_write_blocks(sector_buffer, len/512);
+    crc = CalculateCRC32(crc, sector_buffer, len);
+  }
+  return ~crc;
+}
+
+// read size bytes back from base and compare their CRC32
+static char mist_memory_verify(unsigned long base, unsigned long size, unsigned long crc) {
+  unsigned long c = ~0, done, len;
+
+  for(done = 0; done < size; done += len) {
+    len = MIN(size - done, SECTOR_BUFFER_SIZE);
+
+    if(!(done & 0xffff))
+      mist_memory_set_address(base + done, 128, 1);
+
+    mist_memory_read_blocks(sector_buffer, len/512);
+    c = CalculateCRC32(c, sector_buffer, len);
+  }
+
+  if(~c != crc)
+    iprintf("Verify of $%08lx-$%08lx failed (%08lx != %08lx)\n", base, base + size, ~c, crc);
+  return ~c == crc;
+}
+
 // enable direct sd card access on acsi0
 void tos_set_direct_hdd(char on) {
   config.sd_direct = on;
+#ifdef HAVE_ACSI_READAHEAD
+  acsi_ra.count = 0;
+#endif
 
   if(on) {
     tos_debugf("ACSI: enable direct sd access");
@@ -255,6 +343,18 @@ static void dma_nak(void) {
   DisableFpga();
 }
 
+// read count sectors of the ACSI target (direct card access or image)
+static void acsi_read_sectors(unsigned char target, unsigned long lba, unsigned short count, char *buf) {
+  if(hdd_direct && target == 0) {
+    if(user_io_dip_switch1())
+      tos_debugf("ACSI: direct read %ld", lba);
+    disk_read(fs.pdrv, buf, lba, count);
+  } else {
+    IDXSeek(&sd_image[target+2], lba);
+    FileReadBlockEx(&sd_image[target+2].file, buf, count);
+  }
+}
+
 static void handle_acsi(unsigned char *buffer) {
 
   static unsigned char asc[2] = { 0,0 };
@@ -266,7 +366,6 @@ static void handle_acsi(unsigned char *buffer) {
   unsigned short length = buffer[4];
 
   unsigned short blocklen;
-  unsigned char *buf;
   unsigned short blocks;
 
   if(length == 0) length = 256;
@@ -348,6 +447,9 @@ static void handle_acsi(unsigned char *buffer) {
         }
 
         if(lba+length <= blocks) {
+#ifdef HAVE_ACSI_READAHEAD
+          char sequential = (target == acsi_ra.target && lba == acsi_ra.next);
+#endif
           DISKLED_ON;
 #ifndef SD_NO_DIRECT_MODE
           if (user_io_core_type() == CORE_TYPE_MIST2 && fat_uses_mmc()) {
@@ -367,16 +469,18 @@ static void handle_acsi(unsigned char *buffer) {
 #endif
             while(length) {
               int blocksize = MIN(length, SECTOR_BUFFER_SIZE/512);
-              if(hdd_direct && target == 0) {
-                if(user_io_dip_switch1())
-                  tos_debugf("ACSI: direct read %ld", lba);
-                disk_read(fs.pdrv, sector_buffer, lba, blocksize);
-              } else {
-                IDXSeek(&sd_image[target+2], lba);
-                FileReadBlockEx(&sd_image[target+2].file, sector_buffer, blocksize);
+#ifdef HAVE_ACSI_READAHEAD
+              if(acsi_ra.count && target == acsi_ra.target &&
+                 lba >= acsi_ra.lba && lba < acsi_ra.lba + acsi_ra.count) {
+                blocksize = MIN(blocksize, acsi_ra.lba + acsi_ra.count - lba);
+                mist_memory_write_blocks(acsi_ra.data + (lba - acsi_ra.lba)*512, blocksize);
+              } else
+#endif
+              {
+                acsi_read_sectors(target, lba, blocksize, sector_buffer);
+                // hexdump(sector_buffer, 32, 0);
+                mist_memory_write_blocks(sector_buffer, blocksize);
               }
-              // hexdump(sector_buffer, 32, 0);
-              mist_memory_write_blocks(sector_buffer, blocksize);
               length-=blocksize;
               lba+=blocksize;
             }
@@ -386,6 +490,19 @@ static void handle_acsi(unsigned char *buffer) {
           DISKLED_OFF;
           dma_ack(0x00);
           asc[target] = 0x00;
+#ifdef HAVE_ACSI_READAHEAD
+          // fetch the next sectors of a sequential read, unless they are buffered
+          if(sequential && lba < blocks &&
+             !(acsi_ra.count && lba >= acsi_ra.lba && lba < acsi_ra.lba + acsi_ra.count)) {
+            acsi_ra.count = MIN(blocks - lba, SECTOR_BUFFER_SIZE/512);
+            acsi_ra.lba = lba;
+            DISKLED_ON;
+            acsi_read_sectors(target, lba, acsi_ra.count, acsi_ra.data);
+            DISKLED_OFF;
+          }
+          acsi_ra.target = target;
+          acsi_ra.next = lba;
+#endif
         } else {
           tos_debugf("ACSI: read (%d+%d) exceeds device limits (%d)", 
             lba, length, blocks);
@@ -414,17 +531,15 @@ static void handle_acsi(unsigned char *buffer) {
         }
 
         if(lba+length <= blocks) {
+#ifdef HAVE_ACSI_READAHEAD
+          acsi_ra.count = 0;
+#endif
           DISKLED_ON;
           while(length) {
             UINT bw;
 
             blocklen = (length > SECTOR_BUFFER_SIZE/512) ? SECTOR_BUFFER_SIZE/512 : length;
-            buf = sector_buffer;
-            blocks = blocklen;
-            while (blocks--) {
-              mist_memory_read_block(buf);
-              buf+=512;
-            }
+            mist_memory_read_blocks(sector_buffer, blocklen);
             if(hdd_direct && target == 0) {
               if(user_io_dip_switch1()) 
                 tos_debugf("ACSI: direct write %ld", lba);
@@ -511,6 +626,194 @@ static void handle_acsi(unsigned char *buffer) {
   }
 }
 
+#ifdef HAVE_FDD_CACHE
+// the current track, read at once when the FDC moves to another track, side
+// or drive. One buffer for both drives, as the FDC only accesses one of them
+// at a time.
+#define FDC_TRACK_SECTORS 21
+#define FDC_TRACK_LEN     6250  // raw bytes of a DD track
+
+static struct {
+  char          data[FDC_TRACK_SECTORS*512] __attribute__ ((aligned (4)));
+  unsigned char drive;
+  unsigned char track;
+  unsigned char side;
+  unsigned char valid;
+} fdc_cache;
+
+static char *fdc_track_data(unsigned char drive, unsigned char track, unsigned char side) {
+  unsigned int len = fdd_image[drive].spt * 512;
+  FRESULT res;
+  UINT br;
+
+  if(fdc_cache.valid && fdc_cache.drive == drive && fdc_cache.track == track && fdc_cache.side == side)
+    return fdc_cache.data;
+
+  fdc_cache.valid = 0;
+  if(fdd_image[drive].spt > FDC_TRACK_SECTORS || side >= fdd_image[drive].sides)
+    return NULL;
+
+  DISKLED_ON;
+  res = f_lseek(&fdd_image[drive].file, (track * fdd_image[drive].sides + side) * len);
+  if(res == FR_OK)
+    res = f_read(&fdd_image[drive].file, fdc_cache.data, len, &br);
+  DISKLED_OFF;
+  if(res != FR_OK || br != len)
+    return NULL;
+
+  fdc_cache.drive = drive;
+  fdc_cache.track = track;
+  fdc_cache.side = side;
+  fdc_cache.valid = 1;
+  return fdc_cache.data;
+}
+
+// CRC of the address and data fields, including the A1 sync marks
+static unsigned short fdc_crc(unsigned short crc, const unsigned char *p, unsigned int len) {
+  while(len--) {
+    crc ^= *p++ << 8;
+    for(int i = 0; i < 8; i++)
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+// the track as returned by the READ TRACK command of the WD1772, in
+// IBM format, padded to full blocks. Returns the number of blocks.
+static unsigned char fdc_raw_track(unsigned char *p, const char *data, unsigned char spt,
+                                   unsigned char track, unsigned char side) {
+  // shorter gaps for 11 sectors
+  unsigned int gap3 = (60 + spt * 614 <= FDC_TRACK_LEN) ? 40 : 1;
+  unsigned int len = 60 + spt * (574 + gap3);
+  unsigned short crc;
+  unsigned char *field;
+
+  if(len < FDC_TRACK_LEN) len = FDC_TRACK_LEN;
+  if(len > SECTOR_BUFFER_SIZE) return 0;
+
+  memset(p, 0x4e, (len + 511) & ~511);
+  p += 60;
+  for(int s = 0; s < spt; s++) {
+    memset(p, 0x00, 12);
+    p += 12;
+    field = p;
+    *p++ = 0xa1; *p++ = 0xa1; *p++ = 0xa1;
+    *p++ = 0xfe;
+    *p++ = track;
+    *p++ = side;
+    *p++ = s + 1;
+    *p++ = 2;  // 512 bytes
+    crc = fdc_crc(0xffff, field, 8);
+    *p++ = crc >> 8;
+    *p++ = crc;
+    p += 22;
+
+    memset(p, 0x00, 12);
+    p += 12;
+    field = p;
+    *p++ = 0xa1; *p++ = 0xa1; *p++ = 0xa1;
+    *p++ = 0xfb;
+    memcpy(p, data + s * 512, 512);
+    p += 512;
+    crc = fdc_crc(0xffff, field, 516);
+    *p++ = crc >> 8;
+    *p++ = crc;
+    p += gap3;
+  }
+  return (len + 511) / 512;
+}
+
+// WRITE TRACK: the sectors are taken from the data fields of the track
+// written by the ST, the geometry of the image can't be changed
+static void fdc_format_track(unsigned char drive, unsigned char track, unsigned char side,
+                             const unsigned char *p, unsigned int len) {
+  unsigned char spt = fdd_image[drive].spt;
+  unsigned char id_track = 0, id_sector = 0, id_size = 0, id = 0;
+  unsigned int i = 0, sectors = 0;
+  UINT bw;
+
+  if(side >= fdd_image[drive].sides) return;
+
+  while(i < len) {
+    // sync marks are written as F5
+    if(p[i++] != 0xf5) continue;
+    while(i < len && p[i] == 0xf5) i++;
+    if(i >= len) break;
+
+    if(p[i] == 0xfe && i + 4 < len) {
+      id_track = p[i+1];
+      id_sector = p[i+3];
+      id_size = p[i+4];
+      id = 1;
+      i += 5;
+    } else if(p[i] == 0xfb && id && i + 512 < len) {
+      if(id_size == 2 && id_track == track && id_sector >= 1 && id_sector <= spt) {
+        DISKLED_ON;
+        f_lseek(&fdd_image[drive].file, ((track * fdd_image[drive].sides + side) * spt + id_sector - 1) * 512);
+        f_write(&fdd_image[drive].file, p + i + 1, 512, &bw);
+        DISKLED_OFF;
+        sectors++;
+      }
+      id = 0;
+      i += 513;
+    }
+  }
+  f_sync(&fdd_image[drive].file);
+  fdc_cache.valid = 0;
+  if(!track && !side)
+    st_probe_drop(fdd_image[drive].file.obj.id, fdd_image[drive].file.obj.sclust);
+  tos_debugf("FDC: formatted %d sectors", sectors);
+}
+#endif
+
+#ifdef HAVE_STX
+static unsigned int tos_stx_read(unsigned char drive, unsigned long pos, unsigned char *buf, unsigned int len) {
+  UINT br;
+
+  if(f_lseek(&fdd_image[drive].file, pos) != FR_OK ||
+     f_read(&fdd_image[drive].file, buf, len, &br) != FR_OK)
+    return 0;
+  return br;
+}
+
+// Pasti images are looked up by the ID fields, the head is assumed to be
+// on the track in the track register. The image is never written.
+static void handle_fdc_stx(unsigned char drive, unsigned char cmd, unsigned char track,
+                           unsigned char sector, unsigned char side, unsigned char scnt) {
+  unsigned char status = 0;
+  unsigned int len;
+
+  DISKLED_ON;
+  if((cmd & 0xe0) == 0x80) {
+    // read sector, a multi sector read stops at the first failing one
+    while(scnt) {
+      len = stx_read_sector(drive, track, side, sector, sector_buffer, &status);
+      if(!len) break;
+      mist_memory_write(sector_buffer, len/2);
+      scnt -= MIN(scnt, (len + 511) / 512);
+      sector++;
+      if(!(cmd & 0x10) || status) break;
+    }
+  } else if((cmd & 0xe0) == 0xa0 || (cmd & 0xf0) == 0xf0) {
+    status = 0x40;  // write protect
+  } else if((cmd & 0xe0) == 0xc0) {
+    if(stx_read_address(drive, track, side, sector_buffer))
+      mist_memory_write(sector_buffer, 3);
+    else
+      status = STX_RNF;
+  } else if((cmd & 0xf0) == 0xe0) {
+    len = stx_read_track(drive, track, side, sector_buffer, MIN(scnt * 512, SECTOR_BUFFER_SIZE));
+    if(len) mist_memory_write(sector_buffer, (len + 1)/2);
+  }
+  DISKLED_OFF;
+
+  if(user_io_dip_switch1())
+    tos_debugf("FDC STX cmd %x (%c, SD:%d, T:%d, S:%d) status %x",
+               cmd, 'A'+drive, side, track, sector, status);
+  dma_ack(status);
+}
+#endif
+
 static void handle_fdc(unsigned char *buffer) {
   // extract contents
   unsigned int dma_address = 256 * 256 * buffer[0] + 
@@ -527,6 +830,13 @@ static void handle_fdc(unsigned char *buffer) {
 
   // check if a matching disk image has been inserted
   if(drv_sel && disk_inserted[drv_sel-1]) {
+#ifdef HAVE_STX
+    if(stx_active(drv_sel-1)) {
+      handle_fdc_stx(drv_sel-1, fdc_cmd, fdc_track, fdc_sector, drv_side, scnt);
+      return;
+    }
+#endif
+
     // if the fdc has been asked to write protect the disks, then
     // write sector commands should never reach the oi controller
 
@@ -545,6 +855,24 @@ static void handle_fdc(unsigned char *buffer) {
                    dma_address);
       }
 
+#ifdef HAVE_FDD_CACHE
+      // reads within the track are served from the track cache in one burst,
+      // sectors past the end of the track are read from the image below
+      if(scnt && (fdc_cmd & 0xe0) == 0x80 &&
+         (fdc_sector > 0) && (fdc_sector <= fdd_image[drv_sel-1].spt)) {
+        char *track = fdc_track_data(drv_sel-1, fdc_track, drv_side);
+        if(track) {
+          unsigned char n = (fdc_cmd & 0x10) ? MIN(scnt, fdd_image[drv_sel-1].spt - fdc_sector + 1) : 1;
+          mist_memory_write_blocks(track + (fdc_sector-1) * 512, n);
+          scnt = (fdc_cmd & 0x10) ? scnt - n : 0;
+          dma_address += n * 512;
+          offset += n;
+        }
+      } else if((fdc_cmd & 0xe0) == 0xa0) {
+        fdc_cache.valid = 0;
+      }
+#endif
+
       while(scnt) {
         // check if requested sector is in range
         if((fdc_sector > 0) && (fdc_sector <= fdd_image[drv_sel-1].spt)) {
@@ -563,6 +891,9 @@ static void handle_fdc(unsigned char *buffer) {
             mist_memory_read_block(sector_buffer);
             // ... and write to disk
             FileWriteBlock(&(fdd_image[drv_sel-1].file), sector_buffer);
+            // a new boot sector may describe another geometry
+            if(!offset)
+              st_probe_drop(fdd_image[drv_sel-1].file.obj.id, fdd_image[drv_sel-1].file.obj.sclust);
           }
 
           DISKLED_OFF;
@@ -582,14 +913,31 @@ static void handle_fdc(unsigned char *buffer) {
 
       if((fdc_cmd & 0xf0) == 0xe0) {
         iprintf("READ TRACK %d SIDE %d\n", fdc_track, drv_side);
-        siprintf(msg, "RD TRK %d S %d", fdc_track, drv_side);
-        InfoMessage(msg);
+#ifdef HAVE_FDD_CACHE
+        char *track = fdc_track_data(drv_sel-1, fdc_track, drv_side);
+        unsigned char n = track ? fdc_raw_track(sector_buffer, track, fdd_image[drv_sel-1].spt, fdc_track, drv_side) : 0;
+        if(n) {
+          mist_memory_write_blocks(sector_buffer, MIN(scnt, n));
+        } else
+#endif
+        {
+          siprintf(msg, "RD TRK %d S %d", fdc_track, drv_side);
+          InfoMessage(msg);
+        }
       }
 
       if((fdc_cmd & 0xf0) == 0xf0) {
         iprintf("WRITE TRACK %d SIDE %d\n", fdc_track, drv_side);
+#ifdef HAVE_FDD_CACHE
+        if(scnt) {
+          unsigned char n = MIN(scnt, SECTOR_BUFFER_SIZE/512);
+          mist_memory_read_blocks(sector_buffer, n);
+          fdc_format_track(drv_sel-1, fdc_track, drv_side, sector_buffer, n * 512);
+        }
+#else
         siprintf(msg, "WR TRK %d S %d", fdc_track, drv_side);
         InfoMessage(msg);
+#endif
       }
 
       iprintf("scnt = %d\n", scnt);
@@ -726,24 +1074,19 @@ static void tos_load_cartridge_mist1() {
 
   // upload cartridge
   if(config.cart_img[0] && (f_open(&file, config.cart_img, FA_READ) == FR_OK)) {
-    int i;
     tos_debugf("%s:\n  size = %llu", config.cart_img, f_size(&file));
 
     int blocks = f_size(&file) / 512;
     tos_debugf("  blocks = %d", blocks);
 
     DISKLED_ON;
-    for(i=0;i<blocks;i++) {
-      FileReadBlock(&file, sector_buffer);
-
-      if(!(i&0x7f))
-       mist_memory_set_address(CART_BASE_ADDRESS+512*i, 128, 0);
-
-      mist_memory_write_block(sector_buffer);
-
-    }
+    unsigned long crc = mist_memory_upload(&file, CART_BASE_ADDRESS, blocks*512);
     DISKLED_OFF;
 
+    // verify with the debug switch
+    if(user_io_dip_switch1())
+      mist_memory_verify(CART_BASE_ADDRESS, blocks*512, crc);
+
     tos_debugf("%s uploaded", config.cart_img);
     f_close(&file);
     return;
@@ -858,7 +1201,6 @@ static void tos_upload_mist1(const char *name) {
 
   // upload and verify tos image
   if(f_open(&file, config.tos_img, FA_READ) == FR_OK) {
-    int i;
     char buffer[512];
     unsigned long time;
     unsigned long tos_base = TOS_BASE_ADDRESS_192k;
@@ -938,79 +1280,18 @@ static void tos_upload_mist1(const char *name) {
     time = GetRTTC();
     tos_debugf("Uploading ...");
 
-    for(i=0;i<blocks;i++) {
-      FileReadBlock(&file, buffer);
-
-      // copy first 8 bytes to address 0 as well
-      if(i == 0) {
-        mist_memory_set_address(0, 1, 0);
-
-        // write first 4 words
-        // (actually 8 words/16 bytes as the dma cannot transfer less)
-        mist_memory_write(buffer, 8);
-      }
-
-      // send address every 64k (128 sectors) as dma can max transfer
-      // 255 sectors at once
-
-      // set real tos base address
-      if((i & 0x7f) == 0)
-        mist_memory_set_address(tos_base+i*512, 128, 0);
-
-      mist_memory_write_block(buffer);
-    }
-
-#if 0
-    // verify
-    if(user_io_dip_switch1()) {
-      char b2[512];
-      int j, ok;
-
-      f_lseek(&file, 0);
-      for(i=0;i<blocks;i++) {
-
-        if(!(i&0x7f))
-          mist_memory_set_address(tos_base+i*512, 128, 1);
-
-        FileReadBlock(&file, b2);
-        mist_memory_read_block(buffer);
-
-        ok = -1;
-        for(j=0;j<512;j++)
-          if(buffer[j] != b2[j])
-            if(ok < 0)
-              ok = j;
-
-        if(ok >= 0) {
-          iprintf("Failed in block %d/%x (%x != %x)\n", i, ok, 0xff & buffer[ok], 0xff & b2[ok]);
-
-          hexdump(buffer, 512, 0);
-          puts("");
-          hexdump(b2, 512, 0);
-
-          // re-read to check whether read or write failed
-          bzero(buffer, 512);
-          mist_memory_set_address(tos_base+i*512, 1, 1);
-          mist_memory_read_block(buffer);
-
-          ok = -1;
-          for(j=0;j<512;j++)
-            if(buffer[j] != b2[j])
-              if(ok < 0)
-                ok = j;
+    // copy first 8 bytes to address 0 as well
+    // (actually 8 words/16 bytes as the dma cannot transfer less)
+    FileReadBlock(&file, buffer);
+    mist_memory_set_address(0, 1, 0);
+    mist_memory_write(buffer, 8);
+    f_lseek(&file, 0);
 
-          if(ok >= 0) {
-            iprintf("Re-read failed in block %d/%x (%x != %x)\n", i, ok, 0xff & buffer[ok], 0xff & b2[ok]);
-            hexdump(buffer, 512, 0);
-          } else
-            iprintf("Re-read ok!\n");
+    unsigned long crc = mist_memory_upload(&file, tos_base, blocks*512);
 
-            for(;;);
-        }
-      }
-      iprintf("Verify: %s\n", ok?"ok":"failed");
-    }
-#endif
+    // verify with the debug switch
+    if(user_io_dip_switch1() && !mist_memory_verify(tos_base, blocks*512, crc))
+      tos_write("Verify failed");
 
     time = GetRTTC() - time;
     tos_debugf("TOS.IMG uploaded in %lu ms (%d kB/s / %d kBit/s)", 
@@ -1185,6 +1466,9 @@ void tos_select_hdd_image(char i, const unsigned char *name) {
     disk_inserted[i+2] = 0;
   }
   config.system_ctrl &= ~(TOS_ACSI0_ENABLE<<i);
+#ifdef HAVE_ACSI_READAHEAD
+  acsi_ra.count = 0;
+#endif
 
   if(name && name[0]) {
     if (IDXOpen(&sd_image[i+2], name, FA_READ | FA_WRITE) == FR_OK) {
@@ -1218,11 +1502,43 @@ void tos_insert_disk(char i, const unsigned char *name) {
   fdd_image[i].sides = 1;
   fdd_image[i].spt = 0;
   disk_inserted[i] = 0;
+#ifdef HAVE_FDD_CACHE
+  fdc_cache.valid = 0;
+#endif
+#ifdef HAVE_STX
+  stx_close(i);
+#endif
+
+#ifdef HAVE_UNPACK
+  // compressed images are decoded into a scratch image for each drive
+  char scratch[] = "/FDA.TMP";
+  scratch[3] += i;
+#endif
 
   if (user_io_core_type() == CORE_TYPE_MIST2) {
     user_io_file_mount(NULL, i);
     tos_debugf("%c: insert %s\n", i+'A', name);
     if (name && name[0]) {
+#ifdef HAVE_STX
+        // the core runs its own FDC on the mounted image and asks for
+        // plain sector offsets, the ID fields can't be served through it
+        const char *ext = GetExtension(name);
+        if (ext && !strcasecmp(ext, "STX")) {
+          ErrorMessage("Pasti images need\nthe MIST core", 0);
+          return;
+        }
+#endif
+#ifdef HAVE_UNPACK
+        if (unpack_format(name)) {
+          char res = unpack_open(name, scratch, &fdd_image[i].file, ProgressBar);
+          if (res != UNPACK_OK) {
+            ErrorMessage("\n   Unpacking failed!\n", res);
+            return;
+          }
+          f_close(&fdd_image[i].file);
+          user_io_file_mount(scratch, i);
+        } else
+#endif
         user_io_file_mount(name, i);
         if (user_io_is_mounted(i)) {
           strncpy(fdd_image[i].name, name, sizeof(fdd_image[i].name));
@@ -1230,6 +1546,12 @@ void tos_insert_disk(char i, const unsigned char *name) {
           disk_inserted[i] = 1;
         }
         tos_update_sysctrl(config.system_ctrl);
+#ifdef HAVE_UNPACK
+        if (disk_inserted[i] && unpack_format(name)) {
+          mist_set_control(config.system_ctrl | wp_bit);
+          InfoMessage(UNPACK_WRPROT_MSG);
+        }
+#endif
     }
     return;
   }
@@ -1237,6 +1559,15 @@ void tos_insert_disk(char i, const unsigned char *name) {
   // no new disk given?
   if(!name || !name[0]) return;
 
+#ifdef HAVE_UNPACK
+  if (unpack_format(name)) {
+    char res = unpack_open(name, scratch, &fdd_image[i].file, ProgressBar);
+    if (res != UNPACK_OK) {
+      ErrorMessage("\n   Unpacking failed!\n", res);
+      return;
+    }
+  } else
+#endif
   if (f_open(&fdd_image[i].file, name, FA_READ | FA_WRITE) != FR_OK)
     if (f_open(&fdd_image[i].file, name, FA_READ) == FR_OK)
       mist_set_control(config.system_ctrl | wp_bit);
@@ -1249,33 +1580,48 @@ void tos_insert_disk(char i, const unsigned char *name) {
   // open floppy
   tos_debugf("%c: insert", i+'A');
 
-  // check image size and parameters
-
-  // check if image size suggests it's a two sided disk
-  if(f_size(&fdd_image[i].file) > 85*11*512)
-    fdd_image[i].sides = 2;
-
-  // try common sector/track values
-  int m, s, t;
-  for(m=0;m<=2;m++)  // multiplier for hd/ed disks
-    for(s=9;s<=12;s++)
-      for(t=78;t<=85;t++)
-        if(512*(1<<m)*s*t*fdd_image[i].sides == f_size(&fdd_image[i].file))
-          fdd_image[i].spt = s*(1<<m);
-
+#ifdef HAVE_STX
+  // Pasti images are read by the track, the image is write protected
+  if(stx_open(i, f_size(&fdd_image[i].file), tos_stx_read)) {
+    disk_inserted[i] = 1;
+    tos_update_sysctrl(config.system_ctrl);
+    mist_set_control(config.system_ctrl | wp_bit);
+    tos_debugf("%c: Pasti image", i+'A');
+    return;
+  }
+#endif
 
-  if(!fdd_image[i].spt) {
-    // read first sector from disk
-    if(MMC_Read(0, sector_buffer)) {
-      fdd_image[i].spt = sector_buffer[24] + 256 * sector_buffer[25];
-      fdd_image[i].sides = sector_buffer[26] + 256 * sector_buffer[27];
-    }
+  // check image size and parameters, images seen before aren't probed
+  // again (decoded images are rewritten, so they aren't remembered)
+  st_geometry_t geo;
+  unsigned long sclust = fdd_image[i].file.obj.sclust;
+#ifdef HAVE_UNPACK
+  if (unpack_format(name)) sclust = 0;
+#endif
+  if(!st_probe_get(fdd_image[i].file.obj.id, sclust, f_size(&fdd_image[i].file), &geo)) {
+    UINT br;
+
+    // the boot sector of the image, stx_open() has moved the file pointer
+    if(f_lseek(&fdd_image[i].file, 0) != FR_OK ||
+       f_read(&fdd_image[i].file, sector_buffer, 512, &br) != FR_OK || br != 512)
+      memset(sector_buffer, 0, 512);
+    f_lseek(&fdd_image[i].file, 0);
+    st_probe(sector_buffer, f_size(&fdd_image[i].file), &geo);
+    st_probe_put(fdd_image[i].file.obj.id, sclust, f_size(&fdd_image[i].file), &geo);
   }
+  fdd_image[i].spt = geo.spt;
+  fdd_image[i].sides = geo.sides;
 
   if(f_size(&fdd_image[i].file)) {
     disk_inserted[i] = 1;
     // restore state of write protect bit
     tos_update_sysctrl(config.system_ctrl);
+#ifdef HAVE_UNPACK
+    if (unpack_format(name)) {
+      mist_set_control(config.system_ctrl | wp_bit);
+      InfoMessage(UNPACK_WRPROT_MSG);
+    }
+#endif
     tos_debugf("%c: detected %d sides with %d sectors per track", 
       i+'A', fdd_image[i].sides, fdd_image[i].spt);
   }
@@ -1694,7 +2040,7 @@ static char tos_getmenuitem(uint8_t idx, char action, menu_item_t *item) {
 					if(tos_disk_is_inserted(idx>=7 ? idx-7 : idx))
 						tos_insert_disk(idx>=7 ? idx-7 : idx, NULL);
 					else
-						SelectFileNG("ST ", SCAN_DIR | SCAN_LFN, tos_file_selected, 0);
+						SelectFileNG(TOS_FDD_EXT, SCAN_DIR | SCAN_LFN, tos_file_selected, 0);
 					break;
 				case 2:
 				case 3:
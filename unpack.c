@@ -0,0 +1,905 @@
+// unpack.c
+// Compressed floppy images decoded into a raw image when they are inserted
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "unpack.h"
+#include "inflate.h"
+#include "crc32.h"
+#ifndef UNPACK_TEST
+#include "hardware.h"
+#include "fat_compat.h"
+#endif
+
+static unpack_read_t  unpack_read;
+static unpack_write_t unpack_write;
+static unsigned long  unpack_file_size;
+static unsigned long  unpack_total;
+
+// buffered sequential reading of the compressed image, the buffer is also
+// the input buffer of the deflate decoder
+static unsigned char  unpack_in[2048];
+static unsigned long  unpack_pos;     // of the first byte in unpack_in
+static unsigned int   unpack_len, unpack_idx;
+
+static int unpack_getc(void) {
+  if (unpack_idx == unpack_len) {
+    unpack_pos += unpack_len;
+    unpack_idx = 0;
+    unpack_len = 0;
+    if (unpack_pos >= unpack_file_size) return -1;
+    unpack_len = unpack_read(unpack_pos, unpack_in, sizeof(unpack_in));
+    if (!unpack_len) return -1;
+  }
+  return unpack_in[unpack_idx++];
+}
+
+static long unpack_get16(void) {
+  int hi = unpack_getc();
+  int lo = unpack_getc();
+  return (hi < 0 || lo < 0) ? -1 : hi << 8 | lo;
+}
+
+// reads up to len bytes, what's left in the buffer first
+static unsigned int unpack_read_data(unsigned char *buf, unsigned int len) {
+  unsigned int n = unpack_len - unpack_idx;
+  unsigned long pos;
+
+  if (n) {
+    if (n > len) n = len;
+    memmove(buf, unpack_in + unpack_idx, n);
+    unpack_idx += n;
+    return n;
+  }
+  pos = unpack_pos + unpack_len;
+  if (pos >= unpack_file_size) return 0;
+  if (len > unpack_file_size - pos) len = unpack_file_size - pos;
+  n = unpack_read(pos, buf, len);
+  // continue behind the data in the next unpack_getc()
+  unpack_pos = pos + n;
+  unpack_len = unpack_idx = 0;
+  return n;
+}
+
+static char unpack_read_all(unsigned char *buf, unsigned int len) {
+  while (len) {
+    unsigned int n = unpack_read_data(buf, len);
+    if (!n) return 0;
+    buf += n;
+    len -= n;
+  }
+  return 1;
+}
+
+// ------------------------------------------------------------------------
+// ADZ, ST.GZ: gzip (RFC 1952)
+
+static unsigned long gz_crc;
+static unsigned long gz_out;
+
+static unsigned int gz_read(unsigned char *buf, unsigned int len) {
+  return unpack_read_data(buf, len);
+}
+
+static char gz_write(const unsigned char *buf, unsigned int len) {
+  if (gz_out + len > unpack_total) return 0;
+  gz_crc = CalculateCRC32(gz_crc, buf, len);
+  if (!unpack_write(gz_out, buf, len)) return 0;
+  gz_out += len;
+  return 1;
+}
+
+static char unpack_gz(void) {
+  unsigned char trailer[8];
+  int flags;
+  char res;
+
+  if (unpack_file_size < 18 || unpack_getc() != 0x1f || unpack_getc() != 0x8b || unpack_getc() != 8)
+    return UNPACK_ERR_FORMAT;
+  flags = unpack_getc();
+  for (int i = 0; i < 6; i++) unpack_getc(); // time, extra flags, os
+  if (flags & 4) { // extra field
+    long len = unpack_getc();
+    len |= unpack_getc() << 8;
+    while (len-- > 0) unpack_getc();
+  }
+  if (flags & 8) while (unpack_getc() > 0);  // name
+  if (flags & 16) while (unpack_getc() > 0); // comment
+  if (flags & 2) unpack_get16();             // header crc
+  if (unpack_pos + unpack_idx > unpack_file_size - 8) return UNPACK_ERR_FORMAT;
+
+  // the decoder reads ahead, so the trailer is read first
+  if (unpack_read(unpack_file_size - 8, trailer, 8) != 8) return UNPACK_ERR_READ;
+  unpack_total = trailer[4] | trailer[5] << 8 | trailer[6] << 16 | (unsigned long)trailer[7] << 24;
+
+  gz_crc = -1;
+  gz_out = 0;
+  res = inflate_stream(inflate_window, unpack_in, sizeof(unpack_in), gz_read, gz_write);
+  if (res == INFLATE_ERR_READ) return UNPACK_ERR_READ;
+  if (res == INFLATE_ERR_WRITE) return UNPACK_ERR_WRITE;
+  if (res != INFLATE_OK) return UNPACK_ERR_FORMAT;
+  if (gz_out != unpack_total ||
+      (~gz_crc & 0xffffffff) != (trailer[0] | trailer[1] << 8 | trailer[2] << 16 | (unsigned long)trailer[3] << 24))
+    return UNPACK_ERR_CRC;
+  return UNPACK_OK;
+}
+
+// ------------------------------------------------------------------------
+// MSA: Magic Shadow Archiver, run length encoded Atari ST tracks
+
+static char unpack_msa(void) {
+  long spt, sides, start, end, len;
+  unsigned int track_size, out;
+  int c;
+
+  if (unpack_get16() != 0x0e0f) return UNPACK_ERR_FORMAT;
+  spt = unpack_get16();
+  sides = unpack_get16() + 1;
+  start = unpack_get16();
+  end = unpack_get16();
+  if (spt < 1 || spt > UNPACK_MSA_SPT || sides < 1 || sides > 2 || start < 0 || end < start || end > 255)
+    return UNPACK_ERR_FORMAT;
+
+  track_size = spt * 512;
+  unpack_total = (end + 1) * sides * track_size;
+
+  for (long track = start * sides; track < (end + 1) * sides; track++) {
+    if ((len = unpack_get16()) < 0) return UNPACK_ERR_READ;
+    if (len == track_size) {
+      if (!unpack_read_all(inflate_window, track_size)) return UNPACK_ERR_READ;
+    } else {
+      for (out = 0; len > 0; ) {
+        if ((c = unpack_getc()) < 0) return UNPACK_ERR_READ;
+        len--;
+        if (c == 0xe5) { // marker, data, count
+          long n;
+          if ((c = unpack_getc()) < 0 || (n = unpack_get16()) < 0) return UNPACK_ERR_READ;
+          len -= 3;
+          if (out + n > track_size) return UNPACK_ERR_FORMAT;
+          memset(inflate_window + out, c, n);
+          out += n;
+        } else {
+          if (out == track_size) return UNPACK_ERR_FORMAT;
+          inflate_window[out++] = c;
+        }
+      }
+      if (len < 0 || out != track_size) return UNPACK_ERR_FORMAT;
+    }
+    if (!unpack_write(track * track_size, inflate_window, track_size)) return UNPACK_ERR_WRITE;
+  }
+  return UNPACK_OK;
+}
+
+// ------------------------------------------------------------------------
+// DMS: Disk Masher System archives of Amiga disks, a track (both sides of a
+// cylinder) at a time. Decoding follows xDMS, but no track is held in memory:
+// the packed data is read through the bit stream below and the decoded bytes
+// pass the RLE stage into a block buffer. The history and the Huffman tables
+// are kept in the inflate window.
+
+#define DMS_HEADER       56
+#define DMS_TRACK_HEADER 20
+
+#define DMS_NONE   0
+#define DMS_SIMPLE 1
+#define DMS_QUICK  2
+#define DMS_MEDIUM 3
+#define DMS_DEEP   4
+#define DMS_HEAVY1 5
+#define DMS_HEAVY2 6
+
+// DEEP: adaptive Huffman coding of LZHUF
+#define DMS_F         60
+#define DMS_THRESHOLD 2
+#define DMS_N_CHAR    (256 - DMS_THRESHOLD + DMS_F)
+#define DMS_T         (DMS_N_CHAR * 2 - 1)
+#define DMS_R         (DMS_T - 1)
+#define DMS_MAX_FREQ  0x8000
+
+// HEAVY: static Huffman coding of LHA
+#define DMS_NC     510
+#define DMS_NPT    20
+#define DMS_OFFSET 253
+
+typedef unsigned short __attribute__ ((may_alias)) dms_u16;
+
+// The history is shared by all modes. DEEP and HEAVY tables are kept across
+// tracks too, an archive uses only one of them, so they share the space.
+typedef struct {
+  unsigned char text[0x4000];
+  union {
+    struct {
+      dms_u16 freq[DMS_T + 1];
+      dms_u16 prnt[DMS_T + DMS_N_CHAR];
+      dms_u16 son[DMS_T];
+    } deep;
+    struct {
+      dms_u16 c_table[4096];
+      dms_u16 pt_table[256];
+      dms_u16 left[2 * DMS_NC - 1];
+      dms_u16 right[2 * DMS_NC - 1];
+      unsigned char c_len[DMS_NC];
+      unsigned char pt_len[DMS_NPT];
+    } heavy;
+  } u;
+  unsigned char out[2048];  // decoded data on its way to the image
+} __attribute__ ((may_alias)) dms_work_t;
+
+typedef char dms_work_size_check[(sizeof(dms_work_t) <= INFLATE_WINDOW) ? 1 : -1];
+#define dms ((dms_work_t*)inflate_window)
+
+// upper 6 bits of the MEDIUM and DEEP offsets and the length of their code,
+// indexed by the next 8 bits of the stream
+static const unsigned char dms_d_code[256] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+  4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 5, 5,
+  6, 6, 6, 6, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 7,
+  8, 8, 8, 8, 8, 8, 8, 8, 9, 9, 9, 9, 9, 9, 9, 9,
+  10, 10, 10, 10, 10, 10, 10, 10, 11, 11, 11, 11, 11, 11, 11, 11,
+  12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15,
+  16, 16, 16, 16, 17, 17, 17, 17, 18, 18, 18, 18, 19, 19, 19, 19,
+  20, 20, 20, 20, 21, 21, 21, 21, 22, 22, 22, 22, 23, 23, 23, 23,
+  24, 24, 25, 25, 26, 26, 27, 27, 28, 28, 29, 29, 30, 30, 31, 31,
+  32, 32, 33, 33, 34, 34, 35, 35, 36, 36, 37, 37, 38, 38, 39, 39,
+  40, 40, 41, 41, 42, 42, 43, 43, 44, 44, 45, 45, 46, 46, 47, 47,
+  48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63,
+};
+
+static const unsigned char dms_d_len[256] = {
+  3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+  3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+  5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+  5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+  5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+  6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+  6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+  6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+  8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+};
+
+static unsigned short dms_quick_loc, dms_medium_loc, dms_deep_loc, dms_heavy_loc;
+static unsigned short dms_lastlen;   // HEAVY offset repeated by the last code
+static char           dms_deep_init; // DEEP tables need to be set up
+static char           dms_tables;    // mode owning the table space, DMS_DEEP or DMS_HEAVY1
+
+// MSB first bit stream of the packed track, past its end zeros are fed
+static unsigned long  dms_bitbuf;
+static unsigned int   dms_bitcnt;
+static unsigned int   dms_left;      // packed bytes not read yet
+static unsigned short dms_crc;
+static char           dms_err;
+
+// decoded track: RLE state, block buffer and checksum
+static char           dms_rle;
+static unsigned char  dms_rle_state, dms_rle_c;
+static unsigned int   dms_rle_n;
+static unsigned long  dms_pos;
+static unsigned int   dms_done, dms_size, dms_fill;
+static unsigned short dms_sum;
+
+// CRC-16 of the headers and the packed data
+static unsigned short dms_crc_byte(unsigned short crc, unsigned char c) {
+  crc ^= c;
+  for (int i = 0; i < 8; i++)
+    crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+  return crc;
+}
+
+static unsigned short dms_crc_block(const unsigned char *p, unsigned int len) {
+  unsigned short crc = 0;
+
+  while (len--) crc = dms_crc_byte(crc, *p++);
+  return crc;
+}
+
+static unsigned char dms_byte(void) {
+  int c;
+
+  if (!dms_left) return 0;
+  dms_left--;
+  if ((c = unpack_getc()) < 0) {
+    dms_err = UNPACK_ERR_READ;
+    return 0;
+  }
+  dms_crc = dms_crc_byte(dms_crc, c);
+  return c;
+}
+
+#define dms_bits(n) ((unsigned int)(dms_bitbuf >> (dms_bitcnt - (n))))
+
+static void dms_drop(unsigned int n) {
+  dms_bitcnt -= n;
+  dms_bitbuf &= (1UL << dms_bitcnt) - 1;
+  while (dms_bitcnt < 16) {
+    dms_bitbuf = dms_bitbuf << 8 | dms_byte();
+    dms_bitcnt += 8;
+  }
+}
+
+static void dms_flush(void) {
+  if (dms_fill && !dms_err) {
+    if (!unpack_write(dms_pos, dms->out, dms_fill)) dms_err = UNPACK_ERR_WRITE;
+    dms_pos += dms_fill;
+  }
+  dms_fill = 0;
+}
+
+static void dms_emit(unsigned char c, unsigned int n) {
+  if (n > dms_size - dms_done) {
+    dms_err = UNPACK_ERR_FORMAT;
+    return;
+  }
+  dms_done += n;
+  while (n--) {
+    dms->out[dms_fill++] = c;
+    dms_sum += c;
+    if (dms_fill == sizeof(dms->out)) dms_flush();
+  }
+}
+
+// RLE: 0x90 count byte, a count of 0 for 0x90 itself and 0xff for a
+// following 16 bit count. Bytes after the end of the track are ignored.
+static void dms_put(unsigned char c) {
+  if (dms_done == dms_size) return;
+  if (!dms_rle) {
+    dms_emit(c, 1);
+    return;
+  }
+  switch (dms_rle_state) {
+    case 0:
+      if (c == 0x90) dms_rle_state = 1;
+      else dms_emit(c, 1);
+      break;
+    case 1:
+      if (c) {
+        dms_rle_n = c;
+        dms_rle_state = 2;
+      } else {
+        dms_emit(0x90, 1);
+        dms_rle_state = 0;
+      }
+      break;
+    case 2:
+      dms_rle_c = c;
+      if (dms_rle_n == 0xff) {
+        dms_rle_state = 3;
+      } else {
+        dms_emit(c, dms_rle_n);
+        dms_rle_state = 0;
+      }
+      break;
+    case 3:
+      dms_rle_n = c << 8;
+      dms_rle_state = 4;
+      break;
+    default:
+      dms_emit(dms_rle_c, dms_rle_n | c);
+      dms_rle_state = 0;
+      break;
+  }
+}
+
+static void dms_lz_put(unsigned short *loc, unsigned int mask, unsigned char c) {
+  dms->text[(*loc)++ & mask] = c;
+  dms_put(c);
+}
+
+static void dms_lz_copy(unsigned short *loc, unsigned int mask, unsigned short i, unsigned int len) {
+  while (len--) dms_lz_put(loc, mask, dms->text[i++ & mask]);
+}
+
+static void dms_reset(void) {
+  dms_quick_loc = 251;
+  dms_medium_loc = 0x3fbe;
+  dms_heavy_loc = 0;
+  dms_deep_loc = 0x3fc4;
+  dms_deep_init = 1;
+  memset(dms->text, 0, 0x3fc8);
+}
+
+// 8 bits, the upper ones by the code table
+static unsigned int dms_offset(unsigned int c) {
+  unsigned int u = dms_d_len[c];
+
+  c = ((c << u) | dms_bits(u)) & 0xff;
+  dms_drop(u);
+  return c;
+}
+
+// QUICK: LZ77 with a 256 byte history
+static void dms_quick(unsigned int size) {
+  for (unsigned int n = 0; n < size && !dms_err; ) {
+    if (dms_bits(1)) {
+      dms_drop(1);
+      dms_lz_put(&dms_quick_loc, 0xff, dms_bits(8));
+      dms_drop(8);
+      n++;
+    } else {
+      unsigned int len, i;
+      dms_drop(1);
+      len = dms_bits(2) + 2;
+      dms_drop(2);
+      i = dms_quick_loc - dms_bits(8) - 1;
+      dms_drop(8);
+      dms_lz_copy(&dms_quick_loc, 0xff, i, len);
+      n += len;
+    }
+  }
+  dms_quick_loc = (dms_quick_loc + 5) & 0xff;
+}
+
+// MEDIUM: LZ77 with a 16K history, lengths and offsets by a fixed code
+static void dms_medium(unsigned int size) {
+  for (unsigned int n = 0; n < size && !dms_err; ) {
+    if (dms_bits(1)) {
+      dms_drop(1);
+      dms_lz_put(&dms_medium_loc, 0x3fff, dms_bits(8));
+      dms_drop(8);
+      n++;
+    } else {
+      unsigned int c, len;
+      dms_drop(1);
+      c = dms_bits(8);
+      dms_drop(8);
+      len = dms_d_code[c] + 3;
+      c = dms_offset(c);
+      c = dms_d_code[c] << 8 | dms_offset(c);
+      dms_lz_copy(&dms_medium_loc, 0x3fff, dms_medium_loc - c - 1, len);
+      n += len;
+    }
+  }
+  dms_medium_loc = (dms_medium_loc + 66) & 0x3fff;
+}
+
+static void dms_deep_setup(void) {
+  dms_u16 *freq = dms->u.deep.freq, *son = dms->u.deep.son, *prnt = dms->u.deep.prnt;
+  unsigned int i, j;
+
+  for (i = 0; i < DMS_N_CHAR; i++) {
+    freq[i] = 1;
+    son[i] = i + DMS_T;
+    prnt[i + DMS_T] = i;
+  }
+  for (i = 0, j = DMS_N_CHAR; j <= DMS_R; i += 2, j++) {
+    freq[j] = freq[i] + freq[i + 1];
+    son[j] = i;
+    prnt[i] = prnt[i + 1] = j;
+  }
+  freq[DMS_T] = 0xffff;
+  prnt[DMS_R] = 0;
+}
+
+// halves the frequencies and rebuilds the tree
+static void dms_deep_reconst(void) {
+  dms_u16 *freq = dms->u.deep.freq, *son = dms->u.deep.son, *prnt = dms->u.deep.prnt;
+  unsigned int i, j, k, f;
+
+  for (i = 0, j = 0; i < DMS_T; i++) {
+    if (son[i] >= DMS_T) {
+      freq[j] = (freq[i] + 1) / 2;
+      son[j] = son[i];
+      j++;
+    }
+  }
+  for (i = 0, j = DMS_N_CHAR; j < DMS_T; i += 2, j++) {
+    f = freq[j] = freq[i] + freq[i + 1];
+    for (k = j - 1; f < freq[k]; k--);
+    k++;
+    memmove(&freq[k + 1], &freq[k], (j - k) * sizeof(freq[0]));
+    freq[k] = f;
+    memmove(&son[k + 1], &son[k], (j - k) * sizeof(son[0]));
+    son[k] = i;
+  }
+  for (i = 0; i < DMS_T; i++) {
+    if ((k = son[i]) >= DMS_T) prnt[k] = i;
+    else prnt[k] = prnt[k + 1] = i;
+  }
+}
+
+static void dms_deep_update(unsigned int c) {
+  dms_u16 *freq = dms->u.deep.freq, *son = dms->u.deep.son, *prnt = dms->u.deep.prnt;
+  unsigned int i, j, k, l;
+
+  if (freq[DMS_R] == DMS_MAX_FREQ) dms_deep_reconst();
+  c = prnt[c + DMS_T];
+  do {
+    k = ++freq[c];
+    // swap with the last node of the same frequency to keep them sorted
+    if (k > freq[l = c + 1]) {
+      while (k > freq[++l]);
+      l--;
+      freq[c] = freq[l];
+      freq[l] = k;
+      i = son[c];
+      prnt[i] = l;
+      if (i < DMS_T) prnt[i + 1] = l;
+      j = son[l];
+      son[l] = i;
+      prnt[j] = c;
+      if (j < DMS_T) prnt[j + 1] = c;
+      son[c] = j;
+      c = l;
+    }
+  } while ((c = prnt[c]) != 0);
+}
+
+// DEEP: LZ77 with a 16K history, characters and lengths by an adaptive
+// Huffman code, offsets like MEDIUM
+static char dms_deep(unsigned int size) {
+  if (dms_deep_init) {
+    dms_deep_setup();
+    dms_deep_init = 0;
+    dms_tables = DMS_DEEP;
+  } else if (dms_tables != DMS_DEEP) {
+    return 0;
+  }
+
+  for (unsigned int n = 0; n < size && !dms_err; ) {
+    unsigned int c = dms->u.deep.son[DMS_R];
+
+    while (c < DMS_T) {
+      c = dms->u.deep.son[c + dms_bits(1)];
+      dms_drop(1);
+    }
+    c -= DMS_T;
+    dms_deep_update(c);
+    if (c < 256) {
+      dms_lz_put(&dms_deep_loc, 0x3fff, c);
+      n++;
+    } else {
+      unsigned int len = c - 255 + DMS_THRESHOLD;
+      c = dms_bits(8);
+      dms_drop(8);
+      c = dms_d_code[c] << 8 | dms_offset(c);
+      dms_lz_copy(&dms_deep_loc, 0x3fff, dms_deep_loc - c - 1, len);
+      n += len;
+    }
+  }
+  dms_deep_loc = (dms_deep_loc + 60) & 0x3fff;
+  return 1;
+}
+
+// lookup table of bits bits for the canonical Huffman code with the given
+// lengths, longer codes continue in the left/right tree
+static char dms_make_table(unsigned int nchar, const unsigned char *bitlen, unsigned int bits, dms_u16 *table) {
+  unsigned long count[17], weight[17], start[18];
+  unsigned int i, k, len, avail = nchar, shift = 16 - bits;
+  dms_u16 *p;
+
+  for (i = 0; i <= 16; i++) count[i] = 0;
+  for (i = 0; i < nchar; i++) {
+    if (bitlen[i] > 16) return 0;
+    count[bitlen[i]]++;
+  }
+  start[1] = 0;
+  for (i = 1; i <= 16; i++) start[i + 1] = start[i] + (count[i] << (16 - i));
+  if (start[17] != 0x10000) return 0;  // incomplete or oversubscribed
+
+  for (i = 1; i <= bits; i++) {
+    start[i] >>= shift;
+    weight[i] = 1UL << (bits - i);
+  }
+  for (; i <= 16; i++) weight[i] = 1UL << (16 - i);
+  for (i = start[bits + 1] >> shift; i < (1U << bits); i++) table[i] = 0;
+
+  for (unsigned int ch = 0; ch < nchar; ch++) {
+    if (!(len = bitlen[ch])) continue;
+    if (len <= bits) {
+      for (i = start[len]; i < start[len] + weight[len]; i++) table[i] = ch;
+    } else {
+      k = start[len];
+      p = &table[k >> shift];
+      for (i = len - bits; i; i--) {
+        if (!*p) {
+          dms->u.heavy.left[avail] = dms->u.heavy.right[avail] = 0;
+          *p = avail++;
+        }
+        p = (k & (0x8000 >> bits)) ? &dms->u.heavy.right[*p] : &dms->u.heavy.left[*p];
+        k <<= 1;
+      }
+      *p = ch;
+    }
+    start[len] += weight[len];
+  }
+  return 1;
+}
+
+// code lengths of lbits bits, a count of 0 is followed by the only symbol
+static char dms_read_tree(unsigned int nchar, unsigned int nbits, unsigned int lbits,
+                          unsigned char *len, unsigned int bits, dms_u16 *table) {
+  unsigned int i, n = dms_bits(nbits);
+
+  dms_drop(nbits);
+  if (n > nchar) return 0;
+  if (!n) {
+    n = dms_bits(nbits);
+    dms_drop(nbits);
+    if (n >= nchar) return 0;
+    memset(len, 0, nchar);
+    for (i = 0; i < (1U << bits); i++) table[i] = n;
+    return 1;
+  }
+  for (i = 0; i < n; i++) {
+    len[i] = dms_bits(lbits);
+    dms_drop(lbits);
+  }
+  for (; i < nchar; i++) len[i] = 0;
+  return dms_make_table(nchar, len, bits, table);
+}
+
+static unsigned int dms_heavy_code(const dms_u16 *table, const unsigned char *len, unsigned int bits, unsigned int n) {
+  unsigned int j = table[dms_bits(bits)];
+
+  if (j < n) {
+    dms_drop(len[j]);
+  } else {
+    unsigned int i, m = 0x8000;
+    dms_drop(bits);
+    i = dms_bits(16);
+    do {
+      j = (i & m) ? dms->u.heavy.right[j] : dms->u.heavy.left[j];
+      m >>= 1;
+    } while (j >= n);
+    dms_drop(len[j] - bits);
+  }
+  return j;
+}
+
+// HEAVY: LZ77 with a 4K (HEAVY1) or 8K (HEAVY2) history and static Huffman
+// codes, which come with the track or are kept from the one before
+static char dms_heavy(unsigned int size, unsigned char flags) {
+  unsigned int mask = (flags & 8) ? 0x1fff : 0x0fff;
+  unsigned int np = (flags & 8) ? 15 : 14;
+
+  if (flags & 2) {
+    dms_tables = DMS_HEAVY1;
+    if (!dms_read_tree(DMS_NC, 9, 5, dms->u.heavy.c_len, 12, dms->u.heavy.c_table) ||
+        !dms_read_tree(np, 5, 4, dms->u.heavy.pt_len, 8, dms->u.heavy.pt_table)) {
+      dms_tables = 0;
+      return 0;
+    }
+  } else if (dms_tables != DMS_HEAVY1) {
+    return 0;
+  }
+
+  for (unsigned int n = 0; n < size && !dms_err; ) {
+    unsigned int c = dms_heavy_code(dms->u.heavy.c_table, dms->u.heavy.c_len, 12, DMS_NC);
+
+    if (c < 256) {
+      dms_lz_put(&dms_heavy_loc, mask, c);
+      n++;
+    } else {
+      unsigned int len = c - DMS_OFFSET;
+      unsigned int j = dms_heavy_code(dms->u.heavy.pt_table, dms->u.heavy.pt_len, 8, np);
+
+      // the last code repeats the offset before, code j > 0 is followed by
+      // the j - 1 lower bits of the offset
+      if (j != np - 1) {
+        if (j > 1) {
+          unsigned int b = j - 1;
+          j = dms_bits(b) | (1U << b);
+          dms_drop(b);
+        }
+        dms_lastlen = j;
+      }
+      dms_lz_copy(&dms_heavy_loc, mask, dms_heavy_loc - dms_lastlen - 1, len);
+      n += len;
+    }
+  }
+  return 1;
+}
+
+static char unpack_dms(void) {
+  unsigned char header[DMS_HEADER];
+  unsigned int number, pklen1, pklen2, unpklen, last;
+  unsigned short sum, dcrc;
+  unsigned char flags, cmode;
+  char ok;
+
+  if (!unpack_read_all(header, DMS_HEADER) || memcmp(header, "DMS!", 4)) return UNPACK_ERR_FORMAT;
+  if (dms_crc_block(header + 4, DMS_HEADER - 6) != (header[54] << 8 | header[55])) return UNPACK_ERR_CRC;
+  if (header[11] & 2) return UNPACK_ERR_MODE;  // encrypted
+  last = header[18] << 8 | header[19];
+  unpack_total = (last + 1) * 11 * 512 * 2;
+
+  memset(dms->text, 0, sizeof(dms->text));
+  dms_reset();
+  dms_tables = 0;
+  dms_lastlen = 0;
+
+  while (unpack_read_all(header, DMS_TRACK_HEADER)) {
+    if (header[0] != 'T' || header[1] != 'R') return UNPACK_ERR_FORMAT;
+    if (dms_crc_block(header, DMS_TRACK_HEADER - 2) != (header[18] << 8 | header[19])) return UNPACK_ERR_CRC;
+    number = header[2] << 8 | header[3];
+    pklen1 = header[6] << 8 | header[7];
+    pklen2 = header[8] << 8 | header[9];
+    unpklen = header[10] << 8 | header[11];
+    flags = header[12];
+    cmode = header[13];
+    sum = header[14] << 8 | header[15];
+    dcrc = header[16] << 8 | header[17];
+
+    dms_left = pklen1;
+    dms_crc = 0;
+    dms_err = UNPACK_OK;
+
+    // banners and FILE_ID.DIZ are skipped
+    if (number >= 80 || unpklen <= 2048) {
+      while (dms_left && !dms_err) dms_byte();
+      if (dms_err) return dms_err;
+      continue;
+    }
+
+    dms_bitbuf = 0;
+    dms_bitcnt = 0;
+    dms_rle = 1;
+    dms_rle_state = 0;
+    dms_pos = (unsigned long)number * unpklen;
+    dms_size = unpklen;
+    dms_done = dms_fill = 0;
+    dms_sum = 0;
+    ok = 1;
+
+    switch (cmode) {
+      case DMS_NONE:
+        dms_rle = 0;
+        // fall through
+      case DMS_SIMPLE:
+        while (dms_done < dms_size && dms_left && !dms_err) dms_put(dms_byte());
+        break;
+      case DMS_QUICK:
+        dms_drop(0);
+        dms_quick(pklen2);
+        break;
+      case DMS_MEDIUM:
+        dms_drop(0);
+        dms_medium(pklen2);
+        break;
+      case DMS_DEEP:
+        dms_drop(0);
+        ok = dms_deep(pklen2);
+        break;
+      case DMS_HEAVY1:
+      case DMS_HEAVY2:
+        dms_rle = flags & 4;
+        dms_drop(0);
+        ok = dms_heavy(pklen2, cmode == DMS_HEAVY1 ? flags & 7 : flags | 8);
+        break;
+      default:
+        iprintf("DMS: unsupported compression %d\n", cmode);
+        return UNPACK_ERR_MODE;
+    }
+
+    // the CRC covers all of the packed data, a bad one is reported before
+    // any decoding error it caused
+    while (dms_left && dms_err != UNPACK_ERR_READ) dms_byte();
+    if (dms_err == UNPACK_ERR_READ) return UNPACK_ERR_READ;
+    if (dms_crc != dcrc) return UNPACK_ERR_CRC;
+    if (!ok) iprintf("DMS: bad tables in track %d\n", number);
+    if (!dms_err && (!ok || dms_done != dms_size)) dms_err = UNPACK_ERR_FORMAT;
+    dms_flush();
+    if (dms_err) return dms_err;
+    if (dms_sum != sum) return UNPACK_ERR_CRC;
+    if (!(flags & 1)) dms_reset();
+
+    if ((number + 1) * unpklen > unpack_total) unpack_total = (number + 1) * unpklen;
+  }
+  return unpack_pos + unpack_idx >= unpack_file_size ? UNPACK_OK : UNPACK_ERR_READ;
+}
+
+// ------------------------------------------------------------------------
+
+char unpack_format(const char *name) {
+  const char *ext = strrchr(name, '.');
+
+  if (!ext) return UNPACK_NONE;
+  ext++;
+  if (!strcasecmp(ext, "ADZ") || !strcasecmp(ext, "GZ")) return UNPACK_GZ;
+  if (!strcasecmp(ext, "MSA")) return UNPACK_MSA;
+  if (!strcasecmp(ext, "DMS")) return UNPACK_DMS;
+  return UNPACK_NONE;
+}
+
+unsigned long unpack_size(void) {
+  return unpack_total;
+}
+
+char unpack_image(char format, unsigned long size, unpack_read_t read, unpack_write_t write) {
+  char res;
+
+  unpack_read = read;
+  unpack_write = write;
+  unpack_file_size = size;
+  unpack_total = 0;
+  unpack_pos = 0;
+  unpack_len = unpack_idx = 0;
+
+  switch (format) {
+    case UNPACK_GZ:  res = unpack_gz(); break;
+    case UNPACK_MSA: res = unpack_msa(); break;
+    case UNPACK_DMS: res = unpack_dms(); break;
+    default:         res = UNPACK_ERR_FORMAT; break;
+  }
+  if (res != UNPACK_OK) iprintf("Unpack: error %d\n", res);
+  return res;
+}
+
+#ifndef UNPACK_TEST
+static FIL               unpack_src;
+static FIL               *unpack_dst;
+static unpack_progress_t unpack_progress;
+
+static unsigned int unpack_file_read(unsigned long pos, unsigned char *buf, unsigned int len) {
+  UINT br;
+
+  DISKLED_ON
+  if (f_lseek(&unpack_src, pos) != FR_OK || f_read(&unpack_src, buf, len, &br) != FR_OK) br = 0;
+  DISKLED_OFF
+  return br;
+}
+
+// extends the scratch image with zeros up to pos, for missing tracks
+static char unpack_file_fill(unsigned long pos) {
+  UINT bw;
+
+  memset(sector_buffer, 0, SECTOR_BUFFER_SIZE);
+  while (f_size(unpack_dst) < pos) {
+    unsigned long len = pos - f_size(unpack_dst);
+    if (len > SECTOR_BUFFER_SIZE) len = SECTOR_BUFFER_SIZE;
+    if (f_lseek(unpack_dst, f_size(unpack_dst)) != FR_OK ||
+        f_write(unpack_dst, sector_buffer, len, &bw) != FR_OK || bw != len)
+      return 0;
+  }
+  return 1;
+}
+
+static char unpack_file_write(unsigned long pos, const unsigned char *buf, unsigned int len) {
+  UINT bw;
+  char res;
+
+  DISKLED_ON
+  res = unpack_file_fill(pos) && f_lseek(unpack_dst, pos) == FR_OK &&
+        f_write(unpack_dst, buf, len, &bw) == FR_OK && bw == len;
+  DISKLED_OFF
+  if (res && unpack_progress) unpack_progress(pos + len, unpack_total);
+  return res;
+}
+
+char unpack_open(const char *name, const char *scratch, FIL *file, unpack_progress_t progress) {
+  unsigned long time = GetRTTC();
+  char res;
+
+  if (f_open(&unpack_src, name, FA_READ) != FR_OK) return UNPACK_ERR_READ;
+  if (f_open(file, scratch, FA_READ | FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+    f_close(&unpack_src);
+    return UNPACK_ERR_WRITE;
+  }
+
+  iprintf("Unpack: %s -> %s\n", name, scratch);
+  unpack_dst = file;
+  unpack_progress = progress;
+  if (progress) progress(0, 0);
+  res = unpack_image(unpack_format(name), f_size(&unpack_src), unpack_file_read, unpack_file_write);
+  if (res == UNPACK_OK && (!unpack_file_fill(unpack_total) || f_sync(file) != FR_OK))
+    res = UNPACK_ERR_WRITE;
+  f_close(&unpack_src);
+  f_close(file);
+
+  if (res != UNPACK_OK) return res;
+  if (f_open(file, scratch, FA_READ) != FR_OK) return UNPACK_ERR_READ;
+  iprintf("Unpack: %lu bytes in %lu ms\n", unpack_total, GetRTTC() - time);
+  return UNPACK_OK;
+}
+#endif
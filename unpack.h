@@ -0,0 +1,48 @@
+#ifndef UNPACK_H
+#define UNPACK_H
+
+// Compressed floppy images (ADZ, ST.GZ, MSA, DMS). The image is decoded
+// once when it's inserted into a scratch image on the card, which is then
+// used like a raw ADF/ST image. The scratch image is rewritten by the next
+// insert and the compressed image is never modified, so decoded images are
+// write protected: writes would be lost.
+
+#define UNPACK_NONE 0  // raw image
+#define UNPACK_GZ   1  // ADZ, ST.GZ
+#define UNPACK_MSA  2
+#define UNPACK_DMS  3
+
+#define UNPACK_OK          0
+#define UNPACK_ERR_READ    1
+#define UNPACK_ERR_FORMAT  2
+#define UNPACK_ERR_WRITE   3
+#define UNPACK_ERR_CRC     4
+#define UNPACK_ERR_MODE    5  // encrypted DMS archive or unknown compression
+
+#define UNPACK_MSA_SPT   36     // max. sectors per track of MSA images
+
+// reads len bytes of the compressed image from pos, returns the bytes read
+typedef unsigned int (*unpack_read_t)(unsigned long pos, unsigned char *buf, unsigned int len);
+// writes a part of the decoded image at pos, returns 0 to abort
+typedef char (*unpack_write_t)(unsigned long pos, const unsigned char *buf, unsigned int len);
+
+// format by the file name extension
+char unpack_format(const char *name);
+// decode a compressed image of the given size
+char unpack_image(char format, unsigned long size, unpack_read_t read, unpack_write_t write);
+// size of the decoded image, known after the header has been parsed
+unsigned long unpack_size(void);
+
+#ifndef UNPACK_TEST
+#include "FatFs/ff.h"
+
+typedef void (*unpack_progress_t)(unsigned long done, unsigned long total);
+
+#define UNPACK_WRPROT_MSG "\n Unpacked images are\n  write protected\n"
+
+// decode name into the scratch image, which is left open read only in file.
+// progress is called with done = 0 first, then as the image is written.
+char unpack_open(const char *name, const char *scratch, FIL *file, unpack_progress_t progress);
+#endif
+
+#endif // UNPACK_H
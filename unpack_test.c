@@ -0,0 +1,845 @@
+// unpack_test.c
+// Host side test of the compressed floppy image decoders (unpack.c)
+//
+// unpacktest [image reference ...]
+//   packs generated disk images as ADZ (with zlib), MSA and DMS (with the
+//   reference encoders below, all DMS compression modes), decodes them and
+//   compares the result with the original. Pairs of a compressed image and
+//   its raw image given on the command line are checked the same way.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "unpack.h"
+
+#define ADF_SIZE (80 * 2 * 11 * 512)
+
+static const unsigned char *in_data;
+static size_t in_size;
+static unsigned char *out_data;
+static size_t out_size, out_max;
+
+static unsigned int test_read(unsigned long pos, unsigned char *buf, unsigned int len) {
+    // hand out short reads to exercise the buffering
+    if (len > 700) len = 700;
+    if (pos >= in_size) return 0;
+    if (len > in_size - pos) len = in_size - pos;
+    memcpy(buf, in_data + pos, len);
+    return len;
+}
+
+static char test_write(unsigned long pos, const unsigned char *buf, unsigned int len) {
+    if (pos + len > out_max) return 0;
+    memcpy(out_data + pos, buf, len);
+    if (pos + len > out_size) out_size = pos + len;
+    return 1;
+}
+
+static char decode(char format, const unsigned char *data, size_t size, unsigned char *out, size_t max) {
+    in_data = data;
+    in_size = size;
+    out_data = out;
+    out_size = 0;
+    out_max = max;
+    memset(out, 0, max);
+    return unpack_image(format, size, test_read, test_write);
+}
+
+static int check(const char *name, char format, const unsigned char *packed, size_t psize,
+                 const unsigned char *raw, size_t size) {
+    unsigned char *out = malloc(size + 65536);
+    char res = decode(format, packed, psize, out, size + 65536);
+    int ret = 0;
+
+    if (res != UNPACK_OK || unpack_size() != size || out_size > size || memcmp(out, raw, size)) {
+        printf("FAIL %s: result %d, %lu of %zu bytes\n", name, res, unpack_size(), size);
+        ret = 1;
+    } else {
+        printf("PASS %s: %zu -> %zu bytes\n", name, psize, size);
+    }
+    free(out);
+    return ret;
+}
+
+// expect < 0 accepts any error
+static int check_error(const char *name, char format, const unsigned char *packed, size_t psize, int expect) {
+    unsigned char *out = malloc(ADF_SIZE * 2);
+    char res = decode(format, packed, psize, out, ADF_SIZE * 2);
+
+    free(out);
+    if (expect < 0 ? res == UNPACK_OK : res != expect) {
+        printf("FAIL %s: result %d, expected %d\n", name, res, expect);
+        return 1;
+    }
+    printf("PASS %s: error %d\n", name, res);
+    return 0;
+}
+
+// disk like data: empty sectors, runs, text and random bytes
+static void gen_disk(unsigned char *buf, size_t size, unsigned int seed) {
+    static const char *words[] = { "Workbench ", "DOS ", "track ", "sector ", "\x90\xe5", "\n" };
+
+    srand(seed);
+    for (size_t pos = 0; pos < size; pos += 512) {
+        unsigned char *p = buf + pos;
+        switch (rand() % 5) {
+            case 0: memset(p, 0, 512); break;
+            case 1: memset(p, rand() % 3 ? 0xe5 : 0x90, 512); break;
+            case 2:
+                for (int i = 0; i < 512; i++) p[i] = rand();
+                break;
+            case 3:
+                for (int i = 0; i < 512; ) {
+                    int n = 1 + rand() % 300, c = rand();
+                    for (; n && i < 512; n--) p[i++] = c;
+                }
+                break;
+            default:
+                for (int i = 0; i < 512; ) {
+                    const char *w = words[rand() % 6];
+                    for (; *w && i < 512; ) p[i++] = *w++;
+                }
+                break;
+        }
+    }
+}
+
+// ------------------------------------------------------------------------
+// gzip
+
+static size_t pack_gz(const unsigned char *data, size_t size, unsigned char *dst, size_t dsize, int name) {
+    gz_header head;
+    z_stream z;
+
+    memset(&z, 0, sizeof(z));
+    memset(&head, 0, sizeof(head));
+    head.name = (unsigned char*)"disk.adf";
+    head.comment = (unsigned char*)"test image";
+    head.hcrc = 1;
+    if (deflateInit2(&z, 9, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY) != Z_OK) return 0;
+    if (name) deflateSetHeader(&z, &head);
+    z.next_in = (unsigned char*)data;
+    z.avail_in = size;
+    z.next_out = dst;
+    z.avail_out = dsize;
+    if (deflate(&z, Z_FINISH) != Z_STREAM_END) size = 0;
+    else size = z.total_out;
+    deflateEnd(&z);
+    return size;
+}
+
+static int test_gz(const unsigned char *disk, size_t size) {
+    size_t dsize = compressBound(size) + 256;
+    unsigned char *gz = malloc(dsize);
+    int failed = 0;
+    size_t len;
+
+    len = pack_gz(disk, size, gz, dsize, 0);
+    failed += check("adz", UNPACK_GZ, gz, len, disk, size);
+    len = pack_gz(disk, size, gz, dsize, 1);
+    failed += check("adz with name", UNPACK_GZ, gz, len, disk, size);
+
+    failed += check_error("adz truncated", UNPACK_GZ, gz, len / 2, -1);
+    gz[len - 6] ^= 1; // crc
+    failed += check_error("adz crc", UNPACK_GZ, gz, len, UNPACK_ERR_CRC);
+    gz[len - 6] ^= 1;
+    gz[len - 3] ^= 1; // size
+    failed += check_error("adz size", UNPACK_GZ, gz, len, -1);
+    gz[0] = 0;
+    failed += check_error("adz magic", UNPACK_GZ, gz, len, UNPACK_ERR_FORMAT);
+    free(gz);
+    return failed;
+}
+
+// ------------------------------------------------------------------------
+// MSA
+
+static unsigned char *put16(unsigned char *p, unsigned int v) {
+    *p++ = v >> 8;
+    *p++ = v;
+    return p;
+}
+
+static size_t pack_msa(const unsigned char *disk, int spt, int sides, int start, int end, unsigned char *dst) {
+    unsigned char *p = dst;
+    unsigned int track_size = spt * 512;
+
+    p = put16(p, 0x0e0f);
+    p = put16(p, spt);
+    p = put16(p, sides - 1);
+    p = put16(p, start);
+    p = put16(p, end);
+
+    for (int track = start * sides; track < (end + 1) * sides; track++) {
+        const unsigned char *t = disk + track * track_size;
+        unsigned char *len = p, *data = p + 2;
+        unsigned char *q = data;
+
+        for (unsigned int i = 0; i < track_size; ) {
+            unsigned int n = 1;
+            while (i + n < track_size && t[i + n] == t[i]) n++;
+            if (n >= 4 || t[i] == 0xe5) {
+                *q++ = 0xe5;
+                *q++ = t[i];
+                q = put16(q, n);
+                i += n;
+            } else {
+                *q++ = t[i++];
+            }
+        }
+        if (q - data >= track_size) { // store uncompressed
+            memcpy(data, t, track_size);
+            q = data + track_size;
+        }
+        put16(len, q - data);
+        p = q;
+    }
+    return p - dst;
+}
+
+static int test_msa(const unsigned char *disk) {
+    static const struct { int spt, sides, start, end; } geo[] = {
+        { 9, 2, 0, 79 }, { 9, 1, 0, 79 }, { 10, 2, 0, 81 }, { 11, 2, 0, 79 }, { 18, 2, 0, 79 }, { 9, 2, 3, 79 },
+    };
+    unsigned char *msa = malloc(ADF_SIZE * 3);
+    unsigned char *ref = malloc(ADF_SIZE * 2);
+    char name[64];
+    int failed = 0;
+
+    for (int i = 0; i < sizeof(geo) / sizeof(geo[0]); i++) {
+        size_t size = (geo[i].end + 1) * geo[i].sides * geo[i].spt * 512;
+        size_t first = geo[i].start * geo[i].sides * geo[i].spt * 512;
+        size_t len = pack_msa(disk, geo[i].spt, geo[i].sides, geo[i].start, geo[i].end, msa);
+
+        // tracks before the first one are left empty
+        memset(ref, 0, first);
+        memcpy(ref + first, disk + first, size - first);
+        sprintf(name, "msa %d/%d/%d-%d", geo[i].spt, geo[i].sides, geo[i].start, geo[i].end);
+        failed += check(name, UNPACK_MSA, msa, len, ref, size);
+        if (i == 0) {
+            failed += check_error("msa truncated", UNPACK_MSA, msa, len - 100, UNPACK_ERR_READ);
+            msa[1] = 0;
+            failed += check_error("msa magic", UNPACK_MSA, msa, len, UNPACK_ERR_FORMAT);
+        }
+    }
+    free(msa);
+    free(ref);
+    return failed;
+}
+
+// ------------------------------------------------------------------------
+// DMS
+//
+// Reference encoders for all compression modes. They keep the same state
+// as the decoder (history, positions, DEEP tree, HEAVY tables) and pick
+// their matches from a few offsets, which is enough to use every code.
+
+#define DMS_TRACK (2 * 11 * 512)
+
+static unsigned short crc16(const unsigned char *p, unsigned int len) {
+    unsigned short crc = 0;
+
+    while (len--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+    }
+    return crc;
+}
+
+static size_t dms_rle(const unsigned char *in, size_t len, unsigned char *out) {
+    unsigned char *p = out;
+
+    for (size_t i = 0; i < len; ) {
+        size_t n = 1;
+        while (i + n < len && n < 65535 && in[i + n] == in[i]) n++;
+        if (n >= 4) {
+            *p++ = 0x90;
+            if (n < 255) {
+                *p++ = n;
+                *p++ = in[i];
+            } else {
+                *p++ = 0xff;
+                *p++ = in[i];
+                p = put16(p, n);
+            }
+            i += n;
+        } else if (in[i] == 0x90) {
+            *p++ = 0x90;
+            *p++ = 0;
+            i++;
+        } else {
+            *p++ = in[i++];
+        }
+    }
+    return p - out;
+}
+
+// MSB first bit stream
+static unsigned char *bit_ptr, *bit_base;
+static unsigned long bit_buf;
+static int bit_cnt;
+
+static void bit_start(unsigned char *p) {
+    bit_ptr = bit_base = p;
+    bit_buf = 0;
+    bit_cnt = 0;
+}
+
+static void bit_put(unsigned int v, int n) {
+    bit_buf = bit_buf << n | (v & ((1UL << n) - 1));
+    bit_cnt += n;
+    while (bit_cnt >= 8) {
+        bit_cnt -= 8;
+        *bit_ptr++ = bit_buf >> bit_cnt;
+    }
+}
+
+static size_t bit_end(void) {
+    if (bit_cnt) bit_put(0, 8 - bit_cnt);
+    return bit_ptr - bit_base;
+}
+
+// state shared with the decoder
+static unsigned char  enc_text[0x4000];
+static unsigned short quick_loc, medium_loc, deep_loc, heavy_loc, heavy_last;
+static int            deep_init;
+
+static void enc_reset(void) {
+    quick_loc = 251;
+    medium_loc = 0x3fbe;
+    heavy_loc = 0;
+    deep_loc = 0x3fc4;
+    deep_init = 1;
+    memset(enc_text, 0, 0x3fc8);
+}
+
+static void lz_store(unsigned short *loc, unsigned int mask, const unsigned char *p, unsigned int n) {
+    while (n--) enc_text[(*loc)++ & mask] = *p++;
+}
+
+// longest match of in[pos] at offsets 0-255 and the multiples of 512 - 1,
+// the offset counts back from the byte before loc like in the decoder
+static unsigned int find_match(const unsigned char *in, size_t pos, size_t len, unsigned short loc,
+                               unsigned int mask, unsigned int maxoff, unsigned int maxlen, unsigned int *off) {
+    unsigned int best = 0;
+
+    if (maxlen > len - pos) maxlen = len - pos;
+    for (unsigned int k = 0; k < 256 + 32; k++) {
+        unsigned int d = k < 256 ? k : (k - 255) * 512 - 1;
+        unsigned short i = loc - d - 1;
+        unsigned int n = 0;
+
+        if (d > maxoff) break;
+        // the copy overlaps with its own output for short offsets
+        while (n < maxlen && (n <= d ? enc_text[(unsigned short)(i + n) & mask] : in[pos + n - d - 1]) == in[pos + n])
+            n++;
+        if (n > best) {
+            best = n;
+            *off = d;
+        }
+    }
+    return best;
+}
+
+static void quick_pack(const unsigned char *in, size_t len) {
+    for (size_t pos = 0; pos < len; ) {
+        unsigned int off, n = find_match(in, pos, len, quick_loc, 0xff, 255, 5, &off);
+
+        if (n >= 2) {
+            bit_put(0, 1);
+            bit_put(n - 2, 2);
+            bit_put(off, 8);
+        } else {
+            n = 1;
+            bit_put(1, 1);
+            bit_put(in[pos], 8);
+        }
+        lz_store(&quick_loc, 0xff, in + pos, n);
+        pos += n;
+    }
+    quick_loc = (quick_loc + 5) & 0xff;
+}
+
+// the 6 bit values of MEDIUM and DEEP: 3 bit code for 0, 4 bits for 1-3,
+// 5 bits for 4-11, 6 bits for 12-23, 7 bits for 24-47, 8 bits for 48-63
+static unsigned char d_code[256], d_len[256];
+
+static void d_tables(void) {
+    static const int count[] = { 1, 3, 8, 12, 24, 16 };
+    int i = 0, v = 0;
+
+    for (int bits = 3; bits <= 8; bits++)
+        for (int c = 0; c < count[bits - 3]; c++, v++)
+            for (int k = 0; k < 1 << (8 - bits); k++) {
+                d_code[i] = v;
+                d_len[i++] = bits;
+            }
+}
+
+static void put_d(unsigned int v) {
+    int i = 0;
+
+    while (d_code[i] != v) i++;
+    bit_put(i >> (8 - d_len[i]), d_len[i]);
+}
+
+static void medium_pack(const unsigned char *in, size_t len) {
+    for (size_t pos = 0; pos < len; ) {
+        unsigned int off, n = find_match(in, pos, len, medium_loc, 0x3fff, 0x3fff, 66, &off);
+
+        if (n >= 3) {
+            bit_put(0, 1);
+            put_d(n - 3);
+            put_d(off >> 8);
+            bit_put(off, 8);
+        } else {
+            n = 1;
+            bit_put(1, 1);
+            bit_put(in[pos], 8);
+        }
+        lz_store(&medium_loc, 0x3fff, in + pos, n);
+        pos += n;
+    }
+    medium_loc = (medium_loc + 66) & 0x3fff;
+}
+
+// DEEP: the adaptive tree of LZHUF
+#define N_CHAR (256 - 2 + 60)
+#define T      (N_CHAR * 2 - 1)
+#define R      (T - 1)
+
+static unsigned short freq[T + 1], prnt[T + N_CHAR], son[T];
+
+static void deep_start(void) {
+    int i, j;
+
+    for (i = 0; i < N_CHAR; i++) {
+        freq[i] = 1;
+        son[i] = i + T;
+        prnt[i + T] = i;
+    }
+    for (i = 0, j = N_CHAR; j <= R; i += 2, j++) {
+        freq[j] = freq[i] + freq[i + 1];
+        son[j] = i;
+        prnt[i] = prnt[i + 1] = j;
+    }
+    freq[T] = 0xffff;
+    prnt[R] = 0;
+}
+
+static void deep_reconst(void) {
+    int i, j, k;
+    unsigned int f;
+
+    for (i = 0, j = 0; i < T; i++)
+        if (son[i] >= T) {
+            freq[j] = (freq[i] + 1) / 2;
+            son[j++] = son[i];
+        }
+    for (i = 0, j = N_CHAR; j < T; i += 2, j++) {
+        f = freq[j] = freq[i] + freq[i + 1];
+        for (k = j - 1; f < freq[k]; k--);
+        k++;
+        memmove(&freq[k + 1], &freq[k], (j - k) * 2);
+        freq[k] = f;
+        memmove(&son[k + 1], &son[k], (j - k) * 2);
+        son[k] = i;
+    }
+    for (i = 0; i < T; i++) {
+        if ((k = son[i]) >= T) prnt[k] = i;
+        else prnt[k] = prnt[k + 1] = i;
+    }
+}
+
+static void deep_update(int c) {
+    int i, j, l;
+    unsigned int k;
+
+    if (freq[R] == 0x8000) deep_reconst();
+    c = prnt[c + T];
+    do {
+        k = ++freq[c];
+        if (k > freq[l = c + 1]) {
+            while (k > freq[++l]);
+            l--;
+            freq[c] = freq[l];
+            freq[l] = k;
+            i = son[c];
+            prnt[i] = l;
+            if (i < T) prnt[i + 1] = l;
+            j = son[l];
+            son[l] = i;
+            prnt[j] = c;
+            if (j < T) prnt[j + 1] = c;
+            son[c] = j;
+            c = l;
+        }
+    } while ((c = prnt[c]) != 0);
+}
+
+// the path from the root, a node at an odd index is the second son
+static void deep_put(int c) {
+    static unsigned char path[T];
+    int n = 0;
+
+    for (int k = prnt[c + T]; k != R; k = prnt[k]) path[n++] = k & 1;
+    while (n) bit_put(path[--n], 1);
+    deep_update(c);
+}
+
+static void deep_pack(const unsigned char *in, size_t len) {
+    if (deep_init) deep_start();
+    deep_init = 0;
+
+    for (size_t pos = 0; pos < len; ) {
+        unsigned int off, n = find_match(in, pos, len, deep_loc, 0x3fff, 0x3fff, 60, &off);
+
+        if (n >= 3) {
+            deep_put(n + 253);
+            put_d(off >> 8);
+            bit_put(off, 8);
+        } else {
+            n = 1;
+            deep_put(in[pos]);
+        }
+        lz_store(&deep_loc, 0x3fff, in + pos, n);
+        pos += n;
+    }
+    deep_loc = (deep_loc + 60) & 0x3fff;
+}
+
+// HEAVY: static Huffman codes of at most max bits, returns the number of
+// symbols used. The frequencies are halved until the code fits.
+static int huff_lengths(const unsigned long *count, int n, unsigned char *len, int max) {
+    unsigned long f[512], w[1024];
+    int up[1024], used = 0, maxlen;
+    char done[1024];
+
+    for (int i = 0; i < n; i++) {
+        f[i] = count[i];
+        len[i] = 0;
+        if (f[i]) used++;
+    }
+    if (used < 2) return used;
+    for (;;) {
+        int nodes = n;
+
+        for (int i = 0; i < n; i++) {
+            w[i] = f[i];
+            done[i] = !f[i];
+            up[i] = -1;
+        }
+        for (;;) {
+            int a = -1, b = -1;
+            for (int i = 0; i < nodes; i++) {
+                if (done[i]) continue;
+                if (a < 0 || w[i] < w[a]) {
+                    b = a;
+                    a = i;
+                } else if (b < 0 || w[i] < w[b]) {
+                    b = i;
+                }
+            }
+            if (b < 0) break;
+            w[nodes] = w[a] + w[b];
+            done[nodes] = 0;
+            up[nodes] = -1;
+            up[a] = up[b] = nodes++;
+            done[a] = done[b] = 1;
+        }
+        maxlen = 0;
+        for (int i = 0; i < n; i++) {
+            len[i] = 0;
+            if (f[i]) for (int k = i; up[k] >= 0; k = up[k]) len[i]++;
+            if (len[i] > maxlen) maxlen = len[i];
+        }
+        if (maxlen <= max) return used;
+        for (int i = 0; i < n; i++) if (f[i]) f[i] = (f[i] + 1) / 2;
+    }
+}
+
+// canonical codes, shorter codes first and then by symbol
+static void huff_codes(const unsigned char *len, int n, unsigned int *code) {
+    unsigned int count[17] = { 0 }, next[17];
+    unsigned int c = 0;
+
+    for (int i = 0; i < n; i++) count[len[i]]++;
+    count[0] = 0;
+    for (int bits = 1; bits <= 16; bits++) {
+        c = (c + count[bits - 1]) << 1;
+        next[bits] = c;
+    }
+    for (int i = 0; i < n; i++) if (len[i]) code[i] = next[len[i]]++;
+}
+
+static void put_tree(const unsigned char *len, int n, int nbits, int lbits, int used, int only) {
+    if (used < 2) {
+        bit_put(0, nbits);
+        bit_put(only, nbits);
+        return;
+    }
+    while (!len[n - 1]) n--;
+    bit_put(n, nbits);
+    for (int i = 0; i < n; i++) bit_put(len[i], lbits);
+}
+
+static unsigned char heavy_c_len[510], heavy_pt_len[16];
+static unsigned int  heavy_c_code[510], heavy_pt_code[16];
+
+// with flags & 2 the codes are sent, made for all symbols when full is set
+// so that the next tracks can keep them
+static void heavy_pack(const unsigned char *in, size_t len, int cmode, int flags, int full, int literals) {
+    static unsigned short sym[3 * DMS_TRACK], pcode[3 * DMS_TRACK], off[3 * DMS_TRACK];
+    unsigned int mask = cmode == 6 ? 0x1fff : 0x0fff, np = cmode == 6 ? 15 : 14;
+    unsigned long cf[510] = { 0 }, pf[16] = { 0 };
+    size_t ntok = 0;
+
+    for (size_t pos = 0; pos < len; ntok++) {
+        unsigned int d, n = literals ? 0 : find_match(in, pos, len, heavy_loc, mask, mask, 256, &d);
+
+        if (n >= 3) {
+            unsigned int j = np - 1;  // repeats the last offset
+            if (d != heavy_last) {
+                for (j = 0; d >> j; j++);
+                heavy_last = d;
+            }
+            sym[ntok] = n + 253;
+            pcode[ntok] = j;
+            off[ntok] = d;
+            pf[j]++;
+        } else {
+            n = 1;
+            sym[ntok] = in[pos];
+        }
+        cf[sym[ntok]]++;
+        lz_store(&heavy_loc, mask, in + pos, n);
+        pos += n;
+    }
+
+    if (flags & 2) {
+        int cused, pused, conly = 0, ponly = 0;
+        if (full) {
+            for (int i = 0; i < 510; i++) cf[i]++;
+            for (int i = 0; i < np; i++) pf[i]++;
+        }
+        for (int i = 0; i < 510; i++) if (cf[i]) conly = i;
+        for (int i = 0; i < np; i++) if (pf[i]) ponly = i;
+        cused = huff_lengths(cf, 510, heavy_c_len, 16);
+        pused = huff_lengths(pf, np, heavy_pt_len, 15);
+        huff_codes(heavy_c_len, 510, heavy_c_code);
+        huff_codes(heavy_pt_len, np, heavy_pt_code);
+        put_tree(heavy_c_len, 510, 9, 5, cused, conly);
+        put_tree(heavy_pt_len, np, 5, 4, pused, ponly);
+    }
+
+    for (size_t i = 0; i < ntok; i++) {
+        bit_put(heavy_c_code[sym[i]], heavy_c_len[sym[i]]);
+        if (sym[i] >= 256) {
+            unsigned int j = pcode[i];
+            bit_put(heavy_pt_code[j], heavy_pt_len[j]);
+            if (j > 1 && j != np - 1) bit_put(off[i], j - 1);
+        }
+    }
+}
+
+static unsigned char *dms_track(unsigned char *p, unsigned int number, const unsigned char *data,
+                                unsigned int len, int cmode, int flags, int full, int literals) {
+    static unsigned char rle[3 * DMS_TRACK];
+    unsigned char *h = p, *packed = p + 20;
+    unsigned int pklen1, pklen2 = 0;
+    unsigned short sum = 0;
+
+    for (unsigned int i = 0; i < len; i++) sum += data[i];
+    bit_start(packed);
+    switch (cmode) {
+        case 0:
+            memcpy(packed, data, len);
+            pklen1 = len;
+            break;
+        case 1:
+            pklen1 = pklen2 = dms_rle(data, len, packed);
+            break;
+        case 5:
+        case 6:
+            if (flags & 4) {
+                pklen2 = dms_rle(data, len, rle);
+                heavy_pack(rle, pklen2, cmode, flags, full, literals);
+            } else {
+                pklen2 = len;
+                heavy_pack(data, len, cmode, flags, full, literals);
+            }
+            pklen1 = bit_end();
+            break;
+        default:
+            pklen2 = dms_rle(data, len, rle);
+            if (cmode == 2) quick_pack(rle, pklen2);
+            else if (cmode == 3) medium_pack(rle, pklen2);
+            else deep_pack(rle, pklen2);
+            pklen1 = bit_end();
+            break;
+    }
+    // banners don't touch the state of the decoder
+    if (!(flags & 1) && number < 80 && len > 2048) enc_reset();
+
+    memset(h, 0, 20);
+    h[0] = 'T';
+    h[1] = 'R';
+    put16(h + 2, number);
+    put16(h + 6, pklen1);
+    put16(h + 8, pklen2);
+    put16(h + 10, len);
+    h[12] = flags;
+    h[13] = cmode;
+    put16(h + 14, sum);
+    put16(h + 16, crc16(packed, pklen1));
+    put16(h + 18, crc16(h, 18));
+    return packed + pklen1;
+}
+
+// mode 7 mixes NONE to DEEP, mode 8 NONE to MEDIUM and HEAVY2
+static size_t pack_dms(const unsigned char *disk, int mode, unsigned char *dst) {
+    static const char banner[] = "banner of the packer, not part of the disk";
+    unsigned char *p = dst + 56;
+    int full = 0;
+
+    memset(dst, 0, 56);
+    memcpy(dst, "DMS!", 4);
+    put16(dst + 18, 79);
+    put16(dst + 50, mode);
+    put16(dst + 54, crc16(dst + 4, 50));
+
+    memset(enc_text, 0, sizeof(enc_text));
+    enc_reset();
+    heavy_last = 0;
+    p = dms_track(p, 0xffff, (const unsigned char*)banner, sizeof(banner), 1, 0, 0, 0);
+    for (int track = 0; track < 80; track++) {
+        const unsigned char *t = disk + track * DMS_TRACK;
+        int cmode = mode < 7 ? mode : mode == 7 ? track % 5 : (track % 5 == 4 ? 6 : track % 5);
+        // reset the state now and then, DEEP keeps it to halve its frequencies
+        int flags = track % 5 == 3 && mode != 4 ? 0 : 1;
+
+        if (cmode >= 5) {
+            // HEAVY: codes for all symbols, kept codes, codes only for the
+            // used ones, without RLE and a single literal
+            if (track == 5 && mode != 8) {
+                p = dms_track(p, track, t, DMS_TRACK, cmode, 1 | 2, 0, 1);
+                full = 0;
+            } else if (track % 4 == 1 && full) {
+                p = dms_track(p, track, t, DMS_TRACK, cmode, flags | 4, 0, 0);
+            } else {
+                full = track % 4 == 0 || mode == 8;
+                flags |= track % 4 == 2 ? 2 : 2 | 4;
+                p = dms_track(p, track, t, DMS_TRACK, cmode, flags, full, 0);
+            }
+        } else {
+            p = dms_track(p, track, t, DMS_TRACK, cmode, flags, 0, 0);
+        }
+    }
+    p = dms_track(p, 80, (const unsigned char*)banner, sizeof(banner), 0, 0, 0, 0);
+    return p - dst;
+}
+
+static int test_dms(const unsigned char *disk) {
+    static const char *names[] = {
+        "dms none", "dms simple", "dms quick", "dms medium", "dms deep", "dms heavy1", "dms heavy2",
+        "dms mixed", "dms mixed heavy2",
+    };
+    unsigned char *img = malloc(ADF_SIZE), *dms = malloc(ADF_SIZE * 3), *p;
+    int failed = 0;
+    size_t len;
+
+    // a track of one byte for the 16 bit RLE count and single HEAVY codes
+    memcpy(img, disk, ADF_SIZE);
+    memset(img + 5 * DMS_TRACK, 0x4e, DMS_TRACK);
+    d_tables();
+
+    for (int mode = 0; mode < 9; mode++) {
+        len = pack_dms(img, mode, dms);
+        failed += check(names[mode], UNPACK_DMS, dms, len, img, ADF_SIZE);
+    }
+
+    // corrupted data, caught by the CRC of the packed track
+    len = pack_dms(img, 4, dms);
+    dms[len / 2] ^= 0x10;
+    failed += check_error("dms data", UNPACK_DMS, dms, len, UNPACK_ERR_CRC);
+    dms[len / 2] ^= 0x10;
+    dms[56 + 4] ^= 1;
+    failed += check_error("dms track header", UNPACK_DMS, dms, len, UNPACK_ERR_CRC);
+    dms[56 + 4] ^= 1;
+    dms[20] ^= 1;
+    failed += check_error("dms header", UNPACK_DMS, dms, len, UNPACK_ERR_CRC);
+    dms[20] ^= 1;
+    failed += check_error("dms truncated", UNPACK_DMS, dms, len - 100, UNPACK_ERR_READ);
+
+    dms[11] |= 2;
+    put16(dms + 54, crc16(dms + 4, 50));
+    failed += check_error("dms encrypted", UNPACK_DMS, dms, len, UNPACK_ERR_MODE);
+    dms[11] &= ~2;
+    put16(dms + 54, crc16(dms + 4, 50));
+
+    // first track after the banner
+    p = dms + 56 + 20 + (dms[56 + 6] << 8 | dms[56 + 7]);
+    p[13] = 7;
+    put16(p + 18, crc16(p, 18));
+    failed += check_error("dms unknown mode", UNPACK_DMS, dms, len, UNPACK_ERR_MODE);
+
+    // HEAVY codes kept from a track before the first one
+    len = pack_dms(img, 5, dms);
+    p = dms + 56 + 20 + (dms[56 + 6] << 8 | dms[56 + 7]);
+    p[12] &= ~2;
+    put16(p + 18, crc16(p, 18));
+    failed += check_error("dms heavy without codes", UNPACK_DMS, dms, len, UNPACK_ERR_FORMAT);
+
+    free(img);
+    free(dms);
+    return failed;
+}
+
+// ------------------------------------------------------------------------
+
+static unsigned char *load(const char *name, size_t *size) {
+    FILE *f = fopen(name, "rb");
+    unsigned char *buf;
+
+    if (!f) return 0;
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(*size + 1);
+    if (fread(buf, 1, *size, f) != *size) *size = 0;
+    fclose(f);
+    return buf;
+}
+
+int main(int argc, char **argv) {
+    unsigned char *disk = malloc(ADF_SIZE * 2);
+    int failed = 0;
+
+    gen_disk(disk, ADF_SIZE * 2, 1);
+    failed += test_gz(disk, ADF_SIZE);
+    failed += test_gz(disk, 2 * 82 * 10 * 512);
+    failed += test_msa(disk);
+    failed += test_dms(disk);
+    free(disk);
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        size_t psize, size;
+        unsigned char *packed = load(argv[i], &psize);
+        unsigned char *raw = load(argv[i + 1], &size);
+
+        if (!packed || !raw || !unpack_format(argv[i])) {
+            printf("FAIL %s: cannot open\n", argv[i]);
+            failed++;
+        } else {
+            failed += check(argv[i], unpack_format(argv[i]), packed, psize, raw, size);
+        }
+        free(packed);
+        free(raw);
+    }
+
+    if (failed) printf("%d test(s) failed\n", failed);
+    return failed ? 1 : 0;
+}
@@ -26,6 +26,7 @@
 #include "errors.h"
 #include "arc_file.h"
 #include "cue_parser.h"
+#include "cd_cache.h"
 #include "utils.h"
 #include "settings.h"
 #include "usb/joymapping.h"
@@ -797,6 +798,10 @@ char user_io_cue_mount(const unsigned char *name, unsigned char index) {
 	if (name) {
 		res = cue_parse(name, &sd_image[index]);
 	}
+	if (toc.valid && (core_features & FEAT_CDSUB))
+		cd_sub_mount(name);
+	else
+		cd_sub_umount();
 #ifdef HAVE_PSX
 	if (core_features & FEAT_PSX) psx_mount_cd(name);
 #endif
@@ -823,6 +828,18 @@ static inline char sd_index(unsigned char index) {
 		return index;
 }
 
+// read sectors of an image slot, the Archie reads through the image cache
+static void sd_image_read(unsigned char index, uint32_t lba, uint8_t blksz, char *buf) {
+#ifdef HAVE_IDX_CACHE
+	if (core_type == CORE_TYPE_ARCHIE) {
+		IDXCacheRead(&sd_image[index], lba<<blksz, buf, 1<<blksz);
+		return;
+	}
+#endif
+	IDXSeek(&sd_image[index], lba<<blksz);
+	IDXRead(&sd_image[index], buf, blksz);
+}
+
 char user_io_is_mounted(unsigned char index) {
 	return sd_image[sd_index(index)].valid;
 }
@@ -1582,6 +1599,9 @@ void user_io_poll() {
 						if(((f_size(&sd_image[sd_index(drive_index)].file)-1) >> (9+blksz)) >= lba) {
 							IDXSeek(&sd_image[sd_index(drive_index)], (lba<<blksz));
 							IDXWrite(&sd_image[sd_index(drive_index)], sector_buffer, blksz);
+#ifdef HAVE_IDX_CACHE
+							IDXCacheWrite(&sd_image[sd_index(drive_index)], lba<<blksz, sector_buffer, 1<<blksz);
+#endif
 						}
 					} else if (!drive_index && !umounted)
 						disk_write(fs.pdrv, sector_buffer, lba, 1<<blksz);
@@ -1614,8 +1634,7 @@ void user_io_poll() {
 					DISKLED_ON;
 					if(sd_image[sd_index(drive_index)].valid) {
 						if(((f_size(&sd_image[sd_index(drive_index)].file)-1) >> (9+blksz)) >= lba) {
-							IDXSeek(&sd_image[sd_index(drive_index)], lba<<blksz);
-							IDXRead(&sd_image[sd_index(drive_index)], cache_buffer, blksz);
+							sd_image_read(sd_index(drive_index), lba, blksz, cache_buffer);
 						}
 					} else if (!drive_index && !umounted) {
 						// sector read
@@ -1644,8 +1663,7 @@ void user_io_poll() {
 				if(sd_image[sd_index(drive_index)].valid) {
 					// but check if it would overrun on the file
 					if(((f_size(&sd_image[sd_index(drive_index)].file)-1) >> (9+blksz)) > lba) {
-						IDXSeek(&sd_image[sd_index(drive_index)], (lba+1)<<blksz);
-						IDXRead(&sd_image[sd_index(drive_index)], cache_buffer, blksz);
+						sd_image_read(sd_index(drive_index), lba+1, blksz, cache_buffer);
 						buffer_lba = lba + 1;
 					}
 				} else {
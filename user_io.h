@@ -106,6 +106,8 @@
 #define FEAT_BIGOSD     0x2000 // 16 line tall OSD
 #define FEAT_HDMI       0x4000 // HDMI output
 #define FEAT_PSX        0x8000 // PSX-specific CD image handling
+#define FEAT_CDSUB      0x10000 // CD sectors are followed by 96 bytes subchannel data
+#define FEAT_DIO_CAPS   0x20000 // core reports its ROM upload speed (DIO_FILE_TX_CAPS)
 
 #define JOY_RIGHT       0x01
 #define JOY_LEFT        0x02
@@ -0,0 +1,253 @@
+// zip.c
+// Zip archive index and streaming of the members
+
+#include <stdio.h>
+#include <string.h>
+#include "zip.h"
+#include "inflate.h"
+#include "hardware.h"
+#include "fat_compat.h"
+#include "crc32.h"
+#include "utils.h"
+
+#define ZIP_LOCAL_SIG   0x04034b50
+#define ZIP_CENTRAL_SIG 0x02014b50
+#define ZIP_END_SIG     0x06054b50
+
+#define ZIP_LOCAL_SIZE   30
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_END_SIZE     22
+
+static FIL          zip_file;
+static char         zip_opened = 0;
+static zip_entry_t  zip_entries[ZIP_ENTRIES];
+static char         zip_names[ZIP_NAMES_SIZE];
+static unsigned int zip_count = 0;
+static unsigned int zip_dirpos = 0;
+// the index is kept after leaving the archive, for going back to it
+static uint32_t     zip_index_cluster = 0;
+static FSIZE_t      zip_index_size = 0;
+
+// member streaming
+static uint32_t      zip_remain;  // compressed bytes left
+static uint32_t      zip_written;
+static unsigned long zip_crc;
+static zip_write_t   zip_write;
+
+static uint16_t zip_get16(const unsigned char *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t zip_get32(const unsigned char *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+char zip_is_archive(const char *name) {
+  const char *ext = GetExtension(name);
+  return ext && !_strnicmp(ext, "zip", 4);
+}
+
+char zip_active(void) {
+  return zip_opened;
+}
+
+uint32_t zip_cluster(void) {
+  return zip_index_cluster;
+}
+
+void zip_close(void) {
+  if (zip_opened) f_close(&zip_file);
+  zip_opened = 0;
+}
+
+// find the end of central directory record, it's only followed by the comment
+static char zip_find_end(uint32_t *cd_offset, unsigned int *entries) {
+  FSIZE_t size = f_size(&zip_file);
+  unsigned int len = (size > SECTOR_BUFFER_SIZE) ? SECTOR_BUFFER_SIZE : size;
+  unsigned char *p;
+  UINT br;
+
+  if (len < ZIP_END_SIZE) return 0;
+  if (f_lseek(&zip_file, size - len) != FR_OK) return 0;
+  if (f_read(&zip_file, sector_buffer, len, &br) != FR_OK || br != len) return 0;
+
+  for (p = sector_buffer + len - ZIP_END_SIZE; p >= sector_buffer; p--) {
+    if (zip_get32(p) == ZIP_END_SIG) {
+      // no multi-disk or zip64 archives
+      if (zip_get16(p + 4) || zip_get16(p + 6)) return 0;
+      *entries = zip_get16(p + 10);
+      *cd_offset = zip_get32(p + 16);
+      return *cd_offset != 0xffffffff;
+    }
+  }
+  return 0;
+}
+
+static char zip_index(void) {
+  unsigned char h[ZIP_CENTRAL_SIZE];
+  unsigned int entries, names = 0;
+  uint32_t cd_offset;
+  UINT br;
+
+  zip_count = 0;
+  if (!zip_find_end(&cd_offset, &entries)) return 0;
+  if (f_lseek(&zip_file, cd_offset) != FR_OK) return 0;
+
+  while (entries--) {
+    unsigned int nlen, skip;
+    zip_entry_t *e = &zip_entries[zip_count];
+    char *name = zip_names + names;
+
+    if (f_read(&zip_file, h, ZIP_CENTRAL_SIZE, &br) != FR_OK || br != ZIP_CENTRAL_SIZE ||
+        zip_get32(h) != ZIP_CENTRAL_SIG)
+      return 0;
+
+    nlen = zip_get16(h + 28);
+    skip = zip_get16(h + 30) + zip_get16(h + 32); // extra field and comment
+    if (zip_count == ZIP_ENTRIES || names + nlen + 1 > ZIP_NAMES_SIZE) {
+      iprintf("ZIP: index full, %d members listed\n", zip_count);
+      break;
+    }
+    if (!nlen || nlen > FF_LFN_BUF) {
+      skip += nlen;
+    } else {
+      if (f_read(&zip_file, name, nlen, &br) != FR_OK || br != nlen) return 0;
+      name[nlen] = 0;
+      // no directories, encrypted members or other compression methods
+      if (name[nlen - 1] != '/' && !(zip_get16(h + 8) & 1) &&
+          (zip_get16(h + 10) == ZIP_STORED || zip_get16(h + 10) == ZIP_DEFLATED) &&
+          zip_get32(h + 20) != 0xffffffff && zip_get32(h + 24) != 0xffffffff) {
+        e->method = zip_get16(h + 10);
+        e->crc = zip_get32(h + 16);
+        e->csize = zip_get32(h + 20);
+        e->size = zip_get32(h + 24);
+        e->offset = zip_get32(h + 42);
+        e->name = names;
+        names += nlen + 1;
+        zip_count++;
+      }
+    }
+    if (skip && f_lseek(&zip_file, f_tell(&zip_file) + skip) != FR_OK) return 0;
+  }
+  return 1;
+}
+
+char zip_open(const char *name) {
+  zip_close();
+  if (f_open(&zip_file, name, FA_READ) != FR_OK) return 0;
+
+  if (zip_file.obj.sclust != zip_index_cluster || f_size(&zip_file) != zip_index_size) {
+    DISKLED_ON
+    zip_index_cluster = 0;
+    if (!zip_index()) {
+      DISKLED_OFF
+      iprintf("ZIP: %s is not a supported archive\n", name);
+      f_close(&zip_file);
+      return 0;
+    }
+    DISKLED_OFF
+    zip_index_cluster = zip_file.obj.sclust;
+    zip_index_size = f_size(&zip_file);
+  }
+  iprintf("ZIP: %s, %d members\n", name, zip_count);
+  zip_opened = 1;
+  zip_dirpos = 0;
+  return 1;
+}
+
+void zip_rewinddir(void) {
+  zip_dirpos = 0;
+}
+
+char zip_readdir(FILINFO *fil) {
+  zip_entry_t *e;
+
+  if (zip_dirpos >= zip_count) {
+    fil->fname[0] = 0;
+    return 0;
+  }
+  e = &zip_entries[zip_dirpos++];
+  strcpy(fil->fname, zip_names + e->name);
+  fil->altname[0] = 0;
+  fil->fattrib = AM_ARC;
+  fil->fsize = e->size;
+  fil->fclust = 0;
+  fil->fdate = fil->ftime = 0;
+  return 1;
+}
+
+FIL *zip_member_open(const char *name, zip_entry_t **entry) {
+  unsigned char h[ZIP_LOCAL_SIZE];
+  UINT br;
+
+  if (!zip_opened) return 0;
+  for (unsigned int i = 0; i < zip_count; i++) {
+    zip_entry_t *e = &zip_entries[i];
+    if (strcmp(zip_names + e->name, name)) continue;
+
+    // the local header has its own extra field length
+    if (f_lseek(&zip_file, e->offset) != FR_OK ||
+        f_read(&zip_file, h, ZIP_LOCAL_SIZE, &br) != FR_OK || br != ZIP_LOCAL_SIZE ||
+        zip_get32(h) != ZIP_LOCAL_SIG)
+      break;
+    if (f_lseek(&zip_file, e->offset + ZIP_LOCAL_SIZE + zip_get16(h + 26) + zip_get16(h + 28)) != FR_OK)
+      break;
+    *entry = e;
+    return &zip_file;
+  }
+  iprintf("ZIP: cannot open %s\n", name);
+  return 0;
+}
+
+static unsigned int zip_read_data(unsigned char *buf, unsigned int len) {
+  UINT br;
+
+  if (len > zip_remain) len = zip_remain;
+  DISKLED_ON
+  if (f_read(&zip_file, buf, len, &br) != FR_OK) br = 0;
+  DISKLED_OFF
+  zip_remain -= br;
+  return br;
+}
+
+static char zip_write_data(const unsigned char *buf, unsigned int len) {
+  zip_crc = CalculateCRC32(zip_crc, (unsigned char*)buf, len);
+  zip_written += len;
+  return zip_write(buf, len);
+}
+
+char zip_member_read(zip_entry_t *entry, zip_write_t write) {
+  char res = ZIP_OK;
+
+  zip_remain = entry->csize;
+  zip_written = 0;
+  zip_crc = -1;
+  zip_write = write;
+
+  if (entry->method == ZIP_STORED) {
+    while (zip_remain) {
+      unsigned int len = zip_read_data(sector_buffer, SECTOR_BUFFER_SIZE);
+      if (!len) {
+        res = ZIP_ERR_READ;
+        break;
+      }
+      if (!zip_write_data(sector_buffer, len)) {
+        res = ZIP_ERR_WRITE;
+        break;
+      }
+    }
+  } else {
+    switch (inflate_stream(inflate_window, sector_buffer, SECTOR_BUFFER_SIZE, zip_read_data, zip_write_data)) {
+      case INFLATE_OK:        break;
+      case INFLATE_ERR_READ:  res = ZIP_ERR_READ; break;
+      case INFLATE_ERR_WRITE: res = ZIP_ERR_WRITE; break;
+      default:                res = ZIP_ERR_FORMAT; break;
+    }
+  }
+
+  if (res == ZIP_OK && (zip_written != entry->size || (~zip_crc & 0xffffffff) != entry->crc))
+    res = ZIP_ERR_CRC;
+  if (res != ZIP_OK)
+    iprintf("ZIP: member read failed (%d)\n", res);
+  return res;
+}
@@ -0,0 +1,53 @@
+#ifndef ZIP_H
+#define ZIP_H
+
+// Zip archives in the file selector. The central directory is indexed
+// once when the archive is entered, then the members are listed like the
+// files of a directory and streamed from the archive when selected.
+
+#include <inttypes.h>
+#include "FatFs/ff.h"
+
+#define ZIP_ENTRIES    256    // max. members of an archive, more are not listed
+#define ZIP_NAMES_SIZE 8192   // space for the member names
+
+#define ZIP_STORED   0
+#define ZIP_DEFLATED 8
+
+#define ZIP_OK         0
+#define ZIP_ERR_READ   1
+#define ZIP_ERR_FORMAT 2
+#define ZIP_ERR_CRC    3
+#define ZIP_ERR_WRITE  4
+
+typedef struct
+{
+  FSIZE_t  offset;   // of the local header
+  uint32_t csize;
+  uint32_t size;
+  uint32_t crc;
+  uint16_t name;     // in the name pool
+  uint8_t  method;
+} zip_entry_t;
+
+// receives the next part of the member, returns 0 to abort
+typedef char (*zip_write_t)(const unsigned char *buf, unsigned int len);
+
+char zip_is_archive(const char *name);
+char zip_active(void);
+// index the archive in the current directory
+char zip_open(const char *name);
+void zip_close(void);
+// cluster of the archive, to find it again in the parent directory
+uint32_t zip_cluster(void);
+
+// directory listing of the members
+void zip_rewinddir(void);
+char zip_readdir(FILINFO *fil);
+
+// look up a member and seek the archive to its data
+FIL *zip_member_open(const char *name, zip_entry_t **entry);
+// stream the uncompressed member to write(), with CRC check
+char zip_member_read(zip_entry_t *entry, zip_write_t write);
+
+#endif // ZIP_H